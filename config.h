@@ -0,0 +1,8 @@
+/* Automatically generated by configure - do not modify */
+#ifndef CONFIG_TCCDIR
+# define CONFIG_TCCDIR "/usr/local/lib/tcc"
+#endif
+#define GCC_MAJOR 12
+#define GCC_MINOR 2
+#define HOST_X86_64 1
+#define TCC_VERSION "0.9.26"
@@ -557,6 +557,7 @@ typedef struct
 #define PT_PHDR         6               /* Entry for header table itself */
 #define PT_NUM          7               /* Number of defined types.  */
 #define PT_LOOS         0x60000000      /* Start of OS-specific */
+#define PT_GNU_EH_FRAME 0x6474e550      /* GCC .eh_frame_hdr segment */
 #define PT_HIOS         0x6fffffff      /* End of OS-specific */
 #define PT_LOPROC       0x70000000      /* Start of processor-specific */
 #define PT_HIPROC       0x7fffffff      /* End of processor-specific */
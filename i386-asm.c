@@ -239,6 +239,50 @@ static const uint16_t op0_codes[] = {
 #endif
 };
 
+/* for each instruction token below TOK_ASM_alllast, the range of
+   asm_instrs[] entries which can match it: [first, last + 1), empty if
+   the second value is 0 */
+#define NB_ASM_INDEX (TOK_ASM_alllast + 1 - TOK_IDENT)
+static uint16_t asm_index[NB_ASM_INDEX][2];
+static int asm_index_done;
+
+/* the tokens an entry can match are the ones accepted by the tests at
+   the start of the matching loop in asm_opcode() */
+static void asm_index_init(void)
+{
+    const ASMInstr *pa;
+    int i, t, n, step;
+
+    for(pa = asm_instrs; pa->sym != 0; pa++) {
+        i = pa - asm_instrs;
+        step = 1;
+        if (pa->instr_type & OPC_FARITH) {
+            n = 8 * 6;
+            step = 6;
+        } else if (pa->instr_type & OPC_ARITH) {
+            n = 8 * NBWLX;
+        } else if (pa->instr_type & OPC_SHIFT) {
+            n = 7 * NBWLX;
+        } else if (pa->instr_type & OPC_TEST) {
+            n = NB_TEST_OPCODES;
+        } else if (pa->instr_type & OPC_B) {
+            n = NBWLX;
+        } else if (pa->instr_type & OPC_WLX) {
+            n = NBWLX - 1;
+        } else {
+            n = 1;
+        }
+        for(t = pa->sym - TOK_IDENT; t < pa->sym - TOK_IDENT + n; t += step) {
+            if ((unsigned)t >= NB_ASM_INDEX)
+                continue;
+            if (asm_index[t][1] == 0)
+                asm_index[t][0] = i;
+            asm_index[t][1] = i + 1;
+        }
+    }
+    asm_index_done = 1;
+}
+
 static inline int get_reg_shift(TCCState *s1)
 {
     int shift, v;
@@ -578,7 +622,7 @@ static inline void asm_modrm(int reg, Operand *op)
 
 ST_FUNC void asm_opcode(TCCState *s1, int opcode)
 {
-    const ASMInstr *pa;
+    const ASMInstr *pa, *pa_end;
     int i, modrm_index, reg, v, op1, is_short_jmp, seg_prefix;
     int nb_ops, s;
     Operand ops[MAX_OPERANDS], *pop;
@@ -625,9 +669,17 @@ ST_FUNC void asm_opcode(TCCState *s1, int opcode)
     is_short_jmp = 0;
     s = 0; /* avoid warning */
 
-    /* optimize matching by using a lookup table (no hashing is needed
-       !) */
-    for(pa = asm_instrs; pa->sym != 0; pa++) {
+    /* only look at the entries which can match the opcode */
+    if (!asm_index_done)
+        asm_index_init();
+    pa = asm_instrs;
+    pa_end = asm_instrs + sizeof(asm_instrs) / sizeof(ASMInstr) - 1;
+    i = opcode - TOK_IDENT;
+    if ((unsigned)i < NB_ASM_INDEX) {
+        pa_end = asm_instrs + asm_index[i][1];
+        pa = asm_index[i][1] ? asm_instrs + asm_index[i][0] : pa_end;
+    }
+    for(; pa < pa_end; pa++) {
         s = 0;
         if (pa->instr_type & OPC_FARITH) {
             v = opcode - pa->sym;
@@ -695,7 +747,7 @@ ST_FUNC void asm_opcode(TCCState *s1, int opcode)
         break;
     next: ;
     }
-    if (pa->sym == 0) {
+    if (pa == pa_end) {
         if (opcode >= TOK_ASM_first && opcode <= TOK_ASM_last) {
             int b;
             b = op0_codes[opcode - TOK_ASM_first];
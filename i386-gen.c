@@ -54,6 +54,13 @@ enum {
 /* defined if function parameters must be evaluated in reverse order */
 #define INVERT_FUNC_PARAMS
 
+/* defined if memcpy()/memset() of constant size can be generated
+   inline (see gen_memcpy() and gen_memset()). Up to INLINE_MEMOPS_MAX
+   bytes are moved with unrolled loads and stores, above that with
+   'rep movs/stos'. */
+#define INLINE_MEMOPS
+#define INLINE_MEMOPS_MAX 64
+
 /* defined if structures are passed as pointers. Otherwise structures
    are directly pushed on stack. */
 /* #define FUNC_STRUCT_PARAM_AS_PTR */
@@ -81,6 +88,17 @@ enum {
 #define R_JMP_SLOT  R_386_JMP_SLOT
 #define R_COPY      R_386_COPY
 
+#ifndef TCC_TARGET_PE
+/* DWARF register numbers and prolog layout for -gdwarf call frame info:
+   'push %ebp' ends at +1, 'mov %esp,%ebp' at +3 */
+#define DWARF_REG_SP    4
+#define DWARF_REG_FP    5
+#define DWARF_REG_RA    8
+#define DWARF_CFA_PUSH  1
+#define DWARF_CFA_FRAME 3
+#define DWARF_R_PC32    R_386_PC32
+#endif
+
 #define ELF_START_ADDR 0x08048000
 #define ELF_PAGE_SIZE  0x1000
 
@@ -576,6 +594,7 @@ ST_FUNC void gfunc_prolog(CType *func_type)
     /* leave some room for bound checking code */
     if (tcc_state->do_bounds_check) {
         oad(0xb8, 0); /* lbound section pointer */
+        o(0x9066); /* frame pointer */
         oad(0xb8, 0); /* call to function */
         func_bound_offset = lbounds_section->data_offset;
     }
@@ -610,6 +629,7 @@ ST_FUNC void gfunc_epilog(void)
         greloc(cur_text_section, sym_data,
                ind + 1, R_386_32);
         oad(0xb8, 0); /* mov %eax, xxx */
+        o(0xea89); /* mov %ebp, %edx */
         gen_static_call(TOK___bound_local_new);
 
         ind = saved_ind;
@@ -618,10 +638,14 @@ ST_FUNC void gfunc_epilog(void)
         greloc(cur_text_section, sym_data,
                ind + 1, R_386_32);
         oad(0xb8, 0); /* mov %eax, xxx */
+        o(0xea89); /* mov %ebp, %edx */
         gen_static_call(TOK___bound_local_delete);
 
         o(0x585a); /* restore returned value, if any */
     }
+#endif
+#ifdef CONFIG_TCC_DWARF
+    func_leave_ind = ind;
 #endif
     o(0xc9); /* leave */
     if (func_ret_sub == 0) {
@@ -1028,6 +1052,17 @@ ST_FUNC void ggoto(void)
 /* bound check support functions */
 #ifdef CONFIG_TCC_BCHECK
 
+/* call __bound_index_error() with the address of the check and the
+   frame pointer, it does not return */
+ST_FUNC void gen_bounded_index_error(void)
+{
+    o(0xe8); /* call 1f; 1: pop %eax */
+    gen_le32(0);
+    o(0x58);
+    o(0xea89); /* mov %ebp, %edx */
+    gen_static_call(TOK___bound_index_error);
+}
+
 /* generate a bounded pointer addition */
 ST_FUNC void gen_bounded_ptr_add(void)
 {
@@ -1125,6 +1160,92 @@ ST_FUNC void gen_vla_alloc(CType *type, int align) {
 #endif
 }
 
+/* store 'size' bytes of register 'r' to 'off'(rd), loading them from
+   'off'(rs) first if 'rs' is >= 0. All offsets must fit in a signed
+   byte. */
+static void gen_mem_chunks(int size, int r, int rs, int rd)
+{
+    int n, off;
+
+    for (off = 0; size > 0; off += n, size -= n) {
+        n = size >= 4 ? 4 : size >= 2 ? 2 : 1;
+        if (rs >= 0) {
+            if (n == 2)
+                o(0x66);
+            o(n == 1 ? 0x8a : 0x8b); /* mov off(rs),r */
+            g(0x40 + r * 8 + rs);
+            g(off);
+        }
+        if (n == 2)
+            o(0x66);
+        o(n == 1 ? 0x88 : 0x89); /* mov r,off(rd) */
+        g(0x40 + r * 8 + rd);
+        g(off);
+    }
+}
+
+/* copy 'size' bytes from the address in vtop to the address in
+   vtop[-1] without calling memcpy(). Both values are popped. Small
+   copies are unrolled, larger ones use 'rep movsl'. */
+ST_FUNC void gen_memcpy(int size)
+{
+    int rs, rd;
+
+    save_regs(2);
+    gv2(RC_INT, RC_INT);
+    rd = vtop[-1].r & VT_VALMASK;
+    rs = vtop->r & VT_VALMASK;
+    if (size > INLINE_MEMOPS_MAX) {
+        o(0x5756); /* push %esi; push %edi */
+        o(0xc689 + rs * 0x800); /* mov rs,%esi */
+        o(0xc789 + rd * 0x800); /* mov rd,%edi */
+        oad(0xb9, size >> 2); /* mov $size/4,%ecx */
+        o(0xa5f3); /* rep movsl */
+        if (size & 2)
+            o(0xa566); /* movsw */
+        if (size & 1)
+            o(0xa4); /* movsb */
+        o(0x5e5f); /* pop %edi; pop %esi */
+    } else {
+        gen_mem_chunks(size, get_reg(RC_INT), rs, rd);
+    }
+    vtop -= 2;
+}
+
+/* fill 'size' bytes at the address in vtop with the byte 'c' without
+   calling memset(). The address is popped. */
+ST_FUNC void gen_memset(int size, int c)
+{
+    int r, rd;
+    unsigned int pattern;
+
+    pattern = (uint8_t)c * 0x01010101;
+    save_regs(1);
+    rd = gv(RC_INT);
+    if (size > INLINE_MEMOPS_MAX) {
+        o(0x57); /* push %edi */
+        o(0xc789 + rd * 0x800); /* mov rd,%edi */
+        oad(0xb8, pattern); /* mov $pattern,%eax */
+        oad(0xb9, size >> 2); /* mov $size/4,%ecx */
+        o(0xabf3); /* rep stosl */
+        if (size & 2)
+            o(0xab66); /* stosw */
+        if (size & 1)
+            o(0xaa); /* stosb */
+        o(0x5f); /* pop %edi */
+    } else {
+        r = get_reg(RC_INT);
+        if (pattern == 0) {
+            o(0x31); /* xor r,r */
+            o(0xc0 + r * 9);
+        } else {
+            oad(0xb8 + r, pattern); /* mov $pattern,r */
+        }
+        gen_mem_chunks(size, r, -1, rd);
+    }
+    vtop--;
+}
+
 /* end of X86 code generator */
 /*************************************************************/
 #endif
@@ -301,23 +301,31 @@ typedef struct type {                                      \
     basetype rem;                                          \
 } type
 
-#define AEABI_UXDIVMOD(name,type, rettype, typemacro)                     \
+/* shift and subtract division: the divisor is first aligned with the
+   top bit of the numerator, then each step yields one quotient bit */
+#define AEABI_UXDIVMOD(name,type, rettype)                                \
 static inline rettype aeabi_ ## name (type num, type den)                 \
 {                                                                         \
     rettype ret;                                                          \
-    type quot = 0;                                                        \
+    type quot = 0, bit = 1;                                               \
                                                                           \
-    /* Increase quotient while it is less than numerator */               \
-    while (num >= den) {                                                  \
-        type q = 1;                                                       \
-                                                                          \
-        /* Find closest power of two */                                   \
-        while ((q << 1) * den <= num && q * den <= typemacro ## _MAX / 2) \
-            q <<= 1;                                                      \
-                                                                          \
-        /* Compute difference between current quotient and numerator */   \
-        num -= q * den;                                                   \
-        quot += q;                                                        \
+    if (den == 0) {                                                       \
+        /* do not loop forever */                                         \
+        ret.quot = ~(type)0;                                              \
+        ret.rem = num;                                                    \
+        return ret;                                                       \
+    }                                                                     \
+    while (!(den >> (sizeof(type) * 8 - 1)) && (den << 1) <= num) {       \
+        den <<= 1;                                                        \
+        bit <<= 1;                                                        \
+    }                                                                     \
+    while (bit) {                                                         \
+        if (num >= den) {                                                 \
+            num -= den;                                                   \
+            quot |= bit;                                                  \
+        }                                                                 \
+        den >>= 1;                                                        \
+        bit >>= 1;                                                        \
     }                                                                     \
     ret.quot = quot;                                                      \
     ret.rem = num;                                                        \
@@ -363,7 +371,24 @@ REGS_RETURN(ulldiv_t, ulldiv_t)
 REGS_RETURN(idiv_t, idiv_t)
 REGS_RETURN(uidiv_t, uidiv_t)
 
-AEABI_UXDIVMOD(uldivmod, unsigned long long, ulldiv_t, ULONG)
+AEABI_UXDIVMOD(uidivmod, unsigned, uidiv_t)
+AEABI_UXDIVMOD(uldivmod_64, unsigned long long, ulldiv_t)
+
+static inline ulldiv_t aeabi_uldivmod(unsigned long long num,
+                                      unsigned long long den)
+{
+    ulldiv_t ret;
+    uidiv_t ret32;
+
+    /* 32 bit operands: the loop runs on single registers */
+    if (!((num | den) >> 32)) {
+        ret32 = aeabi_uidivmod(num, den);
+        ret.quot = ret32.quot;
+        ret.rem = ret32.rem;
+        return ret;
+    }
+    return aeabi_uldivmod_64(num, den);
+}
 
 __AEABI_XDIVMOD(ldivmod, long long, uldivmod, lldiv_t, ulldiv_t, LLONG)
 
@@ -419,8 +444,6 @@ void __aeabi_lasr(unsigned_int_struct val, int shift)
 
 /* Integer division functions */
 
-AEABI_UXDIVMOD(uidivmod, unsigned, uidiv_t, UINT)
-
 int __aeabi_idiv(int numerator, int denominator)
 {
     unsigned num, den;
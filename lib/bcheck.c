@@ -28,6 +28,9 @@
 #if !defined(_WIN32)
 #include <unistd.h>
 #endif
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
 
 /* #define BOUND_DEBUG */
 
@@ -48,14 +51,29 @@
 #undef HAVE_MEMALIGN
 #endif
 
+#if defined(__x86_64__)
+/* tcc renames malloc() and friends to __bound_malloc() etc. instead */
+#undef CONFIG_TCC_MALLOC_HOOKS
+/* the page table covers the 47 bit user address space. It is mapped
+   lazily and a NULL entry stands for an empty page. The code generated
+   by tcc reads it directly (see gen_bounded_ptr_add()) */
+#define BOUND_SPARSE
+#undef BOUND_STATIC
+#define BOUND_ADDR_BITS 47
+#define BOUND_T1_BITS 25
+#define BOUND_T2_BITS 14
+#define BOUND_E_BITS  5
+#else
+#define BOUND_ADDR_BITS 32
 #define BOUND_T1_BITS 13
 #define BOUND_T2_BITS 11
-#define BOUND_T3_BITS (32 - BOUND_T1_BITS - BOUND_T2_BITS)
+#define BOUND_E_BITS  4
+#endif
+#define BOUND_T3_BITS (BOUND_ADDR_BITS - BOUND_T1_BITS - BOUND_T2_BITS)
 
 #define BOUND_T1_SIZE (1 << BOUND_T1_BITS)
 #define BOUND_T2_SIZE (1 << BOUND_T2_BITS)
 #define BOUND_T3_SIZE (1 << BOUND_T3_BITS)
-#define BOUND_E_BITS  4
 
 #define BOUND_T23_BITS (BOUND_T2_BITS + BOUND_T3_BITS)
 #define BOUND_T23_SIZE (1 << BOUND_T23_BITS)
@@ -64,7 +82,7 @@
 /* this pointer is generated when bound check is incorrect */
 #define INVALID_POINTER ((void *)(-2))
 /* size of an empty region */
-#define EMPTY_SIZE        0xffffffff
+#define EMPTY_SIZE        ((unsigned long)-1)
 /* size of an invalid region */
 #define INVALID_SIZE      0
 
@@ -75,15 +93,42 @@ typedef struct BoundEntry {
     unsigned long is_invalid; /* true if pointers outside region are invalid */
 } BoundEntry;
 
+/* Thread safety: the checks take no lock. Writers serialize on a lock
+   per group of T1 entries and keep its sequence count odd while they
+   change the regions. A reader copies the region it finds and starts
+   again if the count changed meanwhile, the inline checks generated
+   by tcc for x86_64 do the same. List entries are recycled but
+   never given back to the libc, so that a reader following a stale
+   'next' pointer still reads a BoundEntry. */
+#define BOUND_LOCK_BITS 6
+#define BOUND_LOCK_SIZE (1 << BOUND_LOCK_BITS)
+
+typedef struct BoundLock {
+    volatile unsigned long seq;
+    volatile int lock;
+    char pad[64 - 2 * sizeof(unsigned long)]; /* one per cache line */
+} BoundLock;
+
+/* the lookup cache needs the thread pointer of x86 Linux */
+#if defined(__linux__) && !defined(__TINYC__)
+#define BOUND_CACHE
+#define BOUND_CACHE_BITS 6
+#define BOUND_CACHE_SIZE (1 << BOUND_CACHE_BITS)
+#endif
+
 /* external interface */
 void __bound_init(void);
 void __bound_new_region(void *p, unsigned long size);
 int __bound_delete_region(void *p);
 
+#if defined(__i386__)
 #define FASTCALL __attribute__((regparm(3)))
+#else
+#define FASTCALL
+#endif
 
 void *__bound_malloc(size_t size, const void *caller);
-void *__bound_memalign(size_t size, size_t align, const void *caller);
+void *__bound_memalign(size_t align, size_t size, const void *caller);
 void __bound_free(void *ptr, const void *caller);
 void *__bound_realloc(void *ptr, size_t size, const void *caller);
 static void *libc_malloc(size_t size);
@@ -102,44 +147,246 @@ static void *saved_memalign_hook;
 extern char __bounds_start; /* start of static bounds table */
 /* error message, just for TCC */
 const char *__bound_error_msg;
+/* where the check code calling __bound_index_error() was, as its
+   frames cannot be found from the error itself */
+unsigned long __bound_error_pc, __bound_error_fp;
 
 /* runtime error output */
 extern void rt_error(unsigned long pc, const char *fmt, ...);
 
 #ifdef BOUND_STATIC
 static BoundEntry *__bound_t1[BOUND_T1_SIZE]; /* page table */
+#elif defined(BOUND_SPARSE)
+BoundEntry **__bound_t1; /* page table */
 #else
 static BoundEntry **__bound_t1; /* page table */
 #endif
 static BoundEntry *__bound_empty_t2;   /* empty page, for unused pages */
 static BoundEntry *__bound_invalid_t2; /* invalid page, for invalid pointers */
 
+#ifdef BOUND_SPARSE
+BoundLock __bound_locks[BOUND_LOCK_SIZE]; /* read by the inline checks */
+#else
+static BoundLock __bound_locks[BOUND_LOCK_SIZE];
+#endif
+static volatile int bound_pool_lock; /* protects bound_free_list */
+static BoundEntry *bound_free_list;  /* recycled list entries */
+#ifdef CONFIG_TCC_MALLOC_HOOKS
+static volatile int bound_hook_lock; /* held while the hooks are off */
+#endif
+
+/* the last blocks freed are given back to the libc only later, so
+   that freeing one again is seen, instead of being taken for memory
+   the libc allocated itself or gave out again */
+#define BOUND_FREED_SIZE 64
+static volatile int bound_freed_lock; /* protects bound_freed */
+static void *bound_freed[BOUND_FREED_SIZE];
+static int bound_freed_index;
+
+#ifdef BOUND_CACHE
+/* last region found by a thread and the lock count it was valid for.
+   tcc cannot relocate thread local variables in a -run image, so each
+   thread claims a slot indexed by its thread pointer instead */
+typedef struct BoundCache {
+    volatile unsigned long owner;
+    BoundEntry r;
+    BoundLock *l;
+    unsigned long seq;
+} BoundCache;
+
+static BoundCache bound_caches[BOUND_CACHE_SIZE];
+#endif
+
+/* force compiler to perform stores coded up to this point */
+#define barrier()   __asm__ __volatile__ ("": : : "memory")
+
+/* x86 only reorders a store with a later load. The seq counts and the
+   entries are only read by the checkers, so compiler barriers suffice
+   on top of the xchg of the locks */
+static inline int bound_xchg(volatile int *p, int v)
+{
+    __asm__ __volatile__ ("xchgl %0, %1"
+                          : "=r" (v), "=m" (*p)
+                          : "0" (v), "m" (*p)
+                          : "memory");
+    return v;
+}
+
+static void bound_spin_lock(volatile int *p)
+{
+    while (bound_xchg(p, 1)) {
+        while (*p)
+            ;
+    }
+}
+
+static void bound_spin_unlock(volatile int *p)
+{
+    barrier();
+    *p = 0;
+}
+
+/* lock group 'i' for writing */
+static void bound_lock(int i)
+{
+    BoundLock *l = &__bound_locks[i];
+    bound_spin_lock(&l->lock);
+    l->seq++;
+    barrier();
+}
+
+static void bound_unlock(int i)
+{
+    BoundLock *l = &__bound_locks[i];
+    barrier();
+    l->seq++;
+    bound_spin_unlock(&l->lock);
+}
+
+/* true if group 'i' holds one of the T1 entries t1_start ... t1_end */
+static inline int bound_lock_used(int i, int t1_start, int t1_end)
+{
+    return t1_end - t1_start >= BOUND_LOCK_SIZE - 1
+        || ((i - t1_start) & (BOUND_LOCK_SIZE - 1)) <= t1_end - t1_start;
+}
+
+/* lock the groups of T1 entries t1_start ... t1_end, always in the
+   same order */
+static void bound_lock_range(int t1_start, int t1_end)
+{
+    int i;
+    for(i = 0; i < BOUND_LOCK_SIZE; i++)
+        if (bound_lock_used(i, t1_start, t1_end))
+            bound_lock(i);
+}
+
+static void bound_unlock_range(int t1_start, int t1_end)
+{
+    int i;
+    for(i = 0; i < BOUND_LOCK_SIZE; i++)
+        if (bound_lock_used(i, t1_start, t1_end))
+            bound_unlock(i);
+}
+
+#ifdef BOUND_CACHE
+/* return the cache of the current thread, NULL if another thread
+   owns its slot */
+static inline BoundCache *bound_cache(void)
+{
+    unsigned long tp;
+    BoundCache *c;
+
+#ifdef __x86_64__
+    __asm__ ("movq %%fs:0, %0" : "=r" (tp));
+#else
+    __asm__ ("movl %%gs:0, %0" : "=r" (tp));
+#endif
+    c = &bound_caches[((unsigned)(tp >> 12) * 2654435761u)
+                      >> (32 - BOUND_CACHE_BITS)];
+    if (c->owner == tp
+        || (c->owner == 0 && __sync_bool_compare_and_swap(&c->owner, 0, tp)))
+        return c;
+    return NULL;
+}
+#endif
+
+/* change an entry. The caller holds the lock of its group, so a
+   checker reading the entry meanwhile finds the sequence count of the
+   group odd or changed and reads it again. */
+static inline void set_entry(BoundEntry *e,
+                             unsigned long start, unsigned long size)
+{
+    e->start = start;
+    e->size = size;
+}
+
+/* return the first entry of the list that holds 'addr' */
+static inline BoundEntry *bound_entry(unsigned long addr)
+{
+    BoundEntry *page;
+
+#ifdef BOUND_SPARSE
+    if (addr >> BOUND_ADDR_BITS)
+        return __bound_invalid_t2;
+    page = __bound_t1[addr >> (BOUND_T2_BITS + BOUND_T3_BITS)];
+    if (!page)
+        return __bound_empty_t2;
+#else
+    page = __bound_t1[addr >> (BOUND_T2_BITS + BOUND_T3_BITS)];
+#endif
+    return (BoundEntry *)((char *)page +
+                          ((addr >> (BOUND_T3_BITS - BOUND_E_BITS)) &
+                           ((BOUND_T2_SIZE - 1) << BOUND_E_BITS)));
+}
+
+/* return the entry of the list 'e1' holding 'p', or NULL. Only for
+   writers, the list must not change meanwhile. */
 static BoundEntry *__bound_find_region(BoundEntry *e1, void *p)
 {
-    unsigned long addr, tmp;
     BoundEntry *e;
 
-    e = e1;
-    while (e != NULL) {
-        addr = (unsigned long)p;
-        addr -= e->start;
-        if (addr <= e->size) {
-            /* put region at the head */
-            tmp = e1->start;
-            e1->start = e->start;
-            e->start = tmp;
-            tmp = e1->size;
-            e1->size = e->size;
-            e->size = tmp;
-            return e1;
-        }
+    for(e = e1; e != NULL; e = e->next) {
+        if ((unsigned long)p - e->start <= e->size)
+            return e;
+    }
+    return NULL;
+}
+
+/* copy the region holding 'p' to 'r', or an empty or invalid region
+   if there is none. Safe against concurrent writers. */
+static void bound_find(void *p, BoundEntry *r)
+{
+    unsigned long addr = (unsigned long)p, seq;
+    BoundLock *l;
+    BoundEntry *e;
+#ifdef BOUND_CACHE
+    BoundCache *c;
+#endif
+
+    l = &__bound_locks[(addr >> BOUND_T23_BITS) & (BOUND_LOCK_SIZE - 1)];
+#ifdef BOUND_CACHE
+    c = bound_cache();
+    if (c && c->l == l && c->seq == l->seq
+        && addr - c->r.start <= c->r.size) {
+        *r = c->r;
+        return;
+    }
+#endif
+ retry:
+    seq = l->seq;
+    barrier();
+    if (seq & 1)
+        goto retry;
+    e = bound_entry(addr);
+    r->is_invalid = e->is_invalid;
+    for(;;) {
+        r->start = e->start;
+        r->size = e->size;
+        if (addr - r->start <= r->size)
+            break;
         e = e->next;
+        barrier();
+        if (l->seq != seq)
+            goto retry;
+        if (e == NULL) {
+            /* no entry found: return empty entry or invalid entry */
+            r->start = 0;
+            r->size = r->is_invalid ? INVALID_SIZE : EMPTY_SIZE;
+            break;
+        }
     }
-    /* no entry found: return empty entry or invalid entry */
-    if (e1->is_invalid)
-        return __bound_invalid_t2;
-    else
-        return __bound_empty_t2;
+    barrier();
+    if (l->seq != seq)
+        goto retry;
+#ifdef BOUND_CACHE
+    /* only regions: the empty and invalid entries, at 0, would match
+       any address */
+    if (c && r->start != 0) {
+        c->r = *r;
+        c->l = l;
+        c->seq = seq;
+    }
+#endif
 }
 
 /* print a bound error message */
@@ -156,25 +403,17 @@ static void bound_alloc_error(void)
 
 /* return '(p + offset)' for pointer arithmetic (a pointer can reach
    the end of a region in this case */
-void * FASTCALL __bound_ptr_add(void *p, int offset)
+void * FASTCALL __bound_ptr_add(void *p, long offset)
 {
-    unsigned long addr = (unsigned long)p;
-    BoundEntry *e;
+    unsigned long addr;
+    BoundEntry r;
 #if defined(BOUND_DEBUG)
-    printf("add: 0x%x %d\n", (int)p, offset);
+    printf("add: 0x%lx %ld\n", (unsigned long)p, offset);
 #endif
 
-    e = __bound_t1[addr >> (BOUND_T2_BITS + BOUND_T3_BITS)];
-    e = (BoundEntry *)((char *)e + 
-                       ((addr >> (BOUND_T3_BITS - BOUND_E_BITS)) & 
-                        ((BOUND_T2_SIZE - 1) << BOUND_E_BITS)));
-    addr -= e->start;
-    if (addr > e->size) {
-        e = __bound_find_region(e, p);
-        addr = (unsigned long)p - e->start;
-    }
-    addr += offset;
-    if (addr > e->size)
+    bound_find(p, &r);
+    addr = (unsigned long)p - r.start + offset;
+    if (addr > r.size)
         return INVALID_POINTER; /* return an invalid pointer */
     return p + offset;
 }
@@ -182,22 +421,14 @@ void * FASTCALL __bound_ptr_add(void *p, int offset)
 /* return '(p + offset)' for pointer indirection (the resulting must
    be strictly inside the region */
 #define BOUND_PTR_INDIR(dsize)                                          \
-void * FASTCALL __bound_ptr_indir ## dsize (void *p, int offset)        \
+void * FASTCALL __bound_ptr_indir ## dsize (void *p, long offset)       \
 {                                                                       \
-    unsigned long addr = (unsigned long)p;                              \
-    BoundEntry *e;                                                      \
+    unsigned long addr;                                                 \
+    BoundEntry r;                                                       \
                                                                         \
-    e = __bound_t1[addr >> (BOUND_T2_BITS + BOUND_T3_BITS)];            \
-    e = (BoundEntry *)((char *)e +                                      \
-                       ((addr >> (BOUND_T3_BITS - BOUND_E_BITS)) &      \
-                        ((BOUND_T2_SIZE - 1) << BOUND_E_BITS)));        \
-    addr -= e->start;                                                   \
-    if (addr > e->size) {                                               \
-        e = __bound_find_region(e, p);                                  \
-        addr = (unsigned long)p - e->start;                             \
-    }                                                                   \
-    addr += offset + dsize;                                             \
-    if (addr > e->size)                                                 \
+    bound_find(p, &r);                                                  \
+    addr = (unsigned long)p - r.start + offset + dsize;                 \
+    if (addr > r.size)                                                  \
         return INVALID_POINTER; /* return an invalid pointer */         \
     return p + offset;                                                  \
 }
@@ -209,17 +440,21 @@ BOUND_PTR_INDIR(8)
 BOUND_PTR_INDIR(12)
 BOUND_PTR_INDIR(16)
 
-/* return the frame pointer of the caller */
-#define GET_CALLER_FP(fp)\
-{\
-    fp = (unsigned long)__builtin_frame_address(1);\
+/* called by the code indexing a local array which is not registered
+   as a region when the index is out of the array. 'pc' and 'fp' are
+   its address and frame pointer */
+void FASTCALL __bound_index_error(unsigned long pc, unsigned long fp)
+{
+    __bound_error_pc = pc;
+    __bound_error_fp = fp;
+    bound_error("array index out of bounds");
 }
 
-/* called when entering a function to add all the local regions */
-void FASTCALL __bound_local_new(void *p1) 
+/* called when entering a function to add all the local regions. 'fp'
+   is the frame pointer of the function, passed by its prolog */
+void FASTCALL __bound_local_new(void *p1, unsigned long fp)
 {
-    unsigned long addr, size, fp, *p = p1;
-    GET_CALLER_FP(fp);
+    unsigned long addr, size, *p = p1;
     for(;;) {
         addr = p[0];
         if (addr == 0)
@@ -232,10 +467,9 @@ void FASTCALL __bound_local_new(void *p1)
 }
 
 /* called when leaving a function to delete all the local regions */
-void FASTCALL __bound_local_delete(void *p1) 
+void FASTCALL __bound_local_delete(void *p1, unsigned long fp)
 {
-    unsigned long addr, fp, *p = p1;
-    GET_CALLER_FP(fp);
+    unsigned long addr, *p = p1;
     for(;;) {
         addr = p[0];
         if (addr == 0)
@@ -268,27 +502,44 @@ static BoundEntry *__bound_new_page(void)
 static BoundEntry *bound_new_entry(void)
 {
     BoundEntry *e;
-    e = libc_malloc(sizeof(BoundEntry));
+
+    bound_spin_lock(&bound_pool_lock);
+    e = bound_free_list;
+    if (e)
+        bound_free_list = e->next;
+    bound_spin_unlock(&bound_pool_lock);
+    if (!e) {
+        e = libc_malloc(sizeof(BoundEntry));
+        if (!e)
+            bound_alloc_error();
+    }
     return e;
 }
 
+/* checkers may still read 'e': keep it for bound_new_entry() */
 static void bound_free_entry(BoundEntry *e)
 {
-    libc_free(e);
+    bound_spin_lock(&bound_pool_lock);
+    e->next = bound_free_list;
+    bound_free_list = e;
+    bound_spin_unlock(&bound_pool_lock);
 }
 
+/* the group of 'index' must be locked */
 static inline BoundEntry *get_page(int index)
 {
     BoundEntry *page;
     page = __bound_t1[index];
-    if (page == __bound_empty_t2 || page == __bound_invalid_t2) {
+    if (!page || page == __bound_empty_t2 || page == __bound_invalid_t2) {
         /* create a new page if necessary */
         page = __bound_new_page();
+        barrier();
         __bound_t1[index] = page;
     }
     return page;
 }
 
+#ifndef BOUND_SPARSE
 /* mark a region as being invalid (can only be used during init) */
 static void mark_invalid(unsigned long addr, unsigned long size)
 {
@@ -342,17 +593,29 @@ static void mark_invalid(unsigned long addr, unsigned long size)
         }
     }
 }
+#endif
 
 void __bound_init(void)
 {
     int i;
     BoundEntry *page;
+#ifndef BOUND_SPARSE
     unsigned long start, size;
-    int *p;
+#endif
+    unsigned long *p;
 
     /* save malloc hooks and install bound check hooks */
     install_malloc_hooks();
 
+#ifdef BOUND_SPARSE
+    /* 256 MB of address space, only the pages in use get memory */
+    __bound_t1 = mmap(NULL, BOUND_T1_SIZE * sizeof(BoundEntry *),
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (__bound_t1 == MAP_FAILED)
+        bound_alloc_error();
+    __bound_empty_t2 = __bound_new_page();
+#else
 #ifndef BOUND_STATIC
     __bound_t1 = libc_malloc(BOUND_T1_SIZE * sizeof(BoundEntry *));
     if (!__bound_t1)
@@ -362,6 +625,7 @@ void __bound_init(void)
     for(i=0;i<BOUND_T1_SIZE;i++) {
         __bound_t1[i] = __bound_empty_t2;
     }
+#endif
 
     page = __bound_new_page();
     for(i=0;i<BOUND_T2_SIZE;i++) {
@@ -373,10 +637,12 @@ void __bound_init(void)
     }
     __bound_invalid_t2 = page;
 
-    /* invalid pointer zone */
+#ifndef BOUND_SPARSE
+    /* invalid pointer zone (above the page table with BOUND_SPARSE) */
     start = (unsigned long)INVALID_POINTER & ~(BOUND_T23_SIZE - 1);
     size = BOUND_T23_SIZE;
     mark_invalid(start, size);
+#endif
 
 #if defined(CONFIG_TCC_MALLOC_HOOKS)
     /* malloc zone is also marked invalid. can only use that with
@@ -411,7 +677,7 @@ void __bound_init(void)
 #endif
 
     /* add all static bound check values */
-    p = (int *)&__bounds_start;
+    p = (unsigned long *)&__bounds_start;
     while (p[0] != 0) {
         __bound_new_region((void *)p[0], p[1]);
         p += 2;
@@ -429,17 +695,16 @@ static inline void add_region(BoundEntry *e,
     BoundEntry *e1;
     if (e->start == 0) {
         /* no region : add it */
-        e->start = start;
-        e->size = size;
+        set_entry(e, start, size);
     } else {
         /* already regions in the list: add it at the head */
         e1 = bound_new_entry();
         e1->start = e->start;
         e1->size = e->size;
         e1->next = e->next;
-        e->start = start;
-        e->size = size;
+        barrier();
         e->next = e1;
+        set_entry(e, start, size);
     }
 }
 
@@ -452,8 +717,13 @@ void __bound_new_region(void *p, unsigned long size)
 
     start = (unsigned long)p;
     end = start + size;
+#ifdef BOUND_SPARSE
+    if (end >> BOUND_ADDR_BITS)
+        return;
+#endif
     t1_start = start >> (BOUND_T2_BITS + BOUND_T3_BITS);
     t1_end = end >> (BOUND_T2_BITS + BOUND_T3_BITS);
+    bound_lock_range(t1_start, t1_end);
 
     /* start */
     page = get_page(t1_start);
@@ -474,38 +744,31 @@ void __bound_new_region(void *p, unsigned long size)
         e2 = (BoundEntry *)((char *)page + t2_end);
         if (e2 > e) {
             e++;
-            for(;e<e2;e++) {
-                e->start = start;
-                e->size = size;
-            }
+            for(;e<e2;e++)
+                set_entry(e, start, size);
             add_region(e, start, size);
         }
     } else {
         /* mark until end of page */
         e2 = page + BOUND_T2_SIZE;
         e++;
-        for(;e<e2;e++) {
-            e->start = start;
-            e->size = size;
-        }
+        for(;e<e2;e++)
+            set_entry(e, start, size);
         /* mark intermediate pages, if any */
         for(i=t1_start+1;i<t1_end;i++) {
             page = get_page(i);
             e2 = page + BOUND_T2_SIZE;
-            for(e=page;e<e2;e++) {
-                e->start = start;
-                e->size = size;
-            }
+            for(e=page;e<e2;e++)
+                set_entry(e, start, size);
         }
         /* last page */
         page = get_page(t1_end);
         e2 = (BoundEntry *)((char *)page + t2_end);
-        for(e=page;e<e2;e++) {
-            e->start = start;
-            e->size = size;
-        }
+        for(e=page;e<e2;e++)
+            set_entry(e, start, size);
         add_region(e, start, size);
     }
+    bound_unlock_range(t1_start, t1_end);
 }
 
 /* delete a region */
@@ -522,12 +785,10 @@ static inline void delete_region(BoundEntry *e,
         e1 = e->next;
         if (e1 == NULL) {
             /* no more region: mark it empty */
-            e->start = 0;
-            e->size = empty_size;
+            set_entry(e, 0, empty_size);
         } else {
             /* copy next region in head */
-            e->start = e1->start;
-            e->size = e1->size;
+            set_entry(e, e1->start, e1->size);
             e->next = e1->next;
             bound_free_entry(e1);
         }
@@ -554,31 +815,52 @@ static inline void delete_region(BoundEntry *e,
 /* return non zero if error */
 int __bound_delete_region(void *p)
 {
-    unsigned long start, end, addr, size, empty_size;
-    BoundEntry *page, *e, *e2;
-    int t1_start, t1_end, t2_start, t2_end, i;
+    unsigned long start, end, size, empty_size;
+    BoundEntry *page, *e, *e1, *e2;
+    int t1_start, t1_end, t2_start, t2_end, i, n;
 
     start = (unsigned long)p;
+#ifdef BOUND_SPARSE
+    if (start >> BOUND_ADDR_BITS)
+        return -1;
+#endif
     t1_start = start >> (BOUND_T2_BITS + BOUND_T3_BITS);
     t2_start = (start >> (BOUND_T3_BITS - BOUND_E_BITS)) & 
         ((BOUND_T2_SIZE - 1) << BOUND_E_BITS);
     
-    /* find region size */
-    page = __bound_t1[t1_start];
-    e = (BoundEntry *)((char *)page + t2_start);
-    addr = start - e->start;
-    if (addr > e->size)
-        e = __bound_find_region(e, p);
-    /* test if invalid region */
-    if (e->size == EMPTY_SIZE || (unsigned long)p != e->start) 
-        return -1;
+    /* find region size. The locks needed depend on it: lock again if
+       the region spans more T1 entries than locked */
+    t1_end = t1_start;
+    for(;;) {
+        bound_lock_range(t1_start, t1_end);
+        page = __bound_t1[t1_start];
+        e1 = NULL;
+#ifdef BOUND_SPARSE
+        if (page)
+#endif
+        {
+            e = (BoundEntry *)((char *)page + t2_start);
+            e1 = __bound_find_region(e, p);
+        }
+        /* test if invalid region */
+        if (!e1 || e1->size == EMPTY_SIZE || (unsigned long)p != e1->start) {
+            bound_unlock_range(t1_start, t1_end);
+            return -1;
+        }
+        size = e1->size;
+        end = start + size;
+        n = end >> (BOUND_T2_BITS + BOUND_T3_BITS);
+        if (n <= t1_end)
+            break;
+        bound_unlock_range(t1_start, t1_end);
+        t1_end = n;
+    }
     /* compute the size we put in invalid regions */
     if (e->is_invalid)
         empty_size = INVALID_SIZE;
     else
         empty_size = EMPTY_SIZE;
-    size = e->size;
-    end = start + size;
+    n = t1_end;
 
     /* now we can free each entry */
     t1_end = end >> (BOUND_T2_BITS + BOUND_T3_BITS);
@@ -591,39 +873,32 @@ int __bound_delete_region(void *p)
         e2 = (BoundEntry *)((char *)page + t2_end);
         if (e2 > e) {
             e++;
-            for(;e<e2;e++) {
-                e->start = 0;
-                e->size = empty_size;
-            }
+            for(;e<e2;e++)
+                set_entry(e, 0, empty_size);
             delete_region(e, p, empty_size);
         }
     } else {
         /* mark until end of page */
         e2 = page + BOUND_T2_SIZE;
         e++;
-        for(;e<e2;e++) {
-            e->start = 0;
-            e->size = empty_size;
-        }
+        for(;e<e2;e++)
+            set_entry(e, 0, empty_size);
         /* mark intermediate pages, if any */
         /* XXX: should free them */
         for(i=t1_start+1;i<t1_end;i++) {
             page = get_page(i);
             e2 = page + BOUND_T2_SIZE;
-            for(e=page;e<e2;e++) {
-                e->start = 0;
-                e->size = empty_size;
-            }
+            for(e=page;e<e2;e++)
+                set_entry(e, 0, empty_size);
         }
         /* last page */
         page = get_page(t1_end);
         e2 = (BoundEntry *)((char *)page + t2_end);
-        for(e=page;e<e2;e++) {
-            e->start = 0;
-            e->size = empty_size;
-        }
+        for(e=page;e<e2;e++)
+            set_entry(e, 0, empty_size);
         delete_region(e, p, empty_size);
     }
+    bound_unlock_range(t1_start, n);
     return 0;
 }
 
@@ -631,25 +906,26 @@ int __bound_delete_region(void *p)
    existant region. */
 static unsigned long get_region_size(void *p)
 {
-    unsigned long addr = (unsigned long)p;
-    BoundEntry *e;
+    BoundEntry r;
 
-    e = __bound_t1[addr >> (BOUND_T2_BITS + BOUND_T3_BITS)];
-    e = (BoundEntry *)((char *)e + 
-                       ((addr >> (BOUND_T3_BITS - BOUND_E_BITS)) & 
-                        ((BOUND_T2_SIZE - 1) << BOUND_E_BITS)));
-    addr -= e->start;
-    if (addr > e->size)
-        e = __bound_find_region(e, p);
-    if (e->start != (unsigned long)p)
+    bound_find(p, &r);
+    if (r.start != (unsigned long)p)
         return EMPTY_SIZE;
-    return e->size;
+    return r.size;
 }
 
-/* patched memory functions */
+#ifndef CONFIG_TCC_MALLOC_HOOKS
+/* return true if 'p' lies in no region at all */
+static int bound_unknown(void *p)
+{
+    BoundEntry r;
 
-/* force compiler to perform stores coded up to this point */
-#define barrier()   __asm__ __volatile__ ("": : : "memory")
+    bound_find(p, &r);
+    return r.size == EMPTY_SIZE;
+}
+#endif
+
+/* patched memory functions */
 
 static void install_malloc_hooks(void)
 {
@@ -679,20 +955,30 @@ static void restore_malloc_hooks(void)
 #endif
 }
 
+#ifdef CONFIG_TCC_MALLOC_HOOKS
+/* the hooks are global: other threads calling malloc() meanwhile get
+   unchecked memory */
+#define hooks_off() (bound_spin_lock(&bound_hook_lock), restore_malloc_hooks())
+#define hooks_on() (install_malloc_hooks(), bound_spin_unlock(&bound_hook_lock))
+#else
+#define hooks_off()
+#define hooks_on()
+#endif
+
 static void *libc_malloc(size_t size)
 {
     void *ptr;
-    restore_malloc_hooks();
+    hooks_off();
     ptr = malloc(size);
-    install_malloc_hooks();
+    hooks_on();
     return ptr;
 }
 
 static void libc_free(void *ptr)
 {
-    restore_malloc_hooks();
+    hooks_off();
     free(ptr);
-    install_malloc_hooks();
+    hooks_on();
 }
 
 /* XXX: we should use a malloc which ensure that it is unlikely that
@@ -713,11 +999,11 @@ void *__bound_malloc(size_t size, const void *caller)
     return ptr;
 }
 
-void *__bound_memalign(size_t size, size_t align, const void *caller)
+void *__bound_memalign(size_t align, size_t size, const void *caller)
 {
     void *ptr;
 
-    restore_malloc_hooks();
+    hooks_off();
 
 #ifndef HAVE_MEMALIGN
     if (align > 4) {
@@ -731,10 +1017,10 @@ void *__bound_memalign(size_t size, size_t align, const void *caller)
     /* we allocate one more byte to ensure the regions will be
        separated by at least one byte. With the glibc malloc, it may
        be in fact not necessary */
-    ptr = memalign(size + 1, align);
+    ptr = memalign(align, size + 1);
 #endif
     
-    install_malloc_hooks();
+    hooks_on();
     
     if (!ptr)
         return NULL;
@@ -742,31 +1028,78 @@ void *__bound_memalign(size_t size, size_t align, const void *caller)
     return ptr;
 }
 
+/* return true if 'p' was freed recently */
+static int bound_was_freed(void *p)
+{
+    int i, ret;
+
+    ret = 0;
+    bound_spin_lock(&bound_freed_lock);
+    for (i = 0; i < BOUND_FREED_SIZE; i++) {
+        if (bound_freed[i] == p)
+            ret = 1;
+    }
+    bound_spin_unlock(&bound_freed_lock);
+    return ret;
+}
+
 void __bound_free(void *ptr, const void *caller)
 {
+    void *ptr1;
+
     if (ptr == NULL)
         return;
+    if (bound_was_freed(ptr))
+        bound_error("freeing invalid region");
+#ifndef CONFIG_TCC_MALLOC_HOOKS
+    /* without hooks, the libc may return memory that was never
+       registered (strdup(), fopen(), ...) */
+    if (bound_unknown(ptr)) {
+        libc_free(ptr);
+        return;
+    }
+#endif
     if (__bound_delete_region(ptr) != 0)
         bound_error("freeing invalid region");
 
-    libc_free(ptr);
+    /* keep it, free the oldest one */
+    bound_spin_lock(&bound_freed_lock);
+    ptr1 = bound_freed[bound_freed_index];
+    bound_freed[bound_freed_index] = ptr;
+    bound_freed_index = (bound_freed_index + 1) & (BOUND_FREED_SIZE - 1);
+    bound_spin_unlock(&bound_freed_lock);
+    if (ptr1)
+        libc_free(ptr1);
 }
 
 void *__bound_realloc(void *ptr, size_t size, const void *caller)
 {
     void *ptr1;
-    int old_size;
+    unsigned long old_size;
 
     if (size == 0) {
         __bound_free(ptr, caller);
         return NULL;
     } else {
+        if (ptr != NULL && bound_was_freed(ptr))
+            bound_error("realloc'ing invalid pointer");
+#ifndef CONFIG_TCC_MALLOC_HOOKS
+        if (ptr != NULL && bound_unknown(ptr)) {
+            /* not allocated by us: let the libc copy it */
+            ptr1 = realloc(ptr, size + 1);
+            if (ptr1)
+                __bound_new_region(ptr1, size);
+            return ptr1;
+        }
+#endif
         ptr1 = __bound_malloc(size, caller);
         if (ptr == NULL || ptr1 == NULL)
             return ptr1;
         old_size = get_region_size(ptr);
         if (old_size == EMPTY_SIZE)
             bound_error("realloc'ing invalid pointer");
+        if (old_size > size)
+            old_size = size;
         memcpy(ptr1, ptr, old_size);
         __bound_free(ptr, caller);
         return ptr1;
@@ -848,28 +1181,147 @@ void *__bound_memset(void *dst, int c, size_t size)
     return memset(dst, c, size);
 }
 
-/* XXX: could be optimized */
-int __bound_strlen(const char *s)
+/* return how many bytes can be accessed from 'p' on, i.e. the
+   distance to the end of its region (0 if 'p' is invalid) */
+static size_t bound_avail(const void *p)
 {
-    const char *p;
-    int len;
+    unsigned long addr;
+    BoundEntry r;
 
-    len = 0;
-    for(;;) {
-        p = __bound_ptr_indir1((char *)s, len);
-        if (p == INVALID_POINTER)
-            bound_error("bad pointer in strlen()");
-        if (*p == '\0')
+    bound_find((void *)p, &r);
+    addr = (unsigned long)p - r.start;
+    if (addr >= r.size)
+        return 0;
+    return r.size - addr;
+}
+
+/* word at a time helpers: ONES has 0x01 in every byte and
+   HAS_ZERO(w) is non zero iff one byte of 'w' is zero */
+#define WSIZE       sizeof(unsigned long)
+#define ONES        ((unsigned long)-1 / 0xff)
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & (ONES << 7))
+
+/* return the index of the first byte of 's' that is zero or 'c',
+   looking at most at 'n' bytes. Return 'n' if none is found */
+static size_t bound_scan(const char *s, size_t n, int c)
+{
+    const unsigned long *w;
+    unsigned long cc, v;
+    size_t i;
+
+    c = (unsigned char)c;
+    for (i = 0; i < n && ((unsigned long)(s + i) & (WSIZE - 1)); i++)
+        if (s[i] == '\0' || (unsigned char)s[i] == c)
+            return i;
+    cc = ONES * c;
+    for (w = (const unsigned long *)(s + i); n - i >= WSIZE; w++, i += WSIZE) {
+        v = *w;
+        if (HAS_ZERO(v) || HAS_ZERO(v ^ cc))
             break;
-        len++;
     }
+    for (; i < n; i++)
+        if (s[i] == '\0' || (unsigned char)s[i] == c)
+            return i;
+    return n;
+}
+
+/* return strlen(s), or raise an error if the string is not terminated
+   inside its region */
+static size_t bound_strlen(const char *s, const char *fname)
+{
+    size_t n, len;
+
+    n = bound_avail(s);
+    len = bound_scan(s, n, 0);
+    if (len == n)
+        bound_error(fname);
     return len;
 }
 
+size_t __bound_strlen(const char *s)
+{
+    return bound_strlen(s, "bad pointer in strlen()");
+}
+
 char *__bound_strcpy(char *dst, const char *src)
 {
-    int len;
-    len = __bound_strlen(src);
+    size_t len;
+    len = bound_strlen(src, "bad pointer in strcpy()");
     return __bound_memcpy(dst, src, len + 1);
 }
 
+char *__bound_strncpy(char *dst, const char *src, size_t n)
+{
+    size_t avail, len;
+
+    avail = bound_avail(src);
+    len = bound_scan(src, n < avail ? n : avail, 0);
+    if (len == avail && avail < n)
+        bound_error("bad pointer in strncpy()");
+    __bound_check(dst, n);
+    return strncpy(dst, src, n);
+}
+
+char *__bound_strcat(char *dst, const char *src)
+{
+    size_t len1, len2;
+
+    len1 = bound_strlen(dst, "bad pointer in strcat()");
+    len2 = bound_strlen(src, "bad pointer in strcat()");
+    __bound_check(dst, len1 + len2 + 1);
+    memcpy(dst + len1, src, len2 + 1);
+    return dst;
+}
+
+char *__bound_strchr(const char *s, int c)
+{
+    size_t n, i;
+
+    n = bound_avail(s);
+    i = bound_scan(s, n, c);
+    if (i == n)
+        bound_error("bad pointer in strchr()");
+    if (s[i] != (char)c)
+        return NULL;
+    return (char *)s + i;
+}
+
+int __bound_strcmp(const char *s1, const char *s2)
+{
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+    size_t n, n2, i;
+    unsigned long v;
+
+    n = bound_avail(s1);
+    n2 = bound_avail(s2);
+    if (n2 < n)
+        n = n2;
+    i = 0;
+    /* compare whole words if both strings are aligned alike */
+    if ((((unsigned long)s1 ^ (unsigned long)s2) & (WSIZE - 1)) == 0) {
+        for (; i < n && ((unsigned long)(p1 + i) & (WSIZE - 1)); i++) {
+            if (p1[i] != p2[i] || p1[i] == '\0')
+                return p1[i] - p2[i];
+        }
+        for (; n - i >= WSIZE; i += WSIZE) {
+            v = *(const unsigned long *)(p1 + i);
+            if (v != *(const unsigned long *)(p2 + i) || HAS_ZERO(v))
+                break;
+        }
+    }
+    for (; i < n; i++) {
+        if (p1[i] != p2[i] || p1[i] == '\0')
+            return p1[i] - p2[i];
+    }
+    bound_error("bad pointer in strcmp()");
+    return 0;
+}
+
+int __bound_memcmp(const void *s1, const void *s2, size_t size)
+{
+    __bound_check(s1, size);
+    __bound_check(s2, size);
+    return memcmp(s1, s2, size);
+}
+
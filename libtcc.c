@@ -361,9 +361,88 @@ ST_FUNC Section *new_section(TCCState *s1, const char *name, int sh_type, int sh
     return sec;
 }
 
-static void free_section(Section *s)
+/* Sections that grow past SECTION_MAP_MIN are moved, once, to a large
+   reserved region of address space whose pages are committed as the
+   section grows: they are not copied again and their data does not
+   move, unless the region itself gets full. */
+#ifndef CONFIG_TCCBOOT
+#define SECTION_MAP_MIN (1024 * 1024)
+#define SECTION_RESERVE (sizeof(void *) == 8 ? 1024ul << 20 : 64ul << 20)
+
+static void *section_map_reserve(unsigned long size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *p = mmap(NULL, size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static int section_map_commit(void *p, unsigned long size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) ? 0 : -1;
+#else
+    return mprotect(p, size, PROT_READ | PROT_WRITE);
+#endif
+}
+
+static void section_map_release(void *p, unsigned long size)
+{
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+/* grow 'sec' to 'size' bytes in a reserved region. Return -1 if
+   that cannot be done (realloc() is used then). */
+static int section_map(Section *sec, unsigned long size)
+{
+    unsigned long reserve;
+    unsigned char *data;
+
+    if (size <= sec->data_reserved) {
+        /* fresh pages are zero */
+        if (section_map_commit(sec->data, size) < 0)
+            return -1;
+        sec->data_allocated = size;
+        return 0;
+    }
+    reserve = SECTION_RESERVE;
+    while (reserve < 2 * size)
+        reserve *= 2;
+    data = section_map_reserve(reserve);
+    if (!data)
+        return -1;
+    if (section_map_commit(data, size) < 0) {
+        section_map_release(data, reserve);
+        return -1;
+    }
+    memcpy(data, sec->data, sec->data_allocated);
+    free_section(sec);
+    sec->data = data;
+    sec->data_allocated = size;
+    sec->data_reserved = reserve;
+    return 0;
+}
+#endif
+
+/* free the data of a section */
+ST_FUNC void free_section(Section *s)
 {
-    tcc_free(s->data);
+#ifdef SECTION_MAP_MIN
+    if (s->data_reserved)
+        section_map_release(s->data, s->data_reserved);
+    else
+#endif
+        tcc_free(s->data);
+    s->data = NULL;
+    s->data_allocated = 0;
+    s->data_reserved = 0;
 }
 
 /* realloc section and set its content to zero */
@@ -377,6 +456,12 @@ ST_FUNC void section_realloc(Section *sec, unsigned long new_size)
         size = 1;
     while (size < new_size)
         size = size * 2;
+#ifdef SECTION_MAP_MIN
+    if (size >= SECTION_MAP_MIN && section_map(sec, size) == 0)
+        return;
+    if (sec->data_reserved)
+        tcc_error("memory full");
+#endif
     data = tcc_realloc(sec->data, size);
     memset(data + sec->data_allocated, 0, size - sec->data_allocated);
     sec->data = data;
@@ -412,7 +497,7 @@ ST_FUNC Section *find_section(TCCState *s1, const char *name)
 {
     Section *sec;
     int i;
-    for(i = 1; i < s1->nb_sections; i++) {
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
         sec = s1->sections[i];
         if (!strcmp(name, sec->name))
             return sec;
@@ -421,6 +506,34 @@ ST_FUNC Section *find_section(TCCState *s1, const char *name)
     return new_section(s1, name, SHT_PROGBITS, SHF_ALLOC);
 }
 
+static void new_stab_sections(TCCState *s1)
+{
+    stab_section = new_section(s1, ".stab", SHT_PROGBITS, 0);
+    stab_section->sh_entsize = sizeof(Stab_Sym);
+    stabstr_section = new_section(s1, ".stabstr", SHT_STRTAB, 0);
+    put_elf_str(stabstr_section, "");
+    stab_section->link = stabstr_section;
+    /* put first entry */
+    put_stabs("", 0, 0, 0, 0);
+#ifdef CONFIG_TCC_DWARF
+    if (s1->do_dwarf)
+        dwarf_new_sections(s1);
+#endif
+}
+
+/* the state was relocated: compile into new sections, the old ones
+   are in memory already */
+ST_FUNC void new_code_sections(TCCState *s1)
+{
+    if (text_section->sh_num > s1->nb_relocated_sections)
+        return;
+    text_section = new_section(s1, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
+    data_section = new_section(s1, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+    bss_section = new_section(s1, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE);
+    if (s1->do_debug)
+        new_stab_sections(s1);
+}
+
 /* update sym->c so that it points to an external symbol in section
    'section' with value 'value' */
 ST_FUNC void put_extern_sym2(Sym *sym, Section *section,
@@ -466,8 +579,8 @@ ST_FUNC void put_extern_sym2(Sym *sym, Section *section,
             /* if bound checking is activated, we change some function
                names by adding the "__bound" prefix */
             switch(sym->v) {
-#ifdef TCC_TARGET_PE
-            /* XXX: we rely only on malloc hooks */
+#if defined TCC_TARGET_PE || defined TCC_TARGET_X86_64
+            /* XXX: we rely only on malloc hooks, except there */
             case TOK_malloc:
             case TOK_free:
             case TOK_realloc:
@@ -479,6 +592,11 @@ ST_FUNC void put_extern_sym2(Sym *sym, Section *section,
             case TOK_memset:
             case TOK_strlen:
             case TOK_strcpy:
+            case TOK_strncpy:
+            case TOK_strcat:
+            case TOK_strchr:
+            case TOK_strcmp:
+            case TOK_memcmp:
             case TOK_alloca:
                 strcpy(buf, "__bound_");
                 strcat(buf, name);
@@ -628,6 +746,8 @@ PUB_FUNC void tcc_error(const char *fmt, ...)
     va_start(ap, fmt);
     error1(s1, 0, fmt, ap);
     va_end(ap);
+    /* keep what -E produced so far */
+    preprocess_flush(s1);
     /* better than nothing: in some cases, we accept to handle errors */
     if (s1->error_set_jmp_enabled) {
         longjmp(s1->error_jmp_buf, 1);
@@ -703,6 +823,104 @@ ST_FUNC int tcc_open(TCCState *s1, const char *filename)
     return fd;
 }
 
+/* the macros and system include paths which follow from the options */
+static void tcc_set_pp_options(TCCState *s)
+{
+#ifdef CONFIG_TCC_SERVER
+    if (s->prelude)
+        return; /* done by tcc_parse_prelude() */
+#endif
+    if (!s->nostdinc) {
+        /* default include paths */
+        /* -isystem paths have already been handled */
+        tcc_add_sysinclude_path(s, CONFIG_TCC_SYSINCLUDEPATHS);
+    }
+#ifdef CONFIG_TCC_BCHECK
+    if (s->do_bounds_check)
+        tcc_define_symbol(s, "__BOUNDS_CHECKING_ON", NULL);
+#endif
+    if (s->char_is_unsigned)
+        tcc_define_symbol(s, "__CHAR_UNSIGNED__", NULL);
+}
+
+/* the types which tcc_compile() defines for each compilation unit */
+static void tcc_compile_types(void)
+{
+    anon_sym = SYM_FIRST_ANOM;
+
+    /* define some often used types */
+    int_type.t = VT_INT;
+
+    char_pointer_type.t = VT_BYTE;
+    mk_pointer(&char_pointer_type);
+
+#if PTR_SIZE == 4
+    size_type.t = VT_INT;
+#else
+    size_type.t = VT_LLONG;
+#endif
+
+    func_old_type.t = VT_FUNC;
+    func_old_type.ref = sym_push(SYM_FIELD, &int_type, FUNC_CDECL, FUNC_OLD);
+#ifdef TCC_TARGET_ARM
+    arm_init_types();
+#endif
+}
+
+#ifdef CONFIG_TCC_SERVER
+/* tcc --server: parse the -include files once, as the start of the next
+   compilation unit. The server forks a copy of the state for each
+   request, so each request finds them parsed already. */
+PUB_FUNC void tcc_parse_prelude(TCCState *s1)
+{
+    TCCPrelude *p;
+
+    tcc_set_pp_options(s1);
+    p = tcc_mallocz(sizeof *p);
+    p->define_start = define_stack;
+    p->nostdinc = s1->nostdinc;
+    p->char_is_unsigned = s1->char_is_unsigned;
+#ifdef CONFIG_TCC_BCHECK
+    p->do_bounds_check = s1->do_bounds_check;
+#endif
+    p->nb_cmd_include_files = s1->nb_cmd_include_files;
+
+    /* like tcc_compile() with an empty file, but keep the symbols and
+       macros. Errors end the server. */
+    tcc_open_bf(s1, "<prelude>", 1);
+    file->buffer[0] = '\n';
+    preprocess_init(s1);
+    tcc_compile_types();
+    preprocess_cmd_includes(s1);
+    nocode_wanted = 1;
+    ch = file->buf_ptr[0];
+    tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
+    parse_flags = PARSE_FLAG_PREPROCESS | PARSE_FLAG_TOK_NUM;
+    next();
+    decl(VT_CONST);
+    if (tok != TOK_EOF)
+        expect("declaration");
+    tcc_close();
+    s1->prelude = p;
+}
+
+/* return an error message if the -include files parsed by
+   tcc_parse_prelude() do not fit the options of this compilation */
+PUB_FUNC const char *tcc_prelude_mismatch(TCCState *s1, TCCPrelude *p)
+{
+    if (p->changed || p->nb_cmd_include_files != s1->nb_cmd_include_files)
+        return "-D, -U, -I, -isystem or -include options";
+    if (p->nostdinc != s1->nostdinc
+        || p->char_is_unsigned != s1->char_is_unsigned
+#ifdef CONFIG_TCC_BCHECK
+        || p->do_bounds_check != s1->do_bounds_check
+#endif
+        )
+        return "-nostdinc, -funsigned-char or -b options";
+    return NULL;
+}
+#endif
+
 /* compile the C file opened in 'file'. Return non zero if errors. */
 static int tcc_compile(TCCState *s1)
 {
@@ -710,15 +928,21 @@ static int tcc_compile(TCCState *s1)
     SValue *pvtop;
     char buf[512];
     volatile int section_sym;
+    int phase_sp;
+#ifdef CONFIG_TCC_SERVER
+    TCCPrelude *prelude;
+    const char *msg;
+#endif
 
 #ifdef INC_DEBUG
     printf("%s: **** new file\n", file->filename);
 #endif
     preprocess_init(s1);
+    if (s1->nb_relocated_sections)
+        new_code_sections(s1);
 
     cur_text_section = NULL;
     funcname = "";
-    anon_sym = SYM_FIRST_ANOM;
 
     /* file info: full path + filename */
     section_sym = 0; /* avoid warning */
@@ -735,6 +959,10 @@ static int tcc_compile(TCCState *s1)
                     text_section->data_offset, text_section, section_sym);
         put_stabs_r(file->filename, N_SO, 0, 0,
                     text_section->data_offset, text_section, section_sym);
+#ifdef CONFIG_TCC_DWARF
+        if (s1->do_dwarf)
+            dwarf_cu_start(file->filename, section_sym);
+#endif
     }
     /* an elf symbol of type STT_FILE must be put so that STB_LOCAL
        symbols can be safely used */
@@ -742,24 +970,6 @@ static int tcc_compile(TCCState *s1)
                 ELFW(ST_INFO)(STB_LOCAL, STT_FILE), 0,
                 SHN_ABS, file->filename);
 
-    /* define some often used types */
-    int_type.t = VT_INT;
-
-    char_pointer_type.t = VT_BYTE;
-    mk_pointer(&char_pointer_type);
-
-#if PTR_SIZE == 4
-    size_type.t = VT_INT;
-#else
-    size_type.t = VT_LLONG;
-#endif
-
-    func_old_type.t = VT_FUNC;
-    func_old_type.ref = sym_push(SYM_FIELD, &int_type, FUNC_CDECL, FUNC_OLD);
-#ifdef TCC_TARGET_ARM
-    arm_init_types();
-#endif
-
 #if 0
     /* define 'void *alloca(unsigned int)' builtin function */
     {
@@ -775,12 +985,31 @@ static int tcc_compile(TCCState *s1)
 #endif
 
     define_start = define_stack;
+#ifdef CONFIG_TCC_SERVER
+    /* the unit begins with the -include files parsed by the server */
+    prelude = s1->prelude;
+    s1->prelude = NULL;
+    if (prelude)
+        define_start = prelude->define_start;
+    else
+#endif
+    {
+        tcc_compile_types();
+        preprocess_cmd_includes(s1);
+    }
     nocode_wanted = 1;
+    phase_sp = s1->phase_sp;
+    bench_enter(s1, TCC_PHASE_PARSE);
 
     if (setjmp(s1->error_jmp_buf) == 0) {
         s1->nb_errors = 0;
         s1->error_set_jmp_enabled = 1;
 
+#ifdef CONFIG_TCC_SERVER
+        if (prelude && (msg = tcc_prelude_mismatch(s1, prelude)))
+            tcc_error("%s differ from those of the server, which "
+                      "parsed its -include files already", msg);
+#endif
         ch = file->buf_ptr[0];
         tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
         parse_flags = PARSE_FLAG_PREPROCESS | PARSE_FLAG_TOK_NUM;
@@ -800,15 +1029,27 @@ static int tcc_compile(TCCState *s1)
     }
 
     s1->error_set_jmp_enabled = 0;
+    tcc_phase_unwind(s1, phase_sp + 1);
+#ifdef CONFIG_TCC_DWARF
+    /* also closes the unit after an error, the output is dropped then */
+    if (s1->do_dwarf)
+        dwarf_cu_end();
+#endif
 
     /* reset define stack, but leave -Dsymbols (may be incorrect if
        they are undefined) */
     free_defines(define_start);
 
+    bench_enter(s1, TCC_PHASE_INLINE);
     gen_inline_functions();
+    bench_leave(s1);
 
     sym_pop(&global_stack, NULL);
     sym_pop(&local_stack, NULL);
+    bench_leave(s1);
+#ifdef CONFIG_TCC_SERVER
+    tcc_free(prelude);
+#endif
 
     return s1->nb_errors != 0 ? -1 : 0;
 }
@@ -825,10 +1066,24 @@ LIBTCCAPI int tcc_compile_string(TCCState *s, const char *str)
     return ret;
 }
 
+/* an option changes how the -include files parsed by tcc --server
+   read. Return true if so: tcc compiles from a new state then. */
+static int prelude_changed(TCCState *s)
+{
+#ifdef CONFIG_TCC_SERVER
+    if (s->prelude)
+        return s->prelude->changed = 1;
+#endif
+    return 0;
+}
+
 /* define a preprocessor symbol. A value can also be provided with the '=' operator */
 LIBTCCAPI void tcc_define_symbol(TCCState *s1, const char *sym, const char *value)
 {
     int len1, len2;
+
+    if (prelude_changed(s1))
+        return;
     /* default value */
     if (!value)
         value = "1";
@@ -854,6 +1109,8 @@ LIBTCCAPI void tcc_undefine_symbol(TCCState *s1, const char *sym)
 {
     TokenSym *ts;
     Sym *s;
+    if (prelude_changed(s1))
+        return;
     ts = tok_alloc(sym, strlen(sym));
     s = define_find(ts->tok);
     /* undefine symbol by putting an invalid name */
@@ -872,6 +1129,9 @@ static void tcc_cleanup(void)
     /* free -D defines */
     free_defines(NULL);
 
+    /* free macro memos and token buffers */
+    preprocess_delete();
+
     /* free tokens */
     n = tok_ident - TOK_IDENT;
     for(i = 0; i < n; i++)
@@ -906,6 +1166,7 @@ LIBTCCAPI TCCState *tcc_new(void)
     tcc_set_lib_path(s, CONFIG_TCCDIR);
 #endif
     s->output_type = TCC_OUTPUT_MEMORY;
+    s->phase = -1;
     preprocess_new();
     s->include_stack_ptr = s->include_stack;
 
@@ -1040,6 +1301,11 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
 {
     int i;
 
+#ifdef CONFIG_TCC_SERVER
+    /* the declarations of the -include files, not compiled after all */
+    if (s1->prelude)
+        sym_pop(&global_stack, NULL);
+#endif
     tcc_cleanup();
 
     /* free all sections */
@@ -1071,6 +1337,10 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
     dynarray_reset(&s1->cached_includes, &s1->nb_cached_includes);
     dynarray_reset(&s1->include_paths, &s1->nb_include_paths);
     dynarray_reset(&s1->sysinclude_paths, &s1->nb_sysinclude_paths);
+    dynarray_reset(&s1->cmd_include_files, &s1->nb_cmd_include_files);
+#ifdef CONFIG_TCC_SERVER
+    tcc_free(s1->prelude);
+#endif
 
     tcc_free(s1->tcc_lib_path);
     tcc_free(s1->soname);
@@ -1083,12 +1353,7 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
     dynarray_reset(&s1->target_deps, &s1->nb_target_deps);
 
 #ifdef TCC_IS_NATIVE
-# ifdef HAVE_SELINUX
-    munmap (s1->write_mem, s1->mem_size);
-    munmap (s1->runtime_mem, s1->mem_size);
-# else
-    tcc_free(s1->runtime_mem);
-# endif
+    tcc_run_free(s1);
 #endif
 
     tcc_free(s1);
@@ -1096,12 +1361,14 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
 
 LIBTCCAPI int tcc_add_include_path(TCCState *s, const char *pathname)
 {
+    prelude_changed(s);
     tcc_split_path(s, (void ***)&s->include_paths, &s->nb_include_paths, pathname);
     return 0;
 }
 
 LIBTCCAPI int tcc_add_sysinclude_path(TCCState *s, const char *pathname)
 {
+    prelude_changed(s);
     tcc_split_path(s, (void ***)&s->sysinclude_paths, &s->nb_sysinclude_paths, pathname);
     return 0;
 }
@@ -1135,6 +1402,17 @@ ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
     dynarray_add((void ***)&s1->target_deps, &s1->nb_target_deps,
             tcc_strdup(filename));
 
+#ifdef CONFIG_TCC_SERVER
+    /* only tcc_compile() can continue after the -include files parsed
+       by the server */
+    if (s1->prelude && ((flags & AFF_PREPROCESS) || !strcmp(ext, "S"))) {
+        tcc_error_noabort("cannot preprocess '%s' after the -include files "
+                          "parsed by the server", filename);
+        ret = -1;
+        goto the_end;
+    }
+#endif
+
     if (flags & AFF_PREPROCESS) {
         ret = tcc_preprocess(s1);
         goto the_end;
@@ -1308,21 +1586,31 @@ LIBTCCAPI int tcc_add_symbol(TCCState *s, const char *name, const void *val)
     return 0;
 }
 
+LIBTCCAPI int tcc_add_symbols(TCCState *s, const TCCSymbol *syms, int nb_syms)
+{
+    int i;
+    if (!s) {
+#if defined TCC_IS_NATIVE && !defined _WIN32
+        rt_add_symbols(syms, nb_syms);
+        return 0;
+#else
+        return -1;
+#endif
+    }
+    for (i = 0; i < nb_syms; i++)
+        tcc_add_symbol(s, syms[i].name, syms[i].val);
+    return 0;
+}
+
 LIBTCCAPI int tcc_set_output_type(TCCState *s, int output_type)
 {
     s->output_type = output_type;
 
-    if (!s->nostdinc) {
-        /* default include paths */
-        /* -isystem paths have already been handled */
-        tcc_add_sysinclude_path(s, CONFIG_TCC_SYSINCLUDEPATHS);
-    }
+    tcc_set_pp_options(s);
 
     /* if bound checking, then add corresponding sections */
 #ifdef CONFIG_TCC_BCHECK
     if (s->do_bounds_check) {
-        /* define symbol */
-        tcc_define_symbol(s, "__BOUNDS_CHECKING_ON", NULL);
         /* create bounds sections */
         bounds_section = new_section(s, ".bounds",
                                      SHT_PROGBITS, SHF_ALLOC);
@@ -1331,20 +1619,10 @@ LIBTCCAPI int tcc_set_output_type(TCCState *s, int output_type)
     }
 #endif
 
-    if (s->char_is_unsigned) {
-        tcc_define_symbol(s, "__CHAR_UNSIGNED__", NULL);
-    }
-
     /* add debug sections */
     if (s->do_debug) {
         /* stab symbols */
-        stab_section = new_section(s, ".stab", SHT_PROGBITS, 0);
-        stab_section->sh_entsize = sizeof(Stab_Sym);
-        stabstr_section = new_section(s, ".stabstr", SHT_STRTAB, 0);
-        put_elf_str(stabstr_section, "");
-        stab_section->link = stabstr_section;
-        /* put first entry */
-        put_stabs("", 0, 0, 0, 0);
+        new_stab_sections(s);
     }
 
     tcc_add_library_path(s, CONFIG_TCC_LIBPATHS);
@@ -1434,6 +1712,9 @@ static const FlagDef flag_defs[] = {
     { offsetof(TCCState, char_is_unsigned), FD_INVERT, "signed-char" },
     { offsetof(TCCState, nocommon), FD_INVERT, "common" },
     { offsetof(TCCState, leading_underscore), 0, "leading-underscore" },
+    { offsetof(TCCState, jit_hugepages), 0, "jit-hugepages" },
+    { offsetof(TCCState, jit_dump), 0, "jit-dump" },
+    { offsetof(TCCState, parallel_reloc), 0, "parallel-reloc" },
 };
 
 /* set/reset a flag */
@@ -1640,6 +1921,7 @@ enum {
     TCC_OPTION_m,
     TCC_OPTION_f,
     TCC_OPTION_isystem,
+    TCC_OPTION_include,
     TCC_OPTION_nostdinc,
     TCC_OPTION_nostdlib,
     TCC_OPTION_print_search_dirs,
@@ -1671,7 +1953,7 @@ static const TCCOption tcc_options[] = {
     { "L", TCC_OPTION_L, TCC_OPTION_HAS_ARG },
     { "B", TCC_OPTION_B, TCC_OPTION_HAS_ARG },
     { "l", TCC_OPTION_l, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
-    { "bench", TCC_OPTION_bench, 0 },
+    { "bench", TCC_OPTION_bench, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
 #ifdef CONFIG_TCC_BACKTRACE
     { "bt", TCC_OPTION_bt, TCC_OPTION_HAS_ARG },
 #endif
@@ -1697,6 +1979,7 @@ static const TCCOption tcc_options[] = {
     { "m", TCC_OPTION_m, TCC_OPTION_HAS_ARG },
     { "f", TCC_OPTION_f, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
     { "isystem", TCC_OPTION_isystem, TCC_OPTION_HAS_ARG },
+    { "include", TCC_OPTION_include, TCC_OPTION_HAS_ARG },
     { "nostdinc", TCC_OPTION_nostdinc, 0 },
     { "nostdlib", TCC_OPTION_nostdlib, 0 },
     { "print-search-dirs", TCC_OPTION_print_search_dirs, 0 },
@@ -1798,7 +2081,9 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
             pthread = 1;
             break;
         case TCC_OPTION_bench:
-            s->do_bench = 1;
+            if (*optarg && strcmp(optarg, "=json"))
+                tcc_error("invalid option -- '%s'", r);
+            s->do_bench = *optarg ? 2 : 1;
             break;
 #ifdef CONFIG_TCC_BACKTRACE
         case TCC_OPTION_bt:
@@ -1813,6 +2098,8 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
 #endif
         case TCC_OPTION_g:
             s->do_debug = 1;
+            if (!strncmp(optarg, "dwarf", 5))
+                s->do_dwarf = 1;
             break;
         case TCC_OPTION_c:
             s->output_type = TCC_OUTPUT_OBJ;
@@ -1840,6 +2127,10 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
         case TCC_OPTION_isystem:
             tcc_add_sysinclude_path(s, optarg);
             break;
+        case TCC_OPTION_include:
+            dynarray_add((void ***)&s->cmd_include_files,
+                         &s->nb_cmd_include_files, tcc_strdup(optarg));
+            break;
         case TCC_OPTION_nostdinc:
             s->nostdinc = 1;
             break;
@@ -1944,9 +2235,127 @@ LIBTCCAPI int tcc_set_options(TCCState *s, const char *str)
     return ret;
 }
 
+/* ------------------------------------------------------------- */
+/* -bench */
+
+static const char * const tcc_phase_names[TCC_PHASE_NB] = {
+    "lex", "macro", "parse", "inline", "reloc", "got", "output"
+};
+
+static unsigned long long tcc_clock_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER c, f;
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return c.QuadPart / f.QuadPart * 1000000000ULL
+        + c.QuadPart % f.QuadPart * 1000000000ULL / f.QuadPart;
+#elif defined CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+static unsigned long long tcc_cycles(void)
+{
+#if (defined __i386__ || defined __x86_64__) \
+    && (defined __GNUC__ || defined __TINYC__)
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return (unsigned long long)hi << 32 | lo;
+#else
+    return 0;
+#endif
+}
+
+/* charge the time since the last phase change to the current phase */
+static void tcc_phase_charge(TCCState *s1)
+{
+    unsigned long long t = tcc_clock_ns(), c = tcc_cycles();
+
+    if (s1->phase >= 0) {
+        s1->stats.phase_ns[s1->phase] += t - s1->phase_ns;
+        s1->stats.phase_cycles[s1->phase] += c - s1->phase_cycles;
+    }
+    s1->phase_ns = t;
+    s1->phase_cycles = c;
+}
+
+ST_FUNC void tcc_phase_enter(TCCState *s1, int phase)
+{
+    tcc_phase_charge(s1);
+    if (s1->phase_sp < countof(s1->phase_stack))
+        s1->phase_stack[s1->phase_sp] = s1->phase;
+    s1->phase_sp++;
+    s1->phase = phase;
+}
+
+ST_FUNC void tcc_phase_leave(TCCState *s1)
+{
+    tcc_phase_charge(s1);
+    if (--s1->phase_sp < countof(s1->phase_stack))
+        s1->phase = s1->phase_stack[s1->phase_sp];
+}
+
+/* leave the phases entered above depth 'sp' (after a tcc_error()) */
+ST_FUNC void tcc_phase_unwind(TCCState *s1, int sp)
+{
+    while (s1->phase_sp > sp)
+        bench_leave(s1);
+}
+
+LIBTCCAPI void tcc_get_stats(TCCState *s, TCCStats *st)
+{
+    if (s->do_bench)
+        tcc_phase_charge(s);
+    *st = s->stats;
+    tok_hash_stats(st);
+}
+
 PUB_FUNC void tcc_print_stats(TCCState *s, int64_t total_time)
 {
-    double tt;
+    double tt, rps;
+    TCCStats st;
+    int i;
+
+    tcc_get_stats(s, &st);
+    /* relocations per second, with the symbol values */
+    rps = st.phase_ns[TCC_PHASE_RELOC]
+        ? st.relocs * 1e9 / st.phase_ns[TCC_PHASE_RELOC] : 0;
+    if (s->do_bench == 2) {
+        printf("{\n  \"idents\": %d,\n  \"lines\": %d,\n  \"bytes\": %d,\n"
+               "  \"time_us\": %lld,\n",
+               tok_ident - TOK_IDENT, total_lines, total_bytes,
+               (long long)total_time);
+        printf("  \"tokens\": %llu,\n  \"macro_expansions\": %llu,\n"
+               "  \"symbols\": %llu,\n  \"relocations\": %llu,\n"
+               "  \"relocations_per_sec\": %.0f,\n  \"reloc_threads\": %llu,\n",
+               st.tokens, st.macro_expansions, st.syms, st.relocs,
+               rps, st.reloc_threads);
+        printf("  \"bound_checks\": %llu,\n  \"bound_checks_elided\": %llu,\n",
+               st.bound_checks, st.bound_checks_elided);
+        printf("  \"bound_locals\": %llu,\n  \"bound_locals_elided\": %llu,\n",
+               st.bound_locals, st.bound_locals_elided);
+        printf("  \"runtime_direct_calls\": %llu,\n"
+               "  \"runtime_plt_calls\": %llu,\n",
+               st.runtime_direct_calls, st.runtime_plt_calls);
+        printf("  \"ident_buckets\": %llu,\n  \"ident_max_chain\": %llu,\n"
+               "  \"ident_probes\": %llu,\n",
+               st.ident_buckets, st.ident_max_chain, st.ident_probes);
+        printf("  \"phases\": {\n");
+        for (i = 0; i < TCC_PHASE_NB; i++)
+            printf("    \"%s\": { \"ns\": %llu, \"cycles\": %llu }%s\n",
+                   tcc_phase_names[i], st.phase_ns[i], st.phase_cycles[i],
+                   i < TCC_PHASE_NB - 1 ? "," : "");
+        printf("  }\n}\n");
+        return;
+    }
+
     tt = (double)total_time / 1000000.0;
     if (tt < 0.001)
         tt = 0.001;
@@ -1956,6 +2365,32 @@ PUB_FUNC void tcc_print_stats(TCCState *s, int64_t total_time)
            tok_ident - TOK_IDENT, total_lines, total_bytes,
            tt, (int)(total_lines / tt),
            total_bytes / tt / 1000000.0);
+    for (i = 0; i < TCC_PHASE_NB; i++)
+        printf("%-8s %9.3f ms %9.3f Mcycles\n", tcc_phase_names[i],
+               st.phase_ns[i] / 1000000.0, st.phase_cycles[i] / 1000000.0);
+    printf("%llu tokens, %llu macro expansions, %llu symbols, %llu relocations\n",
+           st.tokens, st.macro_expansions, st.syms, st.relocs);
+    if (st.ident_buckets)
+        printf("%llu ident buckets, longest chain %llu, %0.2f probes per lookup\n",
+               st.ident_buckets, st.ident_max_chain,
+               (double)st.ident_probes / (tok_ident - TOK_IDENT));
+    if (st.relocs) {
+        printf("%0.2f M relocations/s", rps / 1000000.0);
+        if (st.reloc_threads > 1)
+            printf(" with %llu threads", st.reloc_threads);
+        printf("\n");
+    }
+#ifdef CONFIG_TCC_BCHECK
+    if (s->do_bounds_check) {
+        printf("%llu bound checks, %llu elided\n",
+               st.bound_checks, st.bound_checks_elided);
+        printf("%llu local arrays registered, %llu not registered\n",
+               st.bound_locals, st.bound_locals_elided);
+    }
+#endif
+    if (st.runtime_direct_calls || st.runtime_plt_calls)
+        printf("%llu direct calls, %llu through the runtime PLT\n",
+               st.runtime_direct_calls, st.runtime_plt_calls);
 }
 
 PUB_FUNC void tcc_set_environment(TCCState *s)
@@ -73,10 +73,24 @@ LIBTCCAPI int tcc_add_library(TCCState *s, const char *libraryname);
 /* add a symbol to the compiled program */
 LIBTCCAPI int tcc_add_symbol(TCCState *s, const char *name, const void *val);
 
+/* a host symbol for tcc_add_symbols() */
+typedef struct TCCSymbol {
+    const char *name;
+    const void *val;
+} TCCSymbol;
+
+/* add several symbols at once.  With s == NULL they go to a process-wide
+   table that all states consult first when resolving undefined symbols
+   for tcc_relocate(); return -1 if that table is not supported. */
+LIBTCCAPI int tcc_add_symbols(TCCState *s, const TCCSymbol *syms, int nb_syms);
+
 /* output an executable, library or object file. DO NOT call
    tcc_relocate() before. */
 LIBTCCAPI int tcc_output_file(TCCState *s, const char *filename);
 
+/* same, to an open file descriptor, which is not closed */
+LIBTCCAPI int tcc_output_fd(TCCState *s, int fd);
+
 /* link and run main() function and return its value. DO NOT call
    tcc_relocate() before. */
 LIBTCCAPI int tcc_run(TCCState *s, int argc, char **argv);
@@ -87,12 +101,53 @@ LIBTCCAPI int tcc_relocate(TCCState *s1, void *ptr);
    - TCC_RELOCATE_AUTO : Allocate and manage memory internally
    - NULL              : return required memory size for the step below
    - memory address    : copy code to memory passed by the caller
-   returns -1 if error. */
+   returns -1 if error.
+   More code can be compiled into the state afterwards and relocated
+   with another call: it may use the symbols defined before, which
+   keep their addresses. */
 #define TCC_RELOCATE_AUTO (void*)1
 
 /* return symbol value or NULL if not found */
 LIBTCCAPI void *tcc_get_symbol(TCCState *s, const char *name);
 
+/*****************************/
+/* statistics */
+
+/* compilation phases, timed when option -bench is set */
+#define TCC_PHASE_LEX      0 /* file I/O and tokenizing */
+#define TCC_PHASE_MACRO    1 /* macro expansion */
+#define TCC_PHASE_PARSE    2 /* parsing and code generation */
+#define TCC_PHASE_INLINE   3 /* code generation of inline functions */
+#define TCC_PHASE_RELOC    4 /* relocation */
+#define TCC_PHASE_GOT      5 /* GOT/PLT building */
+#define TCC_PHASE_OUTPUT   6 /* linking and writing output (file or memory) */
+#define TCC_PHASE_NB       7
+
+typedef struct TCCStats {
+    /* time spent in each phase, nested phases excluded */
+    unsigned long long phase_ns[TCC_PHASE_NB];
+    unsigned long long phase_cycles[TCC_PHASE_NB]; /* 0 if no cycle counter */
+    /* counters, always maintained */
+    unsigned long long tokens; /* tokens read from files */
+    unsigned long long macro_expansions;
+    unsigned long long syms; /* symbols pushed */
+    unsigned long long relocs; /* relocations applied */
+    unsigned long long bound_checks, bound_checks_elided; /* option -b */
+    /* local arrays registered with the bound checker at runtime, and
+       not registered because their address does not escape */
+    unsigned long long bound_locals, bound_locals_elided;
+    /* tcc_relocate(): calls to shared libraries and to tcc_add_symbol()
+       symbols, directly or through a jump table entry */
+    unsigned long long runtime_direct_calls, runtime_plt_calls;
+    unsigned long long reloc_threads; /* -fparallel-reloc: threads used */
+    /* identifier hash table: buckets, longest chain and the sum over
+       all identifiers of their position in their chain */
+    unsigned long long ident_buckets, ident_max_chain, ident_probes;
+} TCCStats;
+
+/* get the statistics collected so far for 's' */
+LIBTCCAPI void tcc_get_stats(TCCState *s, TCCStats *st);
+
 #ifdef __cplusplus
 }
 #endif
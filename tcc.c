@@ -231,18 +231,53 @@ static int64_t getclock_us(void)
 #endif
 }
 
-int main(int argc, char **argv)
+#ifdef CONFIG_TCC_SERVER
+/* the options of tcc --server */
+static int server_argc;
+static char **server_argv;
+
+/* can the first file of the request start with the -include files
+   which the server parsed */
+static int server_prelude_fits(TCCState *s)
+{
+    const char *ext;
+    int i;
+
+    if (tcc_prelude_mismatch(s, s->prelude)
+        || s->output_type == TCC_OUTPUT_PREPROCESS)
+        return 0;
+    for (i = 0; i < s->nb_files; i++) {
+        if (s->files[i][0] != '-' || s->files[i][1] != 'l') {
+            ext = tcc_fileextension(s->files[i]);
+            return strcmp(ext, ".S") != 0;
+        }
+    }
+    return 1;
+}
+#endif
+
+static int tcc_main(TCCState *s, int argc, char **argv)
 {
-    TCCState *s;
     int ret, optind, i, bench;
     int64_t start_time = 0;
     const char *first_file = NULL;
 
-    s = tcc_new();
     s->output_type = TCC_OUTPUT_EXE;
 
     optind = tcc_parse_args(s, argc - 1, argv + 1);
     tcc_set_environment(s);
+#ifdef CONFIG_TCC_SERVER
+    if (s->prelude && !server_prelude_fits(s)) {
+        /* compile from a new state instead, with the options of the
+           server and then those of the request */
+        tcc_delete(s);
+        s = tcc_new();
+        tcc_parse_args(s, server_argc, server_argv);
+        s->output_type = TCC_OUTPUT_EXE;
+        optind = tcc_parse_args(s, argc - 1, argv + 1);
+        tcc_set_environment(s);
+    }
+#endif
 
     if (optind == 0) {
         help();
@@ -277,7 +312,7 @@ int main(int argc, char **argv)
     }
 
     if (s->output_type == TCC_OUTPUT_PREPROCESS) {
-        if (!s->outfile) {
+        if (!s->outfile || !strcmp(s->outfile, "-")) {
             s->ppfp = stdout;
         } else {
             s->ppfp = fopen(s->outfile, "w");
@@ -313,23 +348,36 @@ int main(int argc, char **argv)
     }
 
     if (0 == ret) {
-        if (bench)
-            tcc_print_stats(s, getclock_us() - start_time);
-
         if (s->output_type == TCC_OUTPUT_MEMORY) {
 #ifdef TCC_IS_NATIVE
-            ret = tcc_run(s, argc - 1 - optind, argv + 1 + optind);
+            /* relocate first so that the stats include that phase */
+            if (bench && tcc_relocate(s, TCC_RELOCATE_AUTO) < 0)
+                ret = 1;
+            if (bench && 0 == ret)
+                tcc_print_stats(s, getclock_us() - start_time);
+            if (0 == ret)
+                ret = tcc_run(s, argc - 1 - optind, argv + 1 + optind);
 #else
             tcc_error_noabort("-run is not available in a cross compiler");
             ret = 1;
 #endif
         } else if (s->output_type == TCC_OUTPUT_PREPROCESS) {
-             if (s->outfile)
+             if (s->ppfp != stdout)
                 fclose(s->ppfp);
+             if (bench)
+                tcc_print_stats(s, getclock_us() - start_time);
         } else {
             if (!s->outfile)
                 s->outfile = default_outputfile(s, first_file);
-            ret = !!tcc_output_file(s, s->outfile);
+            if (!strcmp(s->outfile, "-")) {
+#ifdef _WIN32
+                _setmode(1, _O_BINARY);
+#endif
+                ret = !!tcc_output_fd(s, 1);
+            } else
+                ret = !!tcc_output_file(s, s->outfile);
+            if (bench && !ret)
+                tcc_print_stats(s, getclock_us() - start_time);
             /* dump collected dependencies */
             if (s->gen_deps && !ret)
                 gen_makedeps(s, s->outfile, s->deps_outfile);
@@ -341,3 +389,294 @@ int main(int argc, char **argv)
         tcc_memstats();
     return ret;
 }
+
+#ifdef CONFIG_TCC_SERVER
+/* ------------------------------------------------------------- */
+/* compile server: 'tcc --server socket [options]' initializes a
+   TCCState once, parses the -include files of the options, and forks
+   a copy of it for each compilation.  The client passes its working
+   directory, arguments, environment and stdin/stdout/stderr over the
+   socket and gets the exit status back.  Only clients with the uid of
+   the server are served. */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define SERVER_MAGIC 0x54434353 /* "TCCS" */
+#define SERVER_MAX_REQUEST (1 << 20)
+
+typedef struct ServerRequest {
+    int magic;
+    int argc;
+    int envc;
+    int size; /* of the data which follows: cwd, argv, then environ */
+} ServerRequest;
+
+extern char **environ;
+
+static int server_socket(const char *path, struct sockaddr_un *sa)
+{
+    int fd;
+
+    if (strlen(path) >= sizeof sa->sun_path)
+        tcc_error("socket path too long: '%s'", path);
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        tcc_error("socket: %s", strerror(errno));
+    return fd;
+}
+
+static int read_full(int fd, void *buf, int size)
+{
+    int n, len = 0;
+    while (len < size) {
+        n = read(fd, (char *)buf + len, size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        len += n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, int size)
+{
+    int n, len = 0;
+    while (len < size) {
+        n = write(fd, (const char *)buf + len, size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        len += n;
+    }
+    return 0;
+}
+
+/* return the uid of the process at the other end of 'fd', or -1 */
+static int server_peer_uid(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0
+        || len != sizeof cred)
+        return -1;
+    return cred.uid;
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return -1;
+    return uid;
+#endif
+}
+
+/* serve one request in a forked copy of the initialized state 's' */
+static void server_child(TCCState *s, int fd)
+{
+    ServerRequest req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3], i, ret;
+    char *data, *p, **argv;
+
+    signal(SIGCHLD, SIG_DFL);
+    if (server_peer_uid(fd) != (int)getuid())
+        exit(1);
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &req;
+    iov.iov_len = sizeof req;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof cbuf;
+    if (recvmsg(fd, &msg, MSG_WAITALL) != sizeof req
+        || req.magic != SERVER_MAGIC
+        || req.argc < 1 || req.envc < 0 || req.size <= 0
+        || req.size > SERVER_MAX_REQUEST
+        || req.argc + req.envc > req.size)
+        exit(1);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof fds))
+        exit(1);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+
+    data = tcc_malloc(req.size + 1);
+    argv = tcc_malloc((req.argc + req.envc + 2) * sizeof *argv);
+    if (read_full(fd, data, req.size) < 0)
+        exit(1);
+    data[req.size] = '\0';
+
+    /* the client's stdin/stdout/stderr and working directory */
+    for (i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    if (chdir(data) < 0)
+        tcc_error("cannot change to directory '%s'", data);
+    /* argv, then the client's environment, which -run and the
+       include paths of C_INCLUDE_PATH and CPATH use */
+    p = data + strlen(data) + 1;
+    for (i = 0; i < req.argc + req.envc + 1; i++) {
+        if (i == req.argc) {
+            argv[i] = NULL;
+            continue;
+        }
+        if (p >= data + req.size)
+            exit(1);
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[i] = NULL;
+    environ = argv + req.argc + 1;
+
+    ret = tcc_main(s, req.argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+    write_full(fd, &ret, sizeof ret);
+    exit(ret);
+}
+
+static void tcc_server(int argc, char **argv)
+{
+    struct sockaddr_un sa;
+    TCCState *s;
+    int lfd, fd, ret;
+    mode_t mask;
+
+    /* the state every compilation starts from: keywords and
+       predefined macros, search paths, the server's options and the
+       declarations and macros of its -include files. The environment
+       is the client's. */
+    s = tcc_new();
+    server_argc = argc - 3;
+    server_argv = argv + 3;
+    if (argc > 3 && tcc_parse_args(s, server_argc, server_argv) != server_argc)
+        tcc_error("--server accepts options only");
+    if (s->nb_cmd_include_files)
+        tcc_parse_prelude(s);
+
+    lfd = server_socket(argv[2], &sa);
+    unlink(sa.sun_path);
+    /* for the user of the server only */
+    mask = umask(077);
+    ret = bind(lfd, (struct sockaddr *)&sa, sizeof sa);
+    umask(mask);
+    if (ret < 0 || chmod(sa.sun_path, 0600) < 0 || listen(lfd, 64) < 0)
+        tcc_error("cannot listen on '%s': %s", argv[2], strerror(errno));
+    /* reap children automatically */
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            tcc_error("accept: %s", strerror(errno));
+        }
+        fflush(stdout);
+        fflush(stderr);
+        switch (fork()) {
+        case -1:
+            tcc_warning("fork: %s", strerror(errno));
+            break;
+        case 0:
+            close(lfd);
+            server_child(s, fd);
+        }
+        close(fd);
+    }
+}
+
+/* 'tcc --client socket args...': let the server compile, or compile
+   locally when no server is running */
+static int tcc_client(int argc, char **argv)
+{
+    struct sockaddr_un sa;
+    ServerRequest req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    char cwd[1024], *data;
+    int fd, fds[3], i, envc, len, ret;
+
+    fd = server_socket(argv[2], &sa);
+    argv[2] = argv[0];
+    argc -= 2, argv += 2;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+        close(fd);
+        return tcc_main(tcc_new(), argc, argv);
+    }
+
+    if (!getcwd(cwd, sizeof cwd))
+        tcc_error("getcwd: %s", strerror(errno));
+    len = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++)
+        len += strlen(argv[i]) + 1;
+    for (envc = 0; environ[envc]; envc++)
+        len += strlen(environ[envc]) + 1;
+    if (len > SERVER_MAX_REQUEST)
+        tcc_error("--client: command line and environment too long");
+    data = tcc_malloc(len);
+    strcpy(data, cwd);
+    len = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++) {
+        strcpy(data + len, argv[i]);
+        len += strlen(argv[i]) + 1;
+    }
+    for (i = 0; i < envc; i++) {
+        strcpy(data + len, environ[i]);
+        len += strlen(environ[i]) + 1;
+    }
+
+    req.magic = SERVER_MAGIC;
+    req.argc = argc;
+    req.envc = envc;
+    req.size = len;
+    for (i = 0; i < 3; i++)
+        fds[i] = i;
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &req;
+    iov.iov_len = sizeof req;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof cbuf;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    if (sendmsg(fd, &msg, 0) != sizeof req || write_full(fd, data, len) < 0)
+        tcc_error("--client: cannot send request: %s", strerror(errno));
+    tcc_free(data);
+    /* the server closes the connection without status on tcc_error() */
+    if (read_full(fd, &ret, sizeof ret) < 0)
+        ret = 1;
+    close(fd);
+    return ret;
+}
+#endif /* CONFIG_TCC_SERVER */
+
+int main(int argc, char **argv)
+{
+#ifdef CONFIG_TCC_SERVER
+    if (argc > 2 && !strcmp(argv[1], "--server"))
+        tcc_server(argc, argv); /* does not return */
+    if (argc > 2 && !strcmp(argv[1], "--client"))
+        return tcc_client(argc, argv);
+#endif
+    return tcc_main(tcc_new(), argc, argv);
+}
@@ -52,6 +52,7 @@
 # include <sys/time.h>
 # include <sys/ucontext.h>
 # include <sys/mman.h>
+# include <sys/uio.h>
 # ifndef CONFIG_TCC_STATIC
 #  include <dlfcn.h>
 # endif
@@ -128,7 +129,8 @@
 #endif
 
 #if !defined(TCC_UCLIBC) && !defined(TCC_TARGET_ARM) && \
-    !defined(TCC_TARGET_C67) && !defined(TCC_TARGET_X86_64)
+    !defined(TCC_TARGET_C67) && \
+    !(defined(TCC_TARGET_X86_64) && defined(TCC_TARGET_PE))
 #define CONFIG_TCC_BCHECK /* enable bound checking code */
 #endif
 
@@ -157,6 +159,22 @@
 # define CONFIG_TCC_BACKTRACE
 #endif
 
+/* describe -run code to gdb (JIT interface) and perf (-fjit-dump) */
+#if defined TCC_IS_NATIVE && !defined TCC_TARGET_PE && !defined CONFIG_TCCBOOT
+# define CONFIG_TCC_JIT_DEBUG
+#endif
+
+/* tcc --server/--client, uses unix domain sockets */
+#if !defined _WIN32 && !defined CONFIG_TCCBOOT
+# define CONFIG_TCC_SERVER
+#endif
+
+/* -fparallel-reloc, uses pthreads */
+#if !defined _WIN32 && !defined CONFIG_TCCBOOT
+# define CONFIG_TCC_RELOC_THREADS
+# include <pthread.h>
+#endif
+
 /* ------------ path configuration ------------ */
 
 #ifndef CONFIG_SYSROOT
@@ -257,6 +275,12 @@
 #endif
 #undef TARGET_DEFS_ONLY
 
+/* -gdwarf: DWARF line table and call frame info, where the backend
+   describes its frame layout */
+#ifdef DWARF_REG_SP
+# define CONFIG_TCC_DWARF
+#endif
+
 /* -------------------------------------------- */
 
 #define INCLUDE_STACK_SIZE  32
@@ -265,7 +289,7 @@
 #define STRING_MAX_SIZE     1024
 #define PACK_STACK_SIZE     8
 
-#define TOK_HASH_SIZE       8192 /* must be a power of two */
+#define TOK_HASH_SIZE       8192 /* initial size, must be a power of two */
 #define TOK_ALLOC_INCR      512  /* must be a power of two */
 #define TOK_MAX_SIZE        4 /* token max size in int unit when stored in string */
 
@@ -276,6 +300,11 @@ typedef struct TokenSym {
     struct Sym *sym_label; /* direct pointer to label */
     struct Sym *sym_struct; /* direct pointer to structure */
     struct Sym *sym_identifier; /* direct pointer to identifier */
+    int *macro_memo; /* saved expansion of an object-like macro */
+    int memo_gen; /* define generation 'macro_memo' is valid for */
+    int memo_mark; /* scratch mark used while saving a memo */
+    int hidden; /* number of pending expansions of this macro */
+    unsigned int hash; /* TOK_HASH_FUNC() of the name */
     int tok; /* token number */
     int len;
     char str[1];
@@ -356,6 +385,7 @@ typedef struct Section {
     unsigned long data_offset; /* current data offset */
     unsigned char *data;       /* section data */
     unsigned long data_allocated; /* used for realloc() handling */
+    unsigned long data_reserved; /* size of the mapped region, if any */
     int sh_name;             /* elf section name (only used during output) */
     int sh_num;              /* elf section number */
     int sh_type;             /* elf section type */
@@ -498,6 +528,17 @@ typedef struct CachedInclude {
 
 #define CACHED_INCLUDES_HASH_SIZE 512
 
+#ifdef CONFIG_TCC_SERVER
+/* the -include files as parsed once by tcc --server, usable by the next
+   compilation as long as the options they depend on stay the same */
+typedef struct TCCPrelude {
+    struct Sym *define_start; /* define stack before them */
+    int nostdinc, char_is_unsigned, do_bounds_check;
+    int nb_cmd_include_files;
+    int changed; /* macros or include paths were changed since */
+} TCCPrelude;
+#endif
+
 #ifdef CONFIG_TCC_ASM
 typedef struct ExprValue {
     uint32_t v;
@@ -550,6 +591,12 @@ struct TCCState {
     /* C language options */
     int char_is_unsigned;
     int leading_underscore;
+    /* -run: use transparent huge pages for the code */
+    int jit_hugepages;
+    /* -run: write a perf jitdump file */
+    int jit_dump;
+    /* relocate with several threads */
+    int parallel_reloc;
     
     /* warning switches */
     int warn_write_strings;
@@ -560,6 +607,8 @@ struct TCCState {
 
     /* compile with debug symbol (and use them if error during execution) */
     int do_debug;
+    /* also emit DWARF line and frame info (-gdwarf) */
+    int do_dwarf;
 #ifdef CONFIG_TCC_BCHECK
     /* compile with built-in memory and bounds checker */
     int do_bounds_check;
@@ -588,6 +637,13 @@ struct TCCState {
     char **sysinclude_paths;
     int nb_sysinclude_paths;
 
+    /* files included ahead of each source file (-include) */
+    char **cmd_include_files;
+    int nb_cmd_include_files;
+#ifdef CONFIG_TCC_SERVER
+    TCCPrelude *prelude;
+#endif
+
     /* library paths */
     char **library_paths;
     int nb_library_paths;
@@ -667,18 +723,27 @@ struct TCCState {
 # endif
 #endif
 
+    /* sections[1..nb_relocated_sections] were placed in memory by
+       tcc_relocate(), code compiled after that goes to new ones */
+    int nb_relocated_sections;
+
 #ifdef TCC_IS_NATIVE
     const char *runtime_main;
     /* for tcc_relocate */
-    void *runtime_mem;
-# ifdef HAVE_SELINUX
-    void *write_mem;
-    unsigned long mem_size;
+    addr_t *runtime_mem; /* JIT memory blocks, address and size pairs */
+    int nb_runtime_mem;
+    addr_t runtime_wdelta; /* writable view of the code - code */
+# ifdef CONFIG_TCC_JIT_DEBUG
+    /* images registered with the gdb JIT interface */
+    void **jit_debug_entries;
+    int nb_jit_debug_entries;
+    unsigned long jit_debug_stab; /* .stab data already described */
 # endif
 # if !defined TCC_TARGET_PE && (defined TCC_TARGET_X86_64 || defined TCC_TARGET_ARM)
     /* write PLT and GOT here */
     char *runtime_plt_and_got;
-    unsigned runtime_plt_and_got_offset;
+    unsigned runtime_plt_and_got_offset, runtime_plt_and_got_size;
+    unsigned *runtime_pltgot_slots; /* entries per symbol, see tccelf.c */
 #  define TCC_HAS_RUNTIME_PLTGOT
 # endif
 #endif
@@ -691,9 +756,16 @@ struct TCCState {
     char *option_m; /* only -m32/-m64 handled */
     int print_search_dirs; /* option */
     int option_r; /* option -r */
-    int do_bench; /* option -bench */
+    int do_bench; /* option -bench (2 for -bench=json) */
     int gen_deps; /* option -MD  */
     char *deps_outfile; /* option -MF */
+
+    /* -bench statistics */
+    TCCStats stats;
+    int phase; /* current phase or -1 */
+    int phase_sp;
+    signed char phase_stack[8]; /* enclosing phases */
+    unsigned long long phase_ns, phase_cycles; /* start of current phase */
 };
 
 /* The current value can be: */
@@ -1052,10 +1124,12 @@ ST_FUNC void cstr_free(CString *cstr);
 ST_FUNC void cstr_reset(CString *cstr);
 
 ST_FUNC Section *new_section(TCCState *s1, const char *name, int sh_type, int sh_flags);
+ST_FUNC void free_section(Section *s);
 ST_FUNC void section_realloc(Section *sec, unsigned long new_size);
 ST_FUNC void *section_ptr_add(Section *sec, unsigned long size);
 ST_FUNC void section_reserve(Section *sec, unsigned long size);
 ST_FUNC Section *find_section(TCCState *s1, const char *name);
+ST_FUNC void new_code_sections(TCCState *s1);
 
 ST_FUNC void put_extern_sym2(Sym *sym, Section *section, addr_t value, unsigned long size, int can_add_underscore);
 ST_FUNC void put_extern_sym(Sym *sym, Section *section, addr_t value, unsigned long size);
@@ -1081,7 +1155,20 @@ ST_FUNC int tcc_add_dll(TCCState *s, const char *filename, int flags);
 PUB_FUNC void tcc_print_stats(TCCState *s, int64_t total_time);
 PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv);
 
+/* -bench: time spent in TCC_PHASE_xxx, nested phases excluded */
+ST_FUNC void tcc_phase_enter(TCCState *s1, int phase);
+ST_FUNC void tcc_phase_leave(TCCState *s1);
+ST_FUNC void tcc_phase_unwind(TCCState *s1, int sp);
+#define bench_enter(s1, phase) \
+    ((s1)->do_bench ? tcc_phase_enter(s1, phase) : (void)0)
+#define bench_leave(s1) \
+    ((s1)->do_bench ? tcc_phase_leave(s1) : (void)0)
+
 PUB_FUNC void tcc_set_environment(TCCState *s);
+#ifdef CONFIG_TCC_SERVER
+PUB_FUNC void tcc_parse_prelude(TCCState *s);
+PUB_FUNC const char *tcc_prelude_mismatch(TCCState *s1, TCCPrelude *p);
+#endif
 
 /* ------------ tccpp.c ------------ */
 
@@ -1133,7 +1220,11 @@ ST_FUNC void next_nomacro(void);
 ST_FUNC void next(void);
 ST_INLN void unget_tok(int last_tok);
 ST_FUNC void preprocess_init(TCCState *s1);
+ST_FUNC void preprocess_cmd_includes(TCCState *s1);
 ST_FUNC void preprocess_new(void);
+ST_FUNC void preprocess_delete(void);
+ST_FUNC void preprocess_flush(TCCState *s1);
+ST_FUNC void tok_hash_stats(TCCStats *st);
 ST_FUNC int tcc_preprocess(TCCState *s1);
 ST_FUNC void skip(int c);
 ST_FUNC void expect(const char *msg);
@@ -1177,6 +1268,9 @@ ST_DATA int global_expr;  /* true if compound literals must be allocated globall
 ST_DATA CType func_vt; /* current function return type (used by return instruction) */
 ST_DATA int func_vc;
 ST_DATA int last_line_num, last_ind, func_ind; /* debug last line number and pc */
+#ifdef CONFIG_TCC_DWARF
+ST_DATA int func_leave_ind; /* position of the epilog 'leave', for -gdwarf */
+#endif
 ST_DATA char *funcname;
 
 ST_INLN int is_float(int t);
@@ -1210,6 +1304,9 @@ ST_FUNC void inc(int post, int c);
 ST_FUNC void parse_asm_str(CString *astr);
 ST_FUNC int lvalue_type(int t);
 ST_FUNC void indir(void);
+#if defined CONFIG_TCC_BCHECK && defined TCC_TARGET_X86_64
+ST_FUNC void gbound_args(int nb_args);
+#endif
 ST_FUNC void unary(void);
 ST_FUNC void expr_prod(void);
 ST_FUNC void expr_sum(void);
@@ -1253,9 +1350,22 @@ ST_FUNC void put_stabs_r(const char *str, int type, int other, int desc, unsigne
 ST_FUNC void put_stabn(int type, int other, int desc, int value);
 ST_FUNC void put_stabd(int type, int other, int desc);
 
+#ifdef CONFIG_TCC_DWARF
+ST_FUNC void dwarf_new_sections(TCCState *s1);
+ST_FUNC void dwarf_cu_start(const char *filename, int text_sym);
+ST_FUNC void dwarf_cu_end(void);
+ST_FUNC void dwarf_func_start(Section *sec, unsigned long offset, const char *filename, int line);
+ST_FUNC void dwarf_line(const char *filename, int line, int offset);
+ST_FUNC void dwarf_func_end(int size, int leave_offset);
+#endif
+
 ST_FUNC void relocate_common_syms(void);
 ST_FUNC void relocate_syms(TCCState *s1, int do_resolve);
 ST_FUNC void relocate_section(TCCState *s1, Section *s);
+ST_FUNC void relocate_sections(TCCState *s1, int first, Section *except);
+#ifdef TCC_HAS_RUNTIME_PLTGOT
+ST_FUNC unsigned long runtime_plt_and_got_size(TCCState *s1, addr_t *near);
+#endif
 
 ST_FUNC void tcc_add_linker_symbols(TCCState *s1);
 ST_FUNC int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset);
@@ -1308,6 +1418,10 @@ ST_FUNC void gen_cvt_itof(int t);
 ST_FUNC void gen_vla_sp_save(int addr);
 ST_FUNC void gen_vla_sp_restore(int addr);
 ST_FUNC void gen_vla_alloc(CType *type, int align);
+#ifdef INLINE_MEMOPS
+ST_FUNC void gen_memcpy(int size);
+ST_FUNC void gen_memset(int size, int c);
+#endif
 
 /* ------------ i386-gen.c ------------ */
 #if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
@@ -1322,6 +1436,7 @@ ST_FUNC void gen_addrpc32(int r, Sym *sym, int c);
 #ifdef CONFIG_TCC_BCHECK
 ST_FUNC void gen_bounded_ptr_add(void);
 ST_FUNC void gen_bounded_ptr_deref(void);
+ST_FUNC void gen_bounded_index_error(void);
 #endif
 
 /* ------------ x86_64-gen.c ------------ */
@@ -1391,13 +1506,18 @@ ST_FUNC void *resolve_sym(TCCState *s1, const char *symbol);
 #elif !defined _WIN32
 ST_FUNC void *resolve_sym(TCCState *s1, const char *symbol);
 #endif
+#ifndef _WIN32
+ST_FUNC void rt_add_symbols(const TCCSymbol *syms, int nb_syms);
+#endif
 
 #ifdef CONFIG_TCC_BACKTRACE
 ST_DATA int rt_num_callers;
 ST_DATA const char **rt_bound_error_msg;
+ST_DATA addr_t *rt_bound_error_pc, *rt_bound_error_fp;
 ST_DATA void *rt_prog_main;
 ST_FUNC void tcc_set_num_callers(int n);
 #endif
+ST_FUNC void tcc_run_free(TCCState *s1);
 #endif
 
 /********************************************************/
@@ -801,6 +801,8 @@ ST_FUNC int tcc_assemble(TCCState *s1, int do_preprocess)
     int ret;
 
     preprocess_init(s1);
+    if (s1->nb_relocated_sections)
+        new_code_sections(s1);
 
     /* default section is text */
     cur_text_section = text_section;
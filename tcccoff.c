@@ -38,6 +38,13 @@ int EndAddress[MAX_FUNCS];
 int LastLineNo[MAX_FUNCS];
 int FuncEntries[MAX_FUNCS];
 
+// hash chains over Func[] so the symbol passes can find a function's
+// stab data without comparing against every name
+
+#define FUNC_HASH_SIZE 1024
+int FuncHash[FUNC_HASH_SIZE];
+int FuncNext[MAX_FUNCS];
+
 int OutputTheSection(Section * sect);
 short int GetCoffFlags(const char *s);
 void SortSymbolTable(void);
@@ -46,8 +53,21 @@ Section *FindSection(TCCState * s1, const char *sname);
 int C67_main_entry_point;
 
 int FindCoffSymbolIndex(const char *func_name);
+void BuildCoffSymbolIndex(void);
+void FreeCoffSymbolIndex(void);
+void BuildFuncIndex(void);
+int FindFunc(const char *name);
 int nb_syms;
 
+// ELF -> COFF symbol index map: the COFF index of every function
+// symbol, chained by name hash, plus the total number of COFF symbols
+
+int coff_nb_total;
+int coff_hash_size;
+int *CoffSymHash;
+int *CoffSymNext;
+int *CoffSymIndex;
+
 typedef struct {
     long tag;
     long size;
@@ -92,7 +112,8 @@ ST_FUNC int tcc_output_coff(TCCState *s1, FILE *f)
     sbss = FindSection(s1, ".bss");
 
     nb_syms = symtab_section->data_offset / sizeof(Elf32_Sym);
-    coff_nb_syms = FindCoffSymbolIndex("XXXXXXXXXX1");
+    BuildCoffSymbolIndex();
+    coff_nb_syms = coff_nb_total;
 
     file_hdr.f_magic = COFF_C67_MAGIC;	/* magic number */
     file_hdr.f_timdat = 0;	/* time & date stamp */
@@ -256,6 +277,7 @@ ST_FUNC int tcc_output_coff(TCCState *s1, FILE *f)
 			    memcpy(func_name, str, len);
 			    memcpy(Func[nFuncs], str, len);
 			    func_name[len] = '\0';
+			    Func[nFuncs][len] = '\0';
 			}
 
 			// save the file that it came in so we can sort later
@@ -365,8 +387,12 @@ ST_FUNC int tcc_output_coff(TCCState *s1, FILE *f)
     // group the symbols in order of filename, func1, func2, etc
     // finally global symbols
 
-    if (s1->do_debug)
+    if (s1->do_debug) {
+	BuildFuncIndex();
 	SortSymbolTable();
+	// the sort moved the function symbols, map them again
+	BuildCoffSymbolIndex();
+    }
 
     // write line no data
 
@@ -557,12 +583,9 @@ ST_FUNC int tcc_output_coff(TCCState *s1, FILE *f)
 	    } else if (p->st_info == 0x12) {
 		// find the function data
 
-		for (k = 0; k < nFuncs; k++) {
-		    if (strcmp(name, Func[k]) == 0)
-			break;
-		}
+		k = FindFunc(name);
 
-		if (k >= nFuncs) {
+		if (k < 0) {
 		    tcc_error("debug info can't find function: %s", name);
 		}
 		// put a Function Name
@@ -682,6 +705,8 @@ ST_FUNC int tcc_output_coff(TCCState *s1, FILE *f)
 	tcc_free(Coff_str_table);
     }
 
+    FreeCoffSymbolIndex();
+
     return 0;
 }
 
@@ -724,12 +749,9 @@ void SortSymbolTable(void)
 
 		    // find the function data index
 
-		    for (k = 0; k < nFuncs; k++) {
-			if (strcmp(name2, Func[k]) == 0)
-			    break;
-		    }
+		    k = FindFunc(name2);
 
-		    if (k >= nFuncs) {
+		    if (k < 0) {
                         tcc_error("debug (sort) info can't find function: %s", name2);
 		    }
 
@@ -770,48 +792,118 @@ void SortSymbolTable(void)
 }
 
 
-int FindCoffSymbolIndex(const char *func_name)
+// one pass over the symbol table: record the COFF index of each
+// function symbol (the same counting the writer does below) and hash
+// it by name, so each lookup afterwards is a single chain walk
+
+void BuildCoffSymbolIndex(void)
 {
-    int i, n = 0;
+    int i, k, h, n = 0;
     Elf32_Sym *p;
     char *name;
 
+    FreeCoffSymbolIndex();
+
+    coff_hash_size = 16;
+    while (coff_hash_size < nb_syms)
+	coff_hash_size <<= 1;
+
+    CoffSymHash = (int *) tcc_malloc(coff_hash_size * sizeof(int));
+    CoffSymNext = (int *) tcc_malloc((nb_syms + 1) * sizeof(int));
+    CoffSymIndex = (int *) tcc_malloc((nb_syms + 1) * sizeof(int));
+    memset(CoffSymHash, -1, coff_hash_size * sizeof(int));
+
     p = (Elf32_Sym *) symtab_section->data;
 
     for (i = 0; i < nb_syms; i++) {
 
-	name = (char *) symtab_section->link->data + p->st_name;
-
 	if (p->st_info == 4) {
-	    // put a filename symbol
+	    // filename symbol
 	    n++;
 	} else if (p->st_info == 0x12) {
 
-	    if (strcmp(func_name, name) == 0)
-		return n;
+	    name = (char *) symtab_section->link->data + p->st_name;
+	    h = elf_hash((unsigned char *) name) & (coff_hash_size - 1);
 
+	    // the first symbol of a given name wins, as with a linear scan
+	    for (k = CoffSymHash[h]; k >= 0; k = CoffSymNext[k]) {
+		if (strcmp(name, (char *) symtab_section->link->data +
+			   ((Elf32_Sym *) symtab_section->data)[k].
+			   st_name) == 0)
+		    break;
+	    }
+
+	    if (k < 0) {
+		CoffSymIndex[i] = n;
+		CoffSymNext[i] = CoffSymHash[h];
+		CoffSymHash[h] = i;
+	    }
+	    // function name, .bf, .ef and their aux entries
 	    n += 6;
+	} else {
+	    n += 2;
+	}
 
-	    // put a Function Name
+	p++;
+    }
 
-	    // now put aux info
+    coff_nb_total = n;
+}
 
-	    // put a .bf
+void FreeCoffSymbolIndex(void)
+{
+    tcc_free(CoffSymHash);
+    tcc_free(CoffSymNext);
+    tcc_free(CoffSymIndex);
+    CoffSymHash = CoffSymNext = CoffSymIndex = NULL;
+}
 
-	    // now put aux info
+int FindCoffSymbolIndex(const char *func_name)
+{
+    int k, h;
+    Elf32_Sym *syms;
 
-	    // put a .ef
+    syms = (Elf32_Sym *) symtab_section->data;
+    h = elf_hash((const unsigned char *) func_name) & (coff_hash_size - 1);
 
-	    // now put aux info
+    for (k = CoffSymHash[h]; k >= 0; k = CoffSymNext[k]) {
+	if (strcmp(func_name,
+		   (char *) symtab_section->link->data + syms[k].st_name) == 0)
+	    return CoffSymIndex[k];
+    }
 
-	} else {
-	    n += 2;
-	}
+    return coff_nb_total;	// total number of symbols
+}
 
-	p++;
+// hash the function names collected from the stabs
+
+void BuildFuncIndex(void)
+{
+    int k, h;
+
+    for (h = 0; h < FUNC_HASH_SIZE; h++)
+	FuncHash[h] = -1;
+
+    // insert backwards so that the first of equal names is found first
+    for (k = nFuncs - 1; k >= 0; k--) {
+	h = elf_hash((unsigned char *) Func[k]) & (FUNC_HASH_SIZE - 1);
+	FuncNext[k] = FuncHash[h];
+	FuncHash[h] = k;
+    }
+}
+
+int FindFunc(const char *name)
+{
+    int k;
+
+    k = FuncHash[elf_hash((const unsigned char *) name) &
+		 (FUNC_HASH_SIZE - 1)];
+    for (; k >= 0; k = FuncNext[k]) {
+	if (strcmp(name, Func[k]) == 0)
+	    break;
     }
 
-    return n;			// total number of symbols
+    return k;
 }
 
 int OutputTheSection(Section * sect)
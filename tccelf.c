@@ -425,6 +425,7 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve)
     int sym_bind, sh_num, sym_index;
     const char *name;
 
+    bench_enter(s1, TCC_PHASE_RELOC);
     sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
     for(sym = (ElfW(Sym) *)symtab_section->data + 1; 
         sym < sym_end;
@@ -469,48 +470,203 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve)
         }
     found: ;
     }
+    bench_leave(s1);
 }
 
+/* a part of the relocations of a section */
+typedef struct RelocJob {
+    TCCState *s1;
+    Section *s;
+    ElfW_Rel *rel, *rel_end;
+    unsigned long long plt_calls, direct_calls; /* for TCCStats */
+    char error[64]; /* reported by the main thread */
+} RelocJob;
+
+#ifndef TCC_TARGET_C67
+/* stop a job: it can run in a worker thread, where tcc_error() cannot
+   be called */
+static void reloc_error(RelocJob *job, const char *fmt, ...)
+{
+    va_list ap;
+    if (job->error[0])
+        return; /* keep the first one */
+    va_start(ap, fmt);
+    vsnprintf(job->error, sizeof job->error, fmt, ap);
+    va_end(ap);
+}
+#endif
+
 #ifdef TCC_HAS_RUNTIME_PLTGOT
+/* -run: calls which do not reach their target go through a jump table
+   entry, GOTPCREL relocations through a GOT entry. There is at most
+   one of each per symbol: runtime_pltgot_slots[2 * sym_index] is one
+   plus the offset of its jump table entry, [2 * sym_index + 1] of its
+   GOT entry. */
+
+#ifdef CONFIG_TCC_RELOC_THREADS
+static pthread_mutex_t pltgot_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* return 0 if the entry exists, or (with job->error set) if there is
+   no room left */
+static addr_t new_pltgot_entry(RelocJob *job, int sym_index, int k, int size)
+{
+    TCCState *s1 = job->s1;
+    unsigned *slot = &s1->runtime_pltgot_slots[2 * sym_index + k];
+    addr_t p = 0;
+
+#ifdef CONFIG_TCC_RELOC_THREADS
+    pthread_mutex_lock(&pltgot_mutex);
+#endif
+    if (0 == *slot) {
+        if (s1->runtime_plt_and_got_offset + size > s1->runtime_plt_and_got_size) {
+            reloc_error(job, "internal error: runtime PLT/GOT overflow");
+            goto done;
+        }
+        *slot = s1->runtime_plt_and_got_offset + 1;
+        s1->runtime_plt_and_got_offset += size;
+        p = (addr_t)s1->runtime_plt_and_got + *slot - 1;
+    }
+ done:
+#ifdef CONFIG_TCC_RELOC_THREADS
+    pthread_mutex_unlock(&pltgot_mutex);
+#endif
+    return p;
+}
+
+#define pltgot_entry(s1, sym_index, k) \
+    ((addr_t)(s1)->runtime_plt_and_got \
+     + (s1)->runtime_pltgot_slots[2 * (sym_index) + (k)] - 1)
+
 #ifdef TCC_TARGET_X86_64
 #define JMP_TABLE_ENTRY_SIZE 14
-static addr_t add_jmp_table(TCCState *s1, addr_t val)
+static addr_t add_jmp_table(RelocJob *job, int sym_index, addr_t val)
 {
-    char *p = s1->runtime_plt_and_got + s1->runtime_plt_and_got_offset;
-    s1->runtime_plt_and_got_offset += JMP_TABLE_ENTRY_SIZE;
+    TCCState *s1 = job->s1;
+    char *p = (char *)new_pltgot_entry(job, sym_index, 0, JMP_TABLE_ENTRY_SIZE);
+    char *w;
+    if (!p)
+        return pltgot_entry(s1, sym_index, 0);
+    w = p + s1->runtime_wdelta; /* writable view */
     /* jmp *0x0(%rip) */
-    p[0] = 0xff;
-    p[1] = 0x25;
-    *(int *)(p + 2) = 0;
-    *(addr_t *)(p + 6) = val;
+    w[0] = 0xff;
+    w[1] = 0x25;
+    *(int *)(w + 2) = 0;
+    *(addr_t *)(w + 6) = val;
     return (addr_t)p;
 }
 
-static addr_t add_got_table(TCCState *s1, addr_t val)
+static addr_t add_got_table(RelocJob *job, int sym_index, addr_t val)
 {
-    addr_t *p = (addr_t *)(s1->runtime_plt_and_got + s1->runtime_plt_and_got_offset);
-    s1->runtime_plt_and_got_offset += sizeof(addr_t);
-    *p = val;
+    TCCState *s1 = job->s1;
+    addr_t *p = (addr_t *)new_pltgot_entry(job, sym_index, 1, sizeof(addr_t));
+    if (!p)
+        return pltgot_entry(s1, sym_index, 1);
+    *(addr_t *)((char *)p + s1->runtime_wdelta) = val;
     return (addr_t)p;
 }
+
+/* which entry relocation 'type' to 'sym' may need (1 << k) */
+static int pltgot_entry_kinds(int type, ElfW(Sym) *sym)
+{
+    switch (type) {
+    case R_X86_64_PC32:
+    case R_X86_64_PLT32:
+        /* everything in the image is within reach */
+        if (sym->st_shndx == SHN_UNDEF || sym->st_shndx == SHN_ABS)
+            return 1;
+        break;
+    case R_X86_64_GOTPCREL:
+        return 2;
+    }
+    return 0;
+}
 #elif defined TCC_TARGET_ARM
 #define JMP_TABLE_ENTRY_SIZE 8
-static addr_t add_jmp_table(TCCState *s1, int val)
+static addr_t add_jmp_table(RelocJob *job, int sym_index, int val)
 {
-    uint32_t *p = (uint32_t *)(s1->runtime_plt_and_got + s1->runtime_plt_and_got_offset);
-    s1->runtime_plt_and_got_offset += JMP_TABLE_ENTRY_SIZE;
+    TCCState *s1 = job->s1;
+    uint32_t *p = (uint32_t *)new_pltgot_entry(job, sym_index, 0, JMP_TABLE_ENTRY_SIZE);
+    uint32_t *w;
+    if (!p)
+        return pltgot_entry(s1, sym_index, 0);
+    w = (uint32_t *)((char *)p + s1->runtime_wdelta);
     /* ldr pc, [pc, #-4] */
-    p[0] = 0xE51FF004;
-    p[1] = val;
+    w[0] = 0xE51FF004;
+    w[1] = val;
     return (addr_t)p;
 }
+
+static int pltgot_entry_kinds(int type, ElfW(Sym) *sym)
+{
+    switch (type) {
+    case R_ARM_PC24:
+    case R_ARM_CALL:
+    case R_ARM_JUMP24:
+    case R_ARM_PLT32:
+        /* may also need a veneer for arm/thumb interworking */
+        return 1;
+    }
+    return 0;
+}
 #endif
+
+/* exact size of the runtime PLT/GOT for the relocations of all
+   sections not yet relocated. If 'near' is set, return there the middle of the call
+   targets in shared libraries (to be called after relocate_syms()). */
+ST_FUNC unsigned long runtime_plt_and_got_size(TCCState *s1, addr_t *near)
+{
+    Section *s, *sr;
+    ElfW_Rel *rel, *rel_end;
+    ElfW(Sym) *sym;
+    unsigned char *seen;
+    unsigned long size;
+    addr_t lo, hi;
+    int i, k, sym_index, nb_syms;
+
+    nb_syms = symtab_section->data_offset / sizeof(ElfW(Sym));
+    seen = tcc_mallocz(nb_syms);
+    size = 0, lo = -1, hi = 0;
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        sr = s->reloc;
+        if (!sr)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            sym_index = ELFW(R_SYM)(rel->r_info);
+            sym = &((ElfW(Sym) *)symtab_section->data)[sym_index];
+            k = pltgot_entry_kinds(ELFW(R_TYPE)(rel->r_info), sym);
+            if ((k & 1) && sym->st_shndx == SHN_UNDEF && sym->st_value) {
+                if (sym->st_value < lo)
+                    lo = sym->st_value;
+                if (sym->st_value > hi)
+                    hi = sym->st_value;
+            }
+            k &= ~seen[sym_index];
+            seen[sym_index] |= k;
+            if (k & 1)
+                size += JMP_TABLE_ENTRY_SIZE;
+            if (k & 2)
+                size += sizeof(addr_t);
+        }
+    }
+    tcc_free(seen);
+    if (near)
+        *near = hi ? lo + (hi - lo) / 2 : 0;
+    return size;
+}
 #endif /* def TCC_HAS_RUNTIME_PLTGOT */
 
-/* relocate a given section (CPU dependent) */
-ST_FUNC void relocate_section(TCCState *s1, Section *s)
+/* apply the relocations of a job (CPU dependent). Jobs on different
+   entries can run at the same time, except for TCC_OUTPUT_DLL. A job
+   stops at its first error, left in job->error. */
+static void relocate_job(RelocJob *job)
 {
-    Section *sr;
+#ifndef TCC_TARGET_C67
+    TCCState *s1 = job->s1;
+#endif
+    Section *s = job->s;
     ElfW_Rel *rel, *rel_end, *qrel;
     ElfW(Sym) *sym;
     int type, sym_index;
@@ -520,11 +676,10 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
     int esym_index;
 #endif
 
-    sr = s->reloc;
-    rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
-    qrel = (ElfW_Rel *)sr->data;
+    rel_end = job->rel_end;
+    qrel = job->rel;
     for(rel = qrel;
-        rel < rel_end;
+        rel < rel_end && !job->error[0];
         rel++) {
         ptr = s->data + rel->r_offset;
 
@@ -588,7 +743,8 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
         case R_386_16:
             if (s1->output_format != TCC_OUTPUT_FORMAT_BINARY) {
             output_file:
-		tcc_error("can only produce 16-bit binary files");
+                reloc_error(job, "can only produce 16-bit binary files");
+                break;
             }
             *(short *)ptr += val;
             break;
@@ -619,14 +775,15 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
 #ifdef TCC_HAS_RUNTIME_PLTGOT
                 if (s1->output_type == TCC_OUTPUT_MEMORY) {
                     if (th_ko || x >= 0x2000000 || x < -0x2000000) {
-                        x += add_jmp_table(s1, val) - val; /* add veneer */
+                        x += add_jmp_table(job, sym_index, val) - val; /* add veneer */
                         th_ko = (x & 3) && (!blx_avail || !is_call);
                         is_thumb = 0; /* Veneer uses ARM instructions */
                     }
                 }
 #endif
                 if (th_ko || x >= 0x2000000 || x < -0x2000000)
-                    tcc_error("can't relocate value at %x",addr);
+                    reloc_error(job, "can't relocate value at %x",
+                                (unsigned)addr);
                 x >>= 2;
                 x &= 0xffffff;
                 /* Only reached if blx is avail and it is a call */
@@ -690,7 +847,8 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
                      - instruction must be a call (bl) or a jump to PLT */
                 if (!to_thumb || x >= 0x1000000 || x < -0x1000000)
                     if (to_thumb || (val & 2) || (!is_call && !to_plt))
-                        tcc_error("can't relocate value at %x",addr);
+                        reloc_error(job, "can't relocate value at %x",
+                                    (unsigned)addr);
 
                 /* Compute and store final offset */
                 s = (x >> 24) & 1;
@@ -747,7 +905,8 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
                 x = (x * 2) / 2;
                 x += val - addr;
                 if((x^(x>>1))&0x40000000)
-                    tcc_error("can't relocate value at %x",addr);
+                    reloc_error(job, "can't relocate value at %x",
+                                (unsigned)addr);
                 (*(int *)ptr) |= x & 0x7fffffff;
             }
         case R_ARM_ABS32:
@@ -844,14 +1003,19 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
 #ifdef TCC_HAS_RUNTIME_PLTGOT
                 /* XXX: naive support for over 32bit jump */
                 if (s1->output_type == TCC_OUTPUT_MEMORY) {
-                    val = (add_jmp_table(s1, val - rel->r_addend) +
+                    val = (add_jmp_table(job, sym_index, val - rel->r_addend) +
                            rel->r_addend);
                     diff = val - addr;
+                    job->plt_calls++;
                 }
 #endif
                 if (diff <= -2147483647 || diff > 2147483647) {
-                    tcc_error("internal error: relocation failed");
+                    reloc_error(job, "internal error: relocation failed");
                 }
+            } else if (s1->output_type == TCC_OUTPUT_MEMORY
+                       && (sym->st_shndx == SHN_UNDEF
+                           || sym->st_shndx == SHN_ABS)) {
+                job->direct_calls++;
             }
             *(int *)ptr += diff;
         }
@@ -864,7 +1028,7 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
         case R_X86_64_GOTPCREL:
 #ifdef TCC_HAS_RUNTIME_PLTGOT
             if (s1->output_type == TCC_OUTPUT_MEMORY) {
-                val = add_got_table(s1, val - rel->r_addend) + rel->r_addend;
+                val = add_got_table(job, sym_index, val - rel->r_addend) + rel->r_addend;
                 *(int *)ptr += val - addr;
                 break;
             }
@@ -884,9 +1048,155 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
 #endif
         }
     }
+}
+
+static void relocate_done(TCCState *s1, Section *s, RelocJob *job)
+{
+    s1->stats.relocs += job->rel_end - job->rel;
+    s1->stats.runtime_plt_calls += job->plt_calls;
+    s1->stats.runtime_direct_calls += job->direct_calls;
     /* if the relocation is allocated, we change its symbol table */
-    if (sr->sh_flags & SHF_ALLOC)
-        sr->link = s1->dynsym;
+    if (s && (s->reloc->sh_flags & SHF_ALLOC))
+        s->reloc->link = s1->dynsym;
+}
+
+/* relocate a given section */
+ST_FUNC void relocate_section(TCCState *s1, Section *s)
+{
+    RelocJob job;
+
+    bench_enter(s1, TCC_PHASE_RELOC);
+    memset(&job, 0, sizeof job);
+    job.s1 = s1;
+    job.s = s;
+    job.rel = (ElfW_Rel *)s->reloc->data;
+    job.rel_end = (ElfW_Rel *)(s->reloc->data + s->reloc->data_offset);
+    relocate_job(&job);
+    if (job.error[0])
+        tcc_error("%s", job.error);
+    relocate_done(s1, s, &job);
+    bench_leave(s1);
+}
+
+#ifdef CONFIG_TCC_RELOC_THREADS
+/* -fparallel-reloc: the relocations of all sections are cut in pieces
+   that worker threads take in turn. The symbol values are final at
+   this point; the runtime PLT/GOT entries are allocated under a lock. */
+#define RELOC_JOB_SIZE 16384 /* entries */
+#define RELOC_MAX_THREADS 16
+
+typedef struct RelocWorker {
+    RelocJob *jobs;
+    int first, nb_jobs, step;
+} RelocWorker;
+
+static void *relocate_worker(void *arg)
+{
+    RelocWorker *w = arg;
+    int i;
+    for (i = w->first; i < w->nb_jobs; i += w->step)
+        relocate_job(&w->jobs[i]);
+    return NULL;
+}
+
+static int relocate_threads(TCCState *s1, int first, Section *except)
+{
+    RelocJob *jobs;
+    RelocWorker w[RELOC_MAX_THREADS];
+    pthread_t th[RELOC_MAX_THREADS];
+    ElfW_Rel *rel;
+    Section *s;
+    int i, n, k, nb, nb_jobs, nb_threads;
+    long ncpu;
+
+    if (s1->output_type == TCC_OUTPUT_DLL)
+        return -1;
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nb_threads = ncpu < 1 ? 1 : ncpu > RELOC_MAX_THREADS ? RELOC_MAX_THREADS : ncpu;
+    /* cut the relocation tables */
+    jobs = NULL, nb_jobs = n = 0;
+    for (i = first; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!s->reloc || s == except)
+            continue;
+        rel = (ElfW_Rel *)s->reloc->data;
+        nb = s->reloc->data_offset / sizeof(ElfW_Rel);
+        for (k = 0; k < nb; k += RELOC_JOB_SIZE) {
+            if (nb_jobs == n) {
+                n = n ? 2 * n : 64;
+                jobs = tcc_realloc(jobs, n * sizeof *jobs);
+            }
+            memset(&jobs[nb_jobs], 0, sizeof *jobs);
+            jobs[nb_jobs].s1 = s1;
+            jobs[nb_jobs].s = s;
+            jobs[nb_jobs].rel = rel + k;
+            jobs[nb_jobs].rel_end = rel + (nb - k > RELOC_JOB_SIZE
+                                           ? k + RELOC_JOB_SIZE : nb);
+            nb_jobs++;
+        }
+    }
+    if (nb_threads > nb_jobs)
+        nb_threads = nb_jobs;
+    if (nb_threads < 2) {
+        tcc_free(jobs);
+        return -1;
+    }
+    for (i = 0; i < nb_threads; i++) {
+        w[i].jobs = jobs;
+        w[i].first = i;
+        w[i].nb_jobs = nb_jobs;
+        w[i].step = nb_threads;
+    }
+    for (n = 1; n < nb_threads; n++)
+        if (pthread_create(&th[n], NULL, relocate_worker, &w[n]))
+            break;
+    /* this thread does its share, and that of the threads that could
+       not be started */
+    for (i = n; i < nb_threads; i++)
+        relocate_worker(&w[i]);
+    relocate_worker(&w[0]);
+    for (i = 1; i < n; i++)
+        pthread_join(th[i], NULL);
+
+    /* the errors of the workers are reported from here */
+    for (i = 0; i < nb_jobs; i++) {
+        if (jobs[i].error[0]) {
+            char error[sizeof jobs->error];
+            pstrcpy(error, sizeof error, jobs[i].error);
+            tcc_free(jobs);
+            tcc_error("%s", error);
+        }
+    }
+
+    for (i = 0; i < nb_jobs; i++)
+        relocate_done(s1, i + 1 < nb_jobs && jobs[i + 1].s == jobs[i].s
+                          ? NULL : jobs[i].s, &jobs[i]);
+    s1->stats.reloc_threads = n;
+    tcc_free(jobs);
+    return 0;
+}
+#endif
+
+/* relocate all sections from 'first' on, except 'except' */
+ST_FUNC void relocate_sections(TCCState *s1, int first, Section *except)
+{
+    Section *s;
+    int i;
+
+#ifdef CONFIG_TCC_RELOC_THREADS
+    if (s1->parallel_reloc) {
+        bench_enter(s1, TCC_PHASE_RELOC);
+        i = relocate_threads(s1, first, except);
+        bench_leave(s1);
+        if (0 == i)
+            return;
+    }
+#endif
+    for (i = first; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (s->reloc && s != except)
+            relocate_section(s1, s);
+    }
 }
 
 /* relocate relocation table in 'sr' */
@@ -1149,7 +1459,8 @@ ST_FUNC void build_got_entries(TCCState *s1)
     ElfW(Sym) *sym;
     int i, type, reloc_type, sym_index;
 
-    for(i = 1; i < s1->nb_sections; i++) {
+    bench_enter(s1, TCC_PHASE_GOT);
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
         s = s1->sections[i];
         if (s->sh_type != SHT_RELX)
             continue;
@@ -1247,6 +1558,7 @@ ST_FUNC void build_got_entries(TCCState *s1)
             }
         }
     }
+    bench_leave(s1);
 }
 
 ST_FUNC Section *new_symtab(TCCState *s1,
@@ -1318,7 +1630,7 @@ static void add_init_array_defines(TCCState *s1, const char *section_name)
 ST_FUNC void tcc_add_bcheck(TCCState *s1)
 {
 #ifdef CONFIG_TCC_BCHECK
-    unsigned long *ptr;
+    addr_t *ptr;
     Section *init_section;
     unsigned char *pinit;
     int sym_index;
@@ -1327,21 +1639,29 @@ ST_FUNC void tcc_add_bcheck(TCCState *s1)
         return;
 
     /* XXX: add an object file to do that */
-    ptr = section_ptr_add(bounds_section, sizeof(unsigned long));
+    ptr = section_ptr_add(bounds_section, sizeof(addr_t));
     *ptr = 0;
     add_elf_sym(symtab_section, 0, 0,
                 ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
                 bounds_section->sh_num, "__bounds_start");
-#ifdef TCC_TARGET_I386
+#if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
     if (s1->output_type != TCC_OUTPUT_MEMORY) {
         /* add 'call __bound_init()' in .init section */
         init_section = find_section(s1, ".init");
         pinit = section_ptr_add(init_section, 5);
         pinit[0] = 0xe8;
         put32(pinit + 1, -4);
-        sym_index = find_elf_sym(symtab_section, "__bound_init");
+        /* undefined until libtcc1.a is loaded */
+        sym_index = add_elf_sym(symtab_section, 0, 0,
+                                ELFW(ST_INFO)(STB_GLOBAL, STT_FUNC), 0,
+                                SHN_UNDEF, "__bound_init");
+#ifdef TCC_TARGET_X86_64
+        put_elf_reloc(symtab_section, init_section,
+                      init_section->data_offset - 4, R_X86_64_PC32, sym_index);
+#else
         put_elf_reloc(symtab_section, init_section,
                       init_section->data_offset - 4, R_386_PC32, sym_index);
+#endif
     }
 #endif
 #endif
@@ -1357,6 +1677,15 @@ static inline int tcc_add_support(TCCState *s1, const char *filename)
 /* add tcc runtime libraries */
 ST_FUNC void tcc_add_runtime(TCCState *s1)
 {
+    if (s1->nb_relocated_sections) {
+        /* code added to a relocated state: libc is there already,
+           take what is still missing from libtcc1.a */
+#if !defined CONFIG_USE_LIBGCC && !defined WITHOUT_LIBTCC
+        if (!s1->nostdlib)
+            tcc_add_support(s1, "libtcc1.a");
+#endif
+        return;
+    }
     tcc_add_bcheck(s1);
 
     /* add libc */
@@ -1433,24 +1762,87 @@ ST_FUNC void tcc_add_linker_symbols(TCCState *s1)
     }
 }
 
-static void tcc_output_binary(TCCState *s1, FILE *f,
+/* The output file is described as a list of pieces of memory, section
+   data in place and zeros for the gaps, and written with writev(). */
+#ifdef _WIN32
+struct iovec { void *iov_base; size_t iov_len; };
+#elif !defined IOV_MAX
+#define IOV_MAX 16
+#endif
+
+typedef struct OutputVec {
+    struct iovec *iov;
+    int nb_iov, nb_alloc;
+    unsigned long offset; /* size of the file so far */
+} OutputVec;
+
+static const char output_zeros[4096];
+
+static void output_add(OutputVec *ov, const void *data, unsigned long size)
+{
+    if (0 == size)
+        return;
+    if (ov->nb_iov == ov->nb_alloc) {
+        ov->nb_alloc = ov->nb_alloc ? ov->nb_alloc * 2 : 64;
+        ov->iov = tcc_realloc(ov->iov, ov->nb_alloc * sizeof *ov->iov);
+    }
+    ov->iov[ov->nb_iov].iov_base = (void *)data;
+    ov->iov[ov->nb_iov].iov_len = size;
+    ov->nb_iov++;
+    ov->offset += size;
+}
+
+/* zeros up to file offset 'offset' */
+static void output_pad(OutputVec *ov, unsigned long offset)
+{
+    unsigned long n;
+    while (ov->offset < offset) {
+        n = offset - ov->offset;
+        if (n > sizeof output_zeros)
+            n = sizeof output_zeros;
+        output_add(ov, output_zeros, n);
+    }
+}
+
+static int output_write(OutputVec *ov, int fd)
+{
+    struct iovec *iov = ov->iov, *iov_end = ov->iov + ov->nb_iov;
+    long n;
+
+    while (iov < iov_end) {
+#ifdef _WIN32
+        n = write(fd, iov->iov_base, iov->iov_len);
+#else
+        n = writev(fd, iov, iov_end - iov > IOV_MAX ? IOV_MAX : iov_end - iov);
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        /* skip what was written, maybe part of an entry */
+        while (iov < iov_end && n >= (long)iov->iov_len)
+            n -= iov->iov_len, iov++;
+        if (n) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static void tcc_output_binary(TCCState *s1, OutputVec *ov,
                               const int *section_order)
 {
     Section *s;
-    int i, offset, size;
+    int i;
 
-    offset = 0;
     for(i=1;i<s1->nb_sections;i++) {
         s = s1->sections[section_order[i]];
         if (s->sh_type != SHT_NOBITS &&
             (s->sh_flags & SHF_ALLOC)) {
-            while (offset < s->sh_offset) {
-                fputc(0, f);
-                offset++;
-            }
-            size = s->sh_size;
-            fwrite(s->data, 1, size, f);
-            offset += size;
+            output_pad(ov, s->sh_offset);
+            output_add(ov, s->data, s->sh_size);
         }
     }
 }
@@ -1535,19 +1927,680 @@ ST_FUNC void fill_got(TCCState *s1)
 }
 
 
+#ifdef CONFIG_TCC_DWARF
+/* -gdwarf: a DWARF 2 line table in .debug_line, described by a minimal
+   compilation unit in .debug_info, and call frame info in .eh_frame
+   from the fixed frame layout of gfunc_prolog()/gfunc_epilog(). */
+
+#define DW_TAG_compile_unit     0x11
+#define DW_AT_name              0x03
+#define DW_AT_stmt_list         0x10
+#define DW_AT_low_pc            0x11
+#define DW_AT_high_pc           0x12
+#define DW_AT_language          0x13
+#define DW_AT_comp_dir          0x1b
+#define DW_AT_producer          0x25
+#define DW_FORM_addr            0x01
+#define DW_FORM_data4           0x06
+#define DW_FORM_string          0x08
+#define DW_FORM_data1           0x0b
+#define DW_LANG_C89             0x01
+
+#define DW_LNS_advance_pc       2
+#define DW_LNS_advance_line     3
+#define DW_LNS_set_file         4
+#define DW_LNE_end_sequence     1
+#define DW_LNE_set_address      2
+
+#define DW_CFA_advance_loc      0x40
+#define DW_CFA_offset           0x80
+#define DW_CFA_restore          0xc0
+#define DW_CFA_advance_loc1     0x02
+#define DW_CFA_advance_loc2     0x03
+#define DW_CFA_advance_loc4     0x04
+#define DW_CFA_def_cfa          0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset   0x0e
+
+#define DW_EH_PE_absptr         0x00
+#define DW_EH_PE_udata2         0x02
+#define DW_EH_PE_udata4         0x03
+#define DW_EH_PE_udata8         0x04
+#define DW_EH_PE_sdata2         0x0a
+#define DW_EH_PE_sdata4         0x0b
+#define DW_EH_PE_sdata8         0x0c
+#define DW_EH_PE_pcrel          0x10
+#define DW_EH_PE_datarel        0x30
+#define DW_EH_PE_omit           0xff
+
+/* line program parameters: special opcodes cover line steps of
+   -5..8 at code steps of 0..17 bytes */
+#define DWARF_LINE_BASE         (-5)
+#define DWARF_LINE_RANGE        14
+#define DWARF_OPCODE_BASE       13
+
+static Section *dwarf_line_section, *dwarf_info_section;
+static Section *dwarf_abbrev_section, *eh_frame_section;
+static int dwarf_line_sym, dwarf_abbrev_sym, eh_frame_cie;
+
+/* the unit being compiled. The line program is buffered because the
+   file table which precedes it is only complete at the end. */
+static struct {
+    Section *prog; /* private buffer, not in s1->sections */
+    int *relocs; /* (offset, symbol, addend) of each set_address */
+    int nb_relocs;
+    char **files;
+    int nb_files;
+    char *name;
+    Section *text;
+    int text_sym, text_start;
+    Section *sec; /* section of the current function, NULL outside */
+    int sec_sym;
+    unsigned long func_offset;
+    int file, line, addr; /* line state machine registers */
+    Section *sym_sec; /* last section given its own section symbol */
+    int sym_sec_sym;
+} dw;
+
+static void dw_byte(Section *s, int b)
+{
+    *(unsigned char *)section_ptr_add(s, 1) = b;
+}
+
+static void dw_u16(Section *s, int v)
+{
+    unsigned char *p = section_ptr_add(s, 2);
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void dw_u32(Section *s, uint32_t v)
+{
+    put32(section_ptr_add(s, 4), v);
+}
+
+static void dw_uleb(Section *s, unsigned long v)
+{
+    do {
+        dw_byte(s, (v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+}
+
+static void dw_sleb(Section *s, long v)
+{
+    int b;
+    for(;;) {
+        b = v & 0x7f;
+        v >>= 7;
+        if ((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40)))
+            break;
+        dw_byte(s, b | 0x80);
+    }
+    dw_byte(s, b);
+}
+
+static void dw_str(Section *s, const char *str)
+{
+    int len = strlen(str) + 1;
+    memcpy(section_ptr_add(s, len), str, len);
+}
+
+/* relocate the word at 'offset' to 'sym' + 'addend': in the RELA
+   addend on x86_64, in place on i386 */
+static void dw_reloc(Section *s, unsigned long offset, int type,
+                     int sym, unsigned long addend)
+{
+    put_elf_reloc(symtab_section, s, offset, type, sym);
+#ifdef TCC_TARGET_X86_64
+    ((ElfW_Rel *)(s->reloc->data + s->reloc->data_offset))[-1].r_addend =
+        addend;
+#else
+    put32(s->data + offset, get32(s->data + offset) + addend);
+#endif
+}
+
+static void dw_addr(Section *s, int sym, unsigned long addend)
+{
+    unsigned long offset = s->data_offset;
+    section_ptr_add(s, PTR_SIZE);
+    dw_reloc(s, offset, R_DATA_PTR, sym, addend);
+}
+
+/* pad a CIE or FDE with DW_CFA_nop and store its length */
+static void dw_eh_close(Section *s, unsigned long start)
+{
+    while ((s->data_offset - start) & (PTR_SIZE - 1))
+        dw_byte(s, 0);
+    put32(s->data + start, s->data_offset - start - 4);
+}
+
+static void dw_cfa_advance(Section *s, int delta)
+{
+    if (delta < 0x40) {
+        dw_byte(s, DW_CFA_advance_loc | delta);
+    } else if (delta < 0x100) {
+        dw_byte(s, DW_CFA_advance_loc1);
+        dw_byte(s, delta);
+    } else if (delta < 0x10000) {
+        dw_byte(s, DW_CFA_advance_loc2);
+        dw_u16(s, delta);
+    } else {
+        dw_byte(s, DW_CFA_advance_loc4);
+        dw_u32(s, delta);
+    }
+}
+
+ST_FUNC void dwarf_new_sections(TCCState *s1)
+{
+    Section *s;
+    unsigned long start;
+
+    dwarf_line_section = new_section(s1, ".debug_line", SHT_PROGBITS, 0);
+    dwarf_info_section = new_section(s1, ".debug_info", SHT_PROGBITS, 0);
+    dwarf_abbrev_section = new_section(s1, ".debug_abbrev", SHT_PROGBITS, 0);
+    eh_frame_section = new_section(s1, ".eh_frame", SHT_PROGBITS, SHF_ALLOC);
+    eh_frame_section->sh_addralign = PTR_SIZE;
+    dwarf_line_sym = put_elf_sym(symtab_section, 0, 0,
+                                 ELFW(ST_INFO)(STB_LOCAL, STT_SECTION), 0,
+                                 dwarf_line_section->sh_num, NULL);
+    dwarf_abbrev_sym = put_elf_sym(symtab_section, 0, 0,
+                                   ELFW(ST_INFO)(STB_LOCAL, STT_SECTION), 0,
+                                   dwarf_abbrev_section->sh_num, NULL);
+
+    /* the only abbreviation: a compile unit without children */
+    s = dwarf_abbrev_section;
+    dw_uleb(s, 1);
+    dw_uleb(s, DW_TAG_compile_unit);
+    dw_byte(s, 0);
+    dw_uleb(s, DW_AT_producer), dw_uleb(s, DW_FORM_string);
+    dw_uleb(s, DW_AT_language), dw_uleb(s, DW_FORM_data1);
+    dw_uleb(s, DW_AT_name), dw_uleb(s, DW_FORM_string);
+    dw_uleb(s, DW_AT_comp_dir), dw_uleb(s, DW_FORM_string);
+    dw_uleb(s, DW_AT_low_pc), dw_uleb(s, DW_FORM_addr);
+    dw_uleb(s, DW_AT_high_pc), dw_uleb(s, DW_FORM_addr);
+    dw_uleb(s, DW_AT_stmt_list), dw_uleb(s, DW_FORM_data4);
+    dw_uleb(s, 0), dw_uleb(s, 0);
+    dw_uleb(s, 0);
+
+    /* the CIE shared by all FDEs: on entry the CFA is sp + PTR_SIZE
+       and the return address is saved just below it */
+    s = eh_frame_section;
+    start = eh_frame_cie = s->data_offset;
+    dw_u32(s, 0);
+    dw_u32(s, 0); /* CIE id */
+    dw_byte(s, 1); /* version */
+    dw_str(s, "zR");
+    dw_uleb(s, 1); /* code alignment */
+    dw_sleb(s, -PTR_SIZE); /* data alignment */
+    dw_byte(s, DWARF_REG_RA);
+    dw_uleb(s, 1); /* augmentation data length */
+    dw_byte(s, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+    dw_byte(s, DW_CFA_def_cfa);
+    dw_uleb(s, DWARF_REG_SP);
+    dw_uleb(s, PTR_SIZE);
+    dw_byte(s, DW_CFA_offset | DWARF_REG_RA);
+    dw_uleb(s, 1);
+    dw_eh_close(s, start);
+}
+
+static void dwarf_cu_free(void)
+{
+    if (dw.prog) {
+        tcc_free(dw.prog->data);
+        tcc_free(dw.prog);
+    }
+    tcc_free(dw.relocs);
+    dynarray_reset(&dw.files, &dw.nb_files);
+    tcc_free(dw.name);
+    memset(&dw, 0, sizeof dw);
+}
+
+ST_FUNC void dwarf_cu_start(const char *filename, int text_sym)
+{
+    dwarf_cu_free();
+    dw.prog = tcc_mallocz(sizeof(Section));
+    dw.name = tcc_strdup(filename);
+    dw.text = text_section;
+    dw.text_sym = text_sym;
+    dw.text_start = text_section->data_offset;
+    dynarray_add((void ***)&dw.files, &dw.nb_files, tcc_strdup(filename));
+}
+
+/* file table index of 'filename' (they are numbered from 1) */
+static int dwarf_file(const char *filename)
+{
+    int i;
+
+    if (!strcmp(dw.files[dw.file - 1], filename))
+        return dw.file;
+    for(i = 0; i < dw.nb_files; i++)
+        if (!strcmp(dw.files[i], filename))
+            return i + 1;
+    dynarray_add((void ***)&dw.files, &dw.nb_files, tcc_strdup(filename));
+    return dw.nb_files;
+}
+
+ST_FUNC void dwarf_func_start(Section *sec, unsigned long offset,
+                              const char *filename, int line)
+{
+    Section *s = dw.prog;
+
+    if (!s)
+        return;
+    /* functions are addressed relative to a section symbol, which
+       keeps the .eh_frame relocations out of the dynamic ones */
+    if (sec == dw.text) {
+        dw.sec_sym = dw.text_sym;
+    } else {
+        if (sec != dw.sym_sec) {
+            dw.sym_sec = sec;
+            dw.sym_sec_sym = put_elf_sym(symtab_section, 0, 0,
+                                 ELFW(ST_INFO)(STB_LOCAL, STT_SECTION), 0,
+                                 sec->sh_num, NULL);
+        }
+        dw.sec_sym = dw.sym_sec_sym;
+    }
+    dw.sec = sec;
+    dw.func_offset = offset;
+
+    /* each function is a sequence of its own */
+    dw.relocs = tcc_realloc(dw.relocs, (dw.nb_relocs + 1) * 3 * sizeof(int));
+    dw_byte(s, 0);
+    dw_uleb(s, 1 + PTR_SIZE);
+    dw_byte(s, DW_LNE_set_address);
+    dw.relocs[dw.nb_relocs * 3] = s->data_offset;
+    dw.relocs[dw.nb_relocs * 3 + 1] = dw.sec_sym;
+    dw.relocs[dw.nb_relocs * 3 + 2] = offset;
+    dw.nb_relocs++;
+    section_ptr_add(s, PTR_SIZE);
+    dw.file = 1;
+    dw.line = 1;
+    dw.addr = 0;
+    dwarf_line(filename, line, 0);
+}
+
+/* add a row for 'line' at 'offset' from the start of the function */
+ST_FUNC void dwarf_line(const char *filename, int line, int offset)
+{
+    Section *s = dw.prog;
+    int file, addr_delta, line_delta, op;
+
+    if (!dw.sec)
+        return;
+    addr_delta = offset - dw.addr;
+    if (addr_delta < 0)
+        return;
+    file = dwarf_file(filename);
+    if (file != dw.file) {
+        dw_byte(s, DW_LNS_set_file);
+        dw_uleb(s, file);
+        dw.file = file;
+    }
+    line_delta = line - dw.line;
+    if (line_delta < DWARF_LINE_BASE ||
+        line_delta >= DWARF_LINE_BASE + DWARF_LINE_RANGE) {
+        dw_byte(s, DW_LNS_advance_line);
+        dw_sleb(s, line_delta);
+        line_delta = 0;
+    }
+    op = line_delta - DWARF_LINE_BASE + DWARF_OPCODE_BASE;
+    if (addr_delta > (255 - op) / DWARF_LINE_RANGE) {
+        dw_byte(s, DW_LNS_advance_pc);
+        dw_uleb(s, addr_delta);
+    } else {
+        op += addr_delta * DWARF_LINE_RANGE;
+    }
+    dw_byte(s, op);
+    dw.addr = offset;
+    dw.line = line;
+}
+
+ST_FUNC void dwarf_func_end(int size, int leave_offset)
+{
+    Section *s = dw.prog;
+    unsigned long start;
+
+    if (!dw.sec)
+        return;
+    if (size > dw.addr) {
+        dw_byte(s, DW_LNS_advance_pc);
+        dw_uleb(s, size - dw.addr);
+    }
+    dw_byte(s, 0);
+    dw_uleb(s, 1);
+    dw_byte(s, DW_LNE_end_sequence);
+
+    /* FDE: the CFA moves with 'push %bp', is then tracked by the frame
+       pointer until 'leave' */
+    s = eh_frame_section;
+    start = s->data_offset;
+    dw_u32(s, 0);
+    dw_u32(s, start + 4 - eh_frame_cie); /* CIE pointer */
+    dw_u32(s, 0);
+    dw_reloc(s, s->data_offset - 4, DWARF_R_PC32, dw.sec_sym, dw.func_offset);
+    dw_u32(s, size);
+    dw_uleb(s, 0); /* augmentation data length */
+    dw_cfa_advance(s, DWARF_CFA_PUSH);
+    dw_byte(s, DW_CFA_def_cfa_offset);
+    dw_uleb(s, 2 * PTR_SIZE);
+    dw_byte(s, DW_CFA_offset | DWARF_REG_FP);
+    dw_uleb(s, 2);
+    dw_cfa_advance(s, DWARF_CFA_FRAME - DWARF_CFA_PUSH);
+    dw_byte(s, DW_CFA_def_cfa_register);
+    dw_uleb(s, DWARF_REG_FP);
+    if (leave_offset >= DWARF_CFA_FRAME && leave_offset < size) {
+        dw_cfa_advance(s, leave_offset + 1 - DWARF_CFA_FRAME);
+        dw_byte(s, DW_CFA_def_cfa);
+        dw_uleb(s, DWARF_REG_SP);
+        dw_uleb(s, PTR_SIZE);
+        dw_byte(s, DW_CFA_restore | DWARF_REG_FP);
+    }
+    dw_eh_close(s, start);
+    dw.sec = NULL;
+}
+
+ST_FUNC void dwarf_cu_end(void)
+{
+    static const unsigned char opcode_lengths[DWARF_OPCODE_BASE - 1] = {
+        0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1
+    };
+    Section *s;
+    unsigned long start, header, prog;
+    char buf[512];
+    int i;
+
+    if (!dw.prog)
+        return;
+
+    /* .debug_line: header with the file table, then the program */
+    s = dwarf_line_section;
+    start = s->data_offset;
+    dw_u32(s, 0);
+    dw_u16(s, 2); /* version */
+    header = s->data_offset;
+    dw_u32(s, 0);
+    dw_byte(s, 1); /* minimum instruction length */
+    dw_byte(s, 1); /* default is_stmt */
+    dw_byte(s, DWARF_LINE_BASE);
+    dw_byte(s, DWARF_LINE_RANGE);
+    dw_byte(s, DWARF_OPCODE_BASE);
+    memcpy(section_ptr_add(s, sizeof opcode_lengths), opcode_lengths,
+           sizeof opcode_lengths);
+    dw_byte(s, 0); /* no include directories */
+    for(i = 0; i < dw.nb_files; i++) {
+        dw_str(s, dw.files[i]);
+        dw_uleb(s, 0); /* directory */
+        dw_uleb(s, 0); /* time */
+        dw_uleb(s, 0); /* size */
+    }
+    dw_byte(s, 0);
+    put32(s->data + header, s->data_offset - header - 4);
+    prog = s->data_offset;
+    memcpy(section_ptr_add(s, dw.prog->data_offset), dw.prog->data,
+           dw.prog->data_offset);
+    for(i = 0; i < dw.nb_relocs; i++)
+        dw_reloc(s, prog + dw.relocs[i * 3], R_DATA_PTR,
+                 dw.relocs[i * 3 + 1], dw.relocs[i * 3 + 2]);
+    put32(s->data + start, s->data_offset - start - 4);
+
+    /* .debug_info: the unit covers the code it put in .text */
+    s = dwarf_info_section;
+    header = s->data_offset;
+    dw_u32(s, 0);
+    dw_u16(s, 2); /* version */
+    dw_u32(s, 0);
+    dw_reloc(s, s->data_offset - 4, R_DATA_32, dwarf_abbrev_sym, 0);
+    dw_byte(s, PTR_SIZE);
+    dw_uleb(s, 1);
+    dw_str(s, "tcc " TCC_VERSION);
+    dw_byte(s, DW_LANG_C89);
+    dw_str(s, dw.name);
+    getcwd(buf, sizeof(buf));
+    dw_str(s, buf);
+    dw_addr(s, dw.text_sym, dw.text_start);
+    dw_addr(s, dw.text_sym, dw.text->data_offset);
+    dw_u32(s, 0);
+    dw_reloc(s, s->data_offset - 4, R_DATA_32, dwarf_line_sym, start);
+    put32(s->data + header, s->data_offset - header - 4);
+
+    dwarf_cu_free();
+}
+
+/* .eh_frame_hdr: a sorted table of the FDEs in .eh_frame, found by
+   unwinders through the PT_GNU_EH_FRAME program header */
+
+static Section *find_eh_frame(TCCState *s1)
+{
+    Section *s;
+    int i;
+
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!strcmp(s->name, ".eh_frame") && (s->sh_flags & SHF_ALLOC))
+            return s;
+    }
+    return NULL;
+}
+
+/* return the next CIE or FDE of 'eh' at or after 'p', skipping the
+   padding between the contributions of different objects */
+static unsigned char *eh_frame_next(Section *eh, unsigned char *p,
+                                    unsigned *len)
+{
+    unsigned char *end = eh->data + eh->data_offset;
+
+    while (p + 4 <= end && get32(p) == 0)
+        p += 4;
+    if (p + 8 > end)
+        return NULL;
+    *len = get32(p);
+    /* 64 bit DWARF or truncated entry: give up */
+    if (*len < 4 || *len > end - p - 4)
+        return NULL;
+    return p;
+}
+
+static unsigned long eh_read_uleb(unsigned char **pp)
+{
+    unsigned long v = 0;
+    int shift = 0;
+    unsigned char b;
+    do {
+        b = *(*pp)++;
+        v |= (unsigned long)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+/* read a pointer encoded with 'enc' at '*pp', which is at address
+   'pc'. Return -1 for encodings not used in .eh_frame by C code. */
+static int eh_read_pointer(unsigned char **pp, int enc, addr_t pc,
+                           addr_t *val)
+{
+    unsigned char *p = *pp;
+    addr_t v;
+
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr:
+        v = get32(p);
+#if PTR_SIZE == 8
+        v |= (addr_t)get32(p + 4) << 32;
+#endif
+        p += PTR_SIZE;
+        break;
+    case DW_EH_PE_udata2:
+        v = p[0] | (p[1] << 8), p += 2;
+        break;
+    case DW_EH_PE_sdata2:
+        v = (short)(p[0] | (p[1] << 8)), p += 2;
+        break;
+    case DW_EH_PE_udata4:
+        v = get32(p), p += 4;
+        break;
+    case DW_EH_PE_sdata4:
+        v = (int)get32(p), p += 4;
+        break;
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:
+        v = get32(p) | ((unsigned long long)get32(p + 4) << 32), p += 8;
+        break;
+    default:
+        return -1;
+    }
+    if ((enc & 0x70) == DW_EH_PE_pcrel)
+        v += pc;
+    else if (enc & 0x70)
+        return -1;
+    *pp = p;
+    *val = v;
+    return 0;
+}
+
+/* pointer encoding of the FDEs using the CIE at 'cie', -1 if unknown */
+static int eh_cie_encoding(unsigned char *cie)
+{
+    unsigned char *p = cie + 8, *aug;
+    int version, enc;
+    addr_t dummy;
+
+    version = *p++;
+    aug = p;
+    p += strlen((char *)aug) + 1;
+    if (aug[0] != 'z')
+        return aug[0] ? -1 : DW_EH_PE_absptr;
+    eh_read_uleb(&p); /* code alignment */
+    eh_read_uleb(&p); /* data alignment, only the length matters */
+    if (version == 1)
+        p++;
+    else
+        eh_read_uleb(&p);
+    eh_read_uleb(&p); /* augmentation data length */
+    enc = DW_EH_PE_absptr;
+    for(aug++; *aug; aug++) {
+        switch (*aug) {
+        case 'R':
+            enc = *p++;
+            break;
+        case 'P':
+            if (eh_read_pointer(&p, *p++ & 0x0f, 0, &dummy) < 0)
+                return -1;
+            break;
+        case 'L':
+            p++;
+            break;
+        case 'S':
+            break;
+        default:
+            return -1;
+        }
+    }
+    return enc;
+}
+
+/* create .eh_frame_hdr with room for one table entry per FDE */
+static Section *new_eh_frame_hdr(TCCState *s1, Section **peh)
+{
+    Section *eh, *hdr;
+    unsigned char *p;
+    unsigned len;
+    int nb_fdes;
+
+    eh = find_eh_frame(s1);
+    if (!eh || eh->data_offset == 0)
+        return NULL;
+    nb_fdes = 0;
+    for(p = eh->data; (p = eh_frame_next(eh, p, &len)); p += 4 + len)
+        if (get32(p + 4))
+            nb_fdes++;
+    /* terminator for unwinders which walk .eh_frame itself */
+    dw_u32(eh, 0);
+    hdr = new_section(s1, ".eh_frame_hdr", SHT_PROGBITS, SHF_ALLOC);
+    hdr->sh_addralign = 4;
+    section_ptr_add(hdr, 12 + 8 * nb_fdes);
+    *peh = eh;
+    return hdr;
+}
+
+typedef struct EhFrameEntry {
+    int pc, fde;
+} EhFrameEntry;
+
+static int eh_frame_entry_cmp(const void *a, const void *b)
+{
+    int pa = ((const EhFrameEntry *)a)->pc;
+    int pb = ((const EhFrameEntry *)b)->pc;
+    return pa < pb ? -1 : pa > pb;
+}
+
+/* fill .eh_frame_hdr once .eh_frame is relocated. If an FDE cannot be
+   decoded the table is omitted, unwinders then walk .eh_frame. */
+static void fill_eh_frame_hdr(Section *eh, Section *hdr)
+{
+    unsigned char *p, *q, *cie, *d;
+    EhFrameEntry *tab;
+    addr_t base, pc;
+    unsigned len;
+    int n, enc;
+
+    base = hdr->sh_addr;
+    d = hdr->data;
+    tab = (EhFrameEntry *)(d + 12);
+    n = 0;
+    for(p = eh->data; (p = eh_frame_next(eh, p, &len)); p += 4 + len) {
+        if (!get32(p + 4))
+            continue;
+        cie = p + 4 - get32(p + 4);
+        enc = -1;
+        if (cie >= eh->data && cie + 8 <= p && get32(cie + 4) == 0)
+            enc = eh_cie_encoding(cie);
+        q = p + 8;
+        if (enc < 0 ||
+            eh_read_pointer(&q, enc, eh->sh_addr + (q - eh->data), &pc) < 0) {
+            n = -1;
+            break;
+        }
+        /* FDEs of discarded code */
+        if (pc == 0)
+            continue;
+        tab[n].pc = pc - base;
+        tab[n].fde = eh->sh_addr + (p - eh->data) - base;
+        n++;
+    }
+    d[0] = 1; /* version */
+    d[1] = DW_EH_PE_pcrel | DW_EH_PE_sdata4;
+    put32(d + 4, eh->sh_addr - (base + 4));
+    if (n < 0) {
+        d[2] = DW_EH_PE_omit;
+        d[3] = DW_EH_PE_omit;
+        return;
+    }
+    d[2] = DW_EH_PE_udata4;
+    d[3] = DW_EH_PE_datarel | DW_EH_PE_sdata4;
+    put32(d + 8, n);
+    qsort(tab, n, sizeof *tab, eh_frame_entry_cmp);
+    for(; n > 0; n--, tab++) {
+        put32((unsigned char *)&tab->pc, tab->pc);
+        put32((unsigned char *)&tab->fde, tab->fde);
+    }
+}
+#endif /* CONFIG_TCC_DWARF */
+
 /* output an ELF file */
 /* XXX: suppress unneeded sections */
-static int elf_output_file(TCCState *s1, const char *filename)
+/* output to 'filename', or to 'fd' if 'filename' is NULL */
+static int elf_output_file(TCCState *s1, const char *filename, int fd)
 {
     ElfW(Ehdr) ehdr;
-    FILE *f;
-    int fd, mode, ret;
+    OutputVec ov;
+    int mode, ret;
     int *section_order;
-    int shnum, i, phnum, file_offset, offset, size, j, sh_order_index, k;
+    int shnum, i, phnum, file_offset, j, sh_order_index, k;
     long long tmp;
     addr_t addr;
     Section *strsec, *s;
-    ElfW(Shdr) shdr, *sh;
+    ElfW(Shdr) *shdr, *sh;
     ElfW(Phdr) *phdr, *ph;
     Section *interp, *dynamic, *dynstr;
     unsigned long saved_dynamic_data_offset;
@@ -1557,6 +2610,9 @@ static int elf_output_file(TCCState *s1, const char *filename)
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
     addr_t bss_addr, bss_size;
 #endif
+#ifdef CONFIG_TCC_DWARF
+    Section *eh_frame, *eh_frame_hdr;
+#endif
 
     file_type = s1->output_type;
     s1->nb_errors = 0;
@@ -1566,6 +2622,8 @@ static int elf_output_file(TCCState *s1, const char *filename)
     }
 
     phdr = NULL;
+    shdr = NULL;
+    memset(&ov, 0, sizeof ov);
     section_order = NULL;
     interp = NULL;
     dynamic = NULL;
@@ -1798,6 +2856,14 @@ static int elf_output_file(TCCState *s1, const char *filename)
         }
     }
 
+#ifdef CONFIG_TCC_DWARF
+    /* only with -gdwarf, plain links stay as they were */
+    eh_frame = eh_frame_hdr = NULL;
+    if (s1->do_dwarf && file_type != TCC_OUTPUT_OBJ &&
+        s1->output_format == TCC_OUTPUT_FORMAT_ELF)
+        eh_frame_hdr = new_eh_frame_hdr(s1, &eh_frame);
+#endif
+
     memset(&ehdr, 0, sizeof(ehdr));
 
     /* we add a section for symbols */
@@ -1828,6 +2894,11 @@ static int elf_output_file(TCCState *s1, const char *filename)
         phnum = 3;
         break;
     }
+#ifdef CONFIG_TCC_DWARF
+    /* PT_GNU_EH_FRAME goes just before PT_DYNAMIC, if any */
+    if (eh_frame_hdr)
+        phnum++;
+#endif
 
     /* allocate strings for section names and decide if an unallocated
        section should be output */
@@ -2030,6 +3101,20 @@ static int elf_output_file(TCCState *s1, const char *filename)
             ph->p_flags = PF_R;
             ph->p_align = interp->sh_addralign;
         }
+
+#ifdef CONFIG_TCC_DWARF
+        if (eh_frame_hdr) {
+            ph = &phdr[phnum - 1 - (dynamic != NULL)];
+            ph->p_type = PT_GNU_EH_FRAME;
+            ph->p_offset = eh_frame_hdr->sh_offset;
+            ph->p_vaddr = eh_frame_hdr->sh_addr;
+            ph->p_paddr = ph->p_vaddr;
+            ph->p_filesz = eh_frame_hdr->sh_size;
+            ph->p_memsz = eh_frame_hdr->sh_size;
+            ph->p_flags = PF_R;
+            ph->p_align = eh_frame_hdr->sh_addralign;
+        }
+#endif
         
         /* if dynamic section, then add corresponing program header */
         if (dynamic) {
@@ -2173,11 +3258,11 @@ static int elf_output_file(TCCState *s1, const char *filename)
 
         /* relocate sections */
         /* XXX: ignore sections with allocated relocations ? */
-        for(i = 1; i < s1->nb_sections; i++) {
-            s = s1->sections[i];
-            if (s->reloc && s != s1->got)
-                relocate_section(s1, s);
-        }
+        relocate_sections(s1, 1, s1->got);
+#ifdef CONFIG_TCC_DWARF
+        if (eh_frame_hdr)
+            fill_eh_frame_hdr(eh_frame, eh_frame_hdr);
+#endif
 
         /* relocate relocation entries if the relocation tables are
            allocated in the executable */
@@ -2199,24 +3284,29 @@ static int elf_output_file(TCCState *s1, const char *filename)
         fill_got(s1);
 
     /* write elf file */
-    if (file_type == TCC_OUTPUT_OBJ)
-        mode = 0666;
-    else
-        mode = 0777;
-    unlink(filename);
-    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, mode); 
-    if (fd < 0) {
-        tcc_error_noabort("could not write '%s'", filename);
-        goto fail;
+    if (filename) {
+        if (file_type == TCC_OUTPUT_OBJ)
+            mode = 0666;
+        else
+            mode = 0777;
+        unlink(filename);
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, mode);
+        if (fd < 0) {
+            tcc_error_noabort("could not write '%s'", filename);
+            goto fail;
+        }
+        if (s1->verbose)
+            printf("<- %s\n", filename);
     }
-    f = fdopen(fd, "wb");
-    if (s1->verbose)
-        printf("<- %s\n", filename);
 
 #ifdef TCC_TARGET_COFF
     if (s1->output_format == TCC_OUTPUT_FORMAT_COFF) {
+        /* fclose() must not close 'fd', closed below if ours */
+        FILE *f = fdopen(dup(fd), "wb");
         tcc_output_coff(s1, f);
-    } else
+        fclose(f);
+        goto written;
+    }
 #endif
     if (s1->output_format == TCC_OUTPUT_FORMAT_ELF) {
         sort_syms(s1, symtab_section);
@@ -2263,34 +3353,24 @@ static int elf_output_file(TCCState *s1, const char *filename)
         ehdr.e_shnum = shnum;
         ehdr.e_shstrndx = shnum - 1;
         
-        fwrite(&ehdr, 1, sizeof(ElfW(Ehdr)), f);
-        fwrite(phdr, 1, phnum * sizeof(ElfW(Phdr)), f);
-        offset = sizeof(ElfW(Ehdr)) + phnum * sizeof(ElfW(Phdr));
+        output_add(&ov, &ehdr, sizeof(ElfW(Ehdr)));
+        output_add(&ov, phdr, phnum * sizeof(ElfW(Phdr)));
 
         for(i=1;i<s1->nb_sections;i++) {
             s = s1->sections[section_order[i]];
             if (s->sh_type != SHT_NOBITS) {
 		if (s->sh_type == SHT_DYNSYM)
 		    patch_dynsym_undef(s1, s);
-                while (offset < s->sh_offset) {
-                    fputc(0, f);
-                    offset++;
-                }
-                size = s->sh_size;
-                fwrite(s->data, 1, size, f);
-                offset += size;
+                output_pad(&ov, s->sh_offset);
+                output_add(&ov, s->data, s->sh_size);
             }
         }
 
         /* output section headers */
-        while (offset < ehdr.e_shoff) {
-            fputc(0, f);
-            offset++;
-        }
-    
+        output_pad(&ov, ehdr.e_shoff);
+        shdr = tcc_mallocz(s1->nb_sections * sizeof(ElfW(Shdr)));
         for(i=0;i<s1->nb_sections;i++) {
-            sh = &shdr;
-            memset(sh, 0, sizeof(ElfW(Shdr)));
+            sh = &shdr[i];
             s = s1->sections[i];
             if (s) {
                 sh->sh_name = s->sh_name;
@@ -2305,18 +3385,26 @@ static int elf_output_file(TCCState *s1, const char *filename)
                 sh->sh_offset = s->sh_offset;
                 sh->sh_size = s->sh_size;
             }
-            fwrite(sh, 1, sizeof(ElfW(Shdr)), f);
         }
+        output_add(&ov, shdr, s1->nb_sections * sizeof(ElfW(Shdr)));
     } else {
-        tcc_output_binary(s1, f, section_order);
+        tcc_output_binary(s1, &ov, section_order);
     }
-    fclose(f);
+    if (output_write(&ov, fd) < 0)
+        tcc_error_noabort("could not write '%s'", filename ? filename : "output");
+#ifdef TCC_TARGET_COFF
+ written:
+#endif
+    if (filename)
+        close(fd);
 
-    ret = 0;
+    ret = s1->nb_errors ? -1 : 0;
  the_end:
     tcc_free(s1->symtab_to_dynsym);
     tcc_free(section_order);
     tcc_free(phdr);
+    tcc_free(shdr);
+    tcc_free(ov.iov);
     tcc_free(s1->sym_attrs);
     return ret;
 }
@@ -2324,14 +3412,33 @@ static int elf_output_file(TCCState *s1, const char *filename)
 LIBTCCAPI int tcc_output_file(TCCState *s, const char *filename)
 {
     int ret;
+
+    bench_enter(s, TCC_PHASE_OUTPUT);
 #ifdef TCC_TARGET_PE
     if (s->output_type != TCC_OUTPUT_OBJ) {
         ret = pe_output_file(s, filename);
     } else
 #endif
     {
-        ret = elf_output_file(s, filename);
+        ret = elf_output_file(s, filename, -1);
     }
+    bench_leave(s);
+    return ret;
+}
+
+LIBTCCAPI int tcc_output_fd(TCCState *s, int fd)
+{
+    int ret;
+
+#ifdef TCC_TARGET_PE
+    if (s->output_type != TCC_OUTPUT_OBJ) {
+        tcc_error_noabort("cannot write a PE image to a file descriptor");
+        return -1;
+    }
+#endif
+    bench_enter(s, TCC_PHASE_OUTPUT);
+    ret = elf_output_file(s, NULL, fd);
+    bench_leave(s);
     return ret;
 }
 
@@ -2447,7 +3554,7 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
         if (sh->sh_addralign < 1)
             sh->sh_addralign = 1;
         /* find corresponding section, if any */
-        for(j = 1; j < s1->nb_sections;j++) {
+        for(j = 1 + s1->nb_relocated_sections; j < s1->nb_sections;j++) {
             s = s1->sections[j];
             if (!strcmp(s->name, sh_name)) {
                 if (!strncmp(sh_name, ".gnu.linkonce", 
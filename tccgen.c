@@ -68,6 +68,9 @@ ST_DATA int global_expr;  /* true if compound literals must be allocated globall
 ST_DATA CType func_vt; /* current function return type (used by return instruction) */
 ST_DATA int func_vc;
 ST_DATA int last_line_num, last_ind, func_ind; /* debug last line number and pc */
+#ifdef CONFIG_TCC_DWARF
+ST_DATA int func_leave_ind; /* position of the epilog 'leave', for -gdwarf */
+#endif
 ST_DATA char *funcname;
 
 ST_DATA CType char_pointer_type, func_old_type, int_type, size_type;
@@ -89,6 +92,9 @@ static void vla_runtime_type_size(CType *type, int *a);
 static void vla_sp_save(void);
 static int is_compatible_parameter_types(CType *type1, CType *type2);
 static void expr_type(CType *type);
+#ifdef CONFIG_TCC_BCHECK
+static void bound_pending_spill(unsigned int reloc, int l);
+#endif
 
 ST_INLN int is_float(int t)
 {
@@ -218,6 +224,7 @@ ST_FUNC Sym *sym_push(int v, CType *type, int r, int c)
     else
         ps = &global_stack;
     s = sym_push2(ps, v, type->t, c);
+    tcc_state->stats.syms++;
     s->type.ref = type->ref;
     s->r = r;
     /* don't record fields or anonymous symbols */
@@ -541,6 +548,10 @@ ST_FUNC void save_reg(int r)
                 saved = 1;
             }
             /* mark that stack entry as being saved on the stack */
+#ifdef CONFIG_TCC_BCHECK
+            if ((p->r & (VT_LVAL | VT_BOUNDED)) == (VT_LVAL | VT_BOUNDED))
+                bound_pending_spill(p->c.ul, l);
+#endif
             if (p->r & VT_LVAL) {
                 /* also clear the bounded flag because the
                    relocation address of the function was stored in
@@ -662,6 +673,299 @@ static void gaddrof(void)
 }
 
 #ifdef CONFIG_TCC_BCHECK
+/* Bound check elision.  An access through a constant index into a
+   fixed size array, or to a field of a named structure, is in bounds
+   by construction.  Otherwise, a runtime check of 'size' bytes at
+   'off' from the value of the pointer variable at stack offset 'loc'
+   remains valid until the variable is stored to, a function is called
+   or a jump target is reached: an identical access in between does
+   not need a new check. */
+typedef struct BoundRange {
+    int loc, off, size;
+    /* pending checks: address of the call point, or stack offset of
+       the checked pointer once spilled by save_reg() */
+    unsigned int reloc;
+    int spilled;
+} BoundRange;
+
+#define BOUND_CACHE_SIZE 16
+
+static BoundRange bound_cache[BOUND_CACHE_SIZE]; /* validated ranges */
+static BoundRange bound_pending[BOUND_CACHE_SIZE]; /* not yet dereferenced */
+static int nb_bound_cache, nb_bound_pending;
+/* set by unary() for the next pointer addition and dereference */
+static int bound_elide; /* the access is known to be in bounds */
+static BoundRange bound_next; /* range of the access, or size == 0 */
+
+/* local arrays of the current function. Only those whose address
+   escapes are registered with the runtime, the others are only
+   indexed directly and their index is checked inline */
+typedef struct BoundLocal {
+    int addr, size, escaped;
+} BoundLocal;
+
+#define BOUND_LOCALS_SIZE 64
+
+static BoundLocal bound_locals[BOUND_LOCALS_SIZE];
+static int nb_bound_locals;
+static int bound_addr_wanted; /* parsing the operand of unary '&' */
+static int bound_local_index; /* the next '[' indexes such an array */
+
+/* forget all validated ranges (call, jump target) */
+static void bound_cache_flush(void)
+{
+    nb_bound_cache = nb_bound_pending = 0;
+}
+
+static int bound_range_del(BoundRange *tab, int n, int loc, int size)
+{
+    int i;
+
+    for (i = 0; i < n;) {
+        if (tab[i].loc < loc + size && tab[i].loc + PTR_SIZE > loc)
+            tab[i] = tab[--n];
+        else
+            i++;
+    }
+    return n;
+}
+
+/* forget ranges validated through a pointer stored in [loc, loc + size) */
+static void bound_cache_store(int loc, int size)
+{
+    nb_bound_cache = bound_range_del(bound_cache, nb_bound_cache, loc, size);
+    nb_bound_pending = bound_range_del(bound_pending, nb_bound_pending, loc, size);
+}
+
+/* vstore() to 'sv' */
+static void bound_cache_vstore(SValue *sv)
+{
+    int align, r = sv->r & (VT_VALMASK | VT_LVAL | VT_REF);
+
+    if (r == (VT_LOCAL | VT_LVAL))
+        bound_cache_store(sv->c.i, type_size(&sv->type, &align));
+    else if (r != (VT_CONST | VT_LVAL) || !(sv->r & VT_SYM))
+        bound_cache_flush(); /* may store to any pointer variable */
+}
+
+static void bound_range_add(BoundRange *tab, int *pn, BoundRange *r)
+{
+    int n = *pn;
+
+    if (n == BOUND_CACHE_SIZE) {
+        /* drop the oldest entry */
+        memmove(tab, tab + 1, (n - 1) * sizeof *tab);
+        n--;
+    }
+    tab[n++] = *r;
+    *pn = n;
+}
+
+static int bound_cache_find(BoundRange *r)
+{
+    BoundRange *e;
+
+    for (e = bound_cache; e < bound_cache + nb_bound_cache; e++)
+        if (e->loc == r->loc && r->off >= e->off
+            && r->off + r->size <= e->off + e->size)
+            return 1;
+    return 0;
+}
+
+/* true if 'sv' is the address (lval == 0) or the lvalue (lval ==
+   VT_LVAL) of a named object, not reached through a pointer */
+static int bound_fixed_addr(SValue *sv, int lval)
+{
+    int r = sv->r & VT_VALMASK;
+
+    if ((sv->r & (VT_LVAL | VT_MUSTBOUND | VT_BOUNDED | VT_REF)) != lval)
+        return 0;
+    return r == VT_LOCAL || (r == VT_CONST && (sv->r & VT_SYM));
+}
+
+/* true if 'sv' is a local pointer variable */
+static int bound_ptr_var(SValue *sv)
+{
+    return (sv->type.t & (VT_BTYPE | VT_ARRAY | VT_VLA)) == VT_PTR
+        && (sv->r & VT_VALMASK) == VT_LOCAL && bound_fixed_addr(sv, VT_LVAL);
+}
+
+/* called by unary() for 'vtop[-1][vtop]' */
+static void bound_index(void)
+{
+    SValue *sv = vtop - 1;
+    CType *type;
+    int size, align;
+    long long idx;
+
+    if ((sv->type.t & (VT_BTYPE | VT_VLA)) != VT_PTR
+        || (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != VT_CONST)
+        return;
+    type = pointed_type(&sv->type);
+    if (type->t & VT_VLA)
+        return;
+    size = type_size(type, &align);
+    if ((vtop->type.t & VT_BTYPE) == VT_LLONG)
+        idx = vtop->c.ll;
+    else if (vtop->type.t & VT_UNSIGNED)
+        idx = vtop->c.ui;
+    else
+        idx = vtop->c.i;
+    if (size <= 0 || idx < 0 || idx > 0x7fffffff / size)
+        return;
+    if (sv->type.t & VT_ARRAY) {
+        bound_elide = bound_fixed_addr(sv, 0) && idx < sv->type.ref->c;
+    } else if (bound_ptr_var(sv) && !(type->t & VT_ARRAY)
+               && (type->t & VT_BTYPE) != VT_STRUCT) {
+        bound_next.loc = sv->c.i;
+        bound_next.off = idx * size;
+        bound_next.size = size;
+        bound_elide = bound_cache_find(&bound_next);
+    }
+}
+
+/* called by unary() for field 'f' of 'base' ('base.f' or 'base->f'),
+   vtop is the address of the structure */
+static void bound_field(SValue *base, Sym *f)
+{
+    int align;
+
+    if ((base->type.t & VT_BTYPE) == VT_STRUCT) {
+        bound_elide = bound_fixed_addr(base, VT_LVAL);
+    } else if (bound_ptr_var(base) && !(f->type.t & VT_ARRAY)
+               && (f->type.t & VT_BTYPE) != VT_STRUCT) {
+        bound_next.loc = base->c.i;
+        bound_next.off = f->c;
+        bound_next.size = type_size(&f->type, &align);
+        bound_elide = bound_cache_find(&bound_next);
+    }
+    /* the structure itself is not checked either */
+    if (bound_elide)
+        vtop->r &= ~VT_MUSTBOUND;
+}
+
+/* register the local array at 'addr' with the runtime */
+static void bound_local_register(int addr, int size)
+{
+    addr_t *bounds_ptr;
+
+    bounds_ptr = section_ptr_add(lbounds_section, 2 * sizeof(addr_t));
+    bounds_ptr[0] = addr;
+    bounds_ptr[1] = size;
+    tcc_state->stats.bound_locals++;
+}
+
+static void bound_local_add(int addr, int size)
+{
+    BoundLocal *b;
+
+    if (nb_bound_locals == BOUND_LOCALS_SIZE) {
+        bound_local_register(addr, size);
+        return;
+    }
+    b = &bound_locals[nb_bound_locals++];
+    b->addr = addr;
+    b->size = size;
+    b->escaped = 0;
+}
+
+/* called by unary() after the identifier of the local array 's' */
+static void bound_local_ref(Sym *s)
+{
+    BoundLocal *b;
+    CType *type;
+
+    for (b = bound_locals; b < bound_locals + nb_bound_locals; b++) {
+        if (b->addr == s->c) {
+            type = pointed_type(&s->type);
+            if (tok == '[' && !bound_addr_wanted
+                && !(type->t & (VT_ARRAY | VT_VLA))
+                && (type->t & VT_BTYPE) != VT_STRUCT)
+                bound_local_index = 1;
+            else
+                b->escaped = 1;
+            break;
+        }
+    }
+}
+
+/* end of function: register the local arrays whose address escaped */
+static void bound_local_end(void)
+{
+    BoundLocal *b;
+
+    for (b = bound_locals; b < bound_locals + nb_bound_locals; b++) {
+        if (b->escaped)
+            bound_local_register(b->addr, b->size);
+        else
+            tcc_state->stats.bound_locals_elided++;
+    }
+    nb_bound_locals = 0;
+}
+
+/* 'vtop[-1][vtop]' with vtop[-1] a local array which is not registered
+   with the runtime: compare the index with the array size inline */
+static void bound_local_check(void)
+{
+    int a, n;
+
+    bound_index();
+    if (bound_elide)
+        return;
+    n = vtop[-1].type.ref->c;
+    gen_cast(&size_type);
+    gv(RC_INT);
+    vdup();
+    vpushs(n);
+    gen_op(TOK_ULT);
+    a = gtst(0, 0);
+    gen_bounded_index_error();
+    gsym(a);
+    bound_elide = 1;
+}
+
+/* the pointer addition in vtop was checked at runtime */
+static void bound_check_add(void)
+{
+    tcc_state->stats.bound_checks++;
+    if (bound_next.size) {
+        bound_next.reloc = vtop->c.ul;
+        bound_next.spilled = 0;
+        bound_range_add(bound_pending, &nb_bound_pending, &bound_next);
+    }
+}
+
+static void bound_pending_spill(unsigned int reloc, int l)
+{
+    BoundRange *e;
+
+    for (e = bound_pending; e < bound_pending + nb_bound_pending; e++) {
+        if (e->reloc == reloc && !e->spilled) {
+            e->reloc = l;
+            e->spilled = 1;
+            break;
+        }
+    }
+}
+
+/* the lvalue in vtop is checked for dereferencing: its range is now
+   validated */
+static void bound_check_deref(void)
+{
+    BoundRange *e;
+    int align, spilled;
+
+    spilled = !(vtop->r & VT_BOUNDED);
+    for (e = bound_pending; e < bound_pending + nb_bound_pending; e++) {
+        if (e->reloc == vtop->c.ul && e->spilled == spilled) {
+            if (e->size == type_size(&vtop->type, &align))
+                bound_range_add(bound_cache, &nb_bound_cache, e);
+            *e = bound_pending[--nb_bound_pending];
+            break;
+        }
+    }
+}
+
 /* generate lvalue bound code */
 static void gbound(void)
 {
@@ -671,15 +975,19 @@ static void gbound(void)
     vtop->r &= ~VT_MUSTBOUND;
     /* if lvalue, then use checking code before dereferencing */
     if (vtop->r & VT_LVAL) {
+        if ((vtop->r & VT_BOUNDED) || (vtop->r & VT_VALMASK) == VT_LLOCAL)
+            bound_check_deref();
         /* if not VT_BOUNDED value, then make one */
         if (!(vtop->r & VT_BOUNDED)) {
             lval_type = vtop->r & (VT_LVAL_TYPE | VT_LVAL);
-            /* must save type because we must set it to int to get pointer */
+            /* must save type because we must set it to an integer as
+               large as a pointer to get the pointer */
             type1 = vtop->type;
-            vtop->type.t = VT_INT;
+            vtop->type = size_type;
             gaddrof();
             vpushi(0);
             gen_bounded_ptr_add();
+            tcc_state->stats.bound_checks++;
             vtop->r |= lval_type;
             vtop->type = type1;
         }
@@ -687,6 +995,24 @@ static void gbound(void)
         gen_bounded_ptr_deref();
     }
 }
+
+#ifdef TCC_TARGET_X86_64
+/* do the bound checks of the 'nb_args' function arguments on the
+   stack before the code generator starts to load the argument
+   registers, which the checks clobber */
+ST_FUNC void gbound_args(int nb_args)
+{
+    int i;
+
+    for (i = 1; i <= nb_args; i++) {
+        if (vtop[1 - i].r & VT_MUSTBOUND) {
+            vrotb(i);
+            gbound();
+            vrott(i);
+        }
+    }
+}
+#endif
 #endif
 
 /* store vtop a register belonging to class 'rc'. lvalues are
@@ -1096,6 +1422,33 @@ static void gv_dup(void)
 }
 
 #ifndef TCC_TARGET_X86_64
+/* signed long long division or modulo of vtop by 2^n, 0 < n < 63:
+   negative dividends are biased by 2^n - 1 so that the arithmetic shift
+   rounds toward zero */
+static void gen_opl_sdiv2n(int op, int n)
+{
+    gv_dup();
+    if (op == '%')
+        gv_dup();
+    /* stack: [x] x x */
+    if (n > 1) {
+        vpushi(63);
+        gen_op(TOK_SAR);
+    }
+    vpushi(64 - n);
+    gen_op(TOK_SHR);
+    gen_op('+');
+    if (op == '/') {
+        vpushi(n);
+        gen_op(TOK_SAR);
+    } else {
+        /* x - ((x + bias) & -2^n) */
+        vpushll(-(1LL << n));
+        gen_op('&');
+        gen_op('-');
+    }
+}
+
 /* generate CPU independent (unsigned) long long operations */
 static void gen_opl(int op)
 {
@@ -1104,18 +1457,33 @@ static void gen_opl(int op)
     unsigned short reg_iret = REG_IRET;
     unsigned short reg_lret = REG_LRET;
     SValue tmp;
+    long long l;
 
     switch(op) {
     case '/':
+    case '%':
+        /* by a power of two: shifts instead of __divdi3/__moddi3 */
+        if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+            l = vtop->c.ll;
+            if (l > 1 && (l & (l - 1)) == 0) {
+                vpop();
+                for (c = 0; l > 1; c++)
+                    l >>= 1;
+                gen_opl_sdiv2n(op, c);
+                break;
+            }
+        }
+        if (op == '%') {
+            func = TOK___moddi3;
+            goto gen_mod_func;
+        }
+        /* fall through */
     case TOK_PDIV:
         func = TOK___divdi3;
         goto gen_func;
     case TOK_UDIV:
         func = TOK___udivdi3;
         goto gen_func;
-    case '%':
-        func = TOK___moddi3;
-        goto gen_mod_func;
     case TOK_UMOD:
         func = TOK___umoddi3;
     gen_mod_func:
@@ -1431,6 +1799,11 @@ static void gen_opic(int op)
                     l2 == -1))) {
             /* nothing to do */
             vtop--;
+        } else if (c2 && op == TOK_UMOD && l2 > 0 && (l2 & (l2 - 1)) == 0) {
+            /* unsigned modulo by a power of two: mask */
+            vtop->c.ll = l2 - 1;
+            op = '&';
+            goto general_case;
         } else if (c2 && (op == '*' || op == TOK_PDIV || op == TOK_UDIV)) {
             /* try to use shifts instead of muls or divs */
             if (l2 > 0 && (l2 & (l2 - 1)) == 0) {
@@ -1683,7 +2056,7 @@ ST_FUNC void gen_op(int op)
 #ifdef CONFIG_TCC_BCHECK
             /* if evaluating constant expression, no code should be
                generated, so no bound check */
-            if (tcc_state->do_bounds_check && !const_wanted) {
+            if (tcc_state->do_bounds_check && !const_wanted && !bound_elide) {
                 /* if bounded pointers, we generate a special code to
                    test bounds */
                 if (op == '-') {
@@ -1692,9 +2065,14 @@ ST_FUNC void gen_op(int op)
                     gen_op('-');
                 }
                 gen_bounded_ptr_add();
+                bound_check_add();
             } else
 #endif
             {
+#ifdef CONFIG_TCC_BCHECK
+                if (bound_elide && !const_wanted)
+                    tcc_state->stats.bound_checks_elided++;
+#endif
                 gen_opic(op);
             }
             /* put again type if gen_opic() swaped operands */
@@ -2396,11 +2774,86 @@ static void gen_assign_cast(CType *dt)
     gen_cast(dt);
 }
 
+#ifdef INLINE_MEMOPS
+/* return true if block copies and fills may be generated inline
+   instead of calling memcpy()/memset() */
+static int inline_memops(void)
+{
+#ifdef CONFIG_TCC_BCHECK
+    /* keep the calls so that they are redirected to the checked
+       versions in bcheck.c */
+    if (tcc_state->do_bounds_check)
+        return 0;
+#endif
+    return 1;
+}
+
+/* expand 'memcpy(d, s, n)' and 'memset(d, c, n)' inline when 'n' (and
+   'c') are constants, and the function is the one of the C library: an
+   extern declaration without a definition so far. The function and its
+   'nb_args' arguments are on the value stack. Return true if they were
+   replaced by the result of the call. */
+static int gen_builtin_memop(int nb_args)
+{
+    SValue *f;
+    CType *ret_type;
+    int v, c;
+    long long size;
+
+    f = vtop - nb_args;
+    if (nb_args != 3 || !inline_memops() ||
+        (f->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != (VT_CONST | VT_SYM))
+        return 0;
+    v = f->sym->v;
+    ret_type = &f->type.ref->type;
+    if ((v != TOK_memcpy && v != TOK_memset) ||
+        (ret_type->t & VT_BTYPE) != VT_PTR ||
+        (f->sym->type.t & VT_STATIC) ||
+        !FUNC_PROTO(f->sym->type.ref->r))
+        return 0;
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != VT_CONST)
+        return 0;
+    if ((vtop->type.t & VT_BTYPE) == VT_LLONG)
+        size = vtop->c.ll;
+    else if (vtop->type.t & VT_UNSIGNED)
+        size = vtop->c.ui;
+    else
+        size = vtop->c.i;
+    if (size < 0 || size > 0x7fffffff)
+        return 0;
+    if (v == TOK_memset) {
+        if ((vtop[-1].r & (VT_VALMASK | VT_LVAL | VT_SYM)) != VT_CONST)
+            return 0;
+        c = vtop[-1].c.i;
+        vtop -= 2;
+        /* the destination is also the result */
+        gv(RC_INT);
+        vdup();
+        gen_memset(size, c);
+    } else {
+        vpop();
+        vswap();
+        gv(RC_INT);
+        vdup();
+        vrotb(3);
+        gen_memcpy(size);
+    }
+    vswap();
+    vpop();
+    vtop->type = *ret_type;
+    return 1;
+}
+#endif
+
 /* store vtop in lvalue pushed on stack */
 ST_FUNC void vstore(void)
 {
     int sbt, dbt, ft, r, t, size, align, bit_size, bit_pos, rc, delayed_cast;
 
+#ifdef CONFIG_TCC_BCHECK
+    if (tcc_state->do_bounds_check)
+        bound_cache_vstore(vtop - 1);
+#endif
     ft = vtop[-1].type.t;
     sbt = vtop->type.t & VT_BTYPE;
     dbt = ft & VT_BTYPE;
@@ -2422,7 +2875,6 @@ ST_FUNC void vstore(void)
     if (sbt == VT_STRUCT) {
         /* if structure, only generate pointer */
         /* structure assignment : generate memcpy */
-        /* XXX: optimize if small size */
         if (!nocode_wanted) {
             size = type_size(&vtop->type, &align);
 
@@ -2431,24 +2883,31 @@ ST_FUNC void vstore(void)
             vtop->type.t = VT_PTR;
             gaddrof();
 
-            /* address of memcpy() */
-#ifdef TCC_ARM_EABI
-            if(!(align & 7))
-                vpush_global_sym(&func_old_type, TOK_memcpy8);
-            else if(!(align & 3))
-                vpush_global_sym(&func_old_type, TOK_memcpy4);
-            else
-#endif
-            vpush_global_sym(&func_old_type, TOK_memcpy);
-
-            vswap();
             /* source */
-            vpushv(vtop - 2);
+            vpushv(vtop - 1);
             vtop->type.t = VT_PTR;
             gaddrof();
-            /* type size */
-            vpushi(size);
-            gfunc_call(3);
+
+#ifdef INLINE_MEMOPS
+            if (inline_memops()) {
+                gen_memcpy(size);
+            } else
+#endif
+            {
+                /* address of memcpy() */
+#ifdef TCC_ARM_EABI
+                if(!(align & 7))
+                    vpush_global_sym(&func_old_type, TOK_memcpy8);
+                else if(!(align & 3))
+                    vpush_global_sym(&func_old_type, TOK_memcpy4);
+                else
+#endif
+                vpush_global_sym(&func_old_type, TOK_memcpy);
+                vrott(3);
+                /* type size */
+                vpushi(size);
+                gfunc_call(3);
+            }
         } else {
             vswap();
             vpop();
@@ -3438,6 +3897,14 @@ ST_FUNC void indir(void)
     }
     if ((vtop->r & VT_LVAL) && !nocode_wanted)
         gv(RC_INT);
+#ifdef CONFIG_TCC_BCHECK
+    /* a pointer to array may not point to a whole array: do not let
+       bound_index() take its address as the one of a named object */
+    else if (tcc_state->do_bounds_check && !bound_elide && !nocode_wanted
+             && (pointed_type(&vtop->type)->t & VT_ARRAY)
+             && bound_fixed_addr(vtop, 0))
+        gv(RC_INT);
+#endif
     vtop->type = *pointed_type(&vtop->type);
     /* Arrays and functions are never lvalues */
     if (!(vtop->type.t & VT_ARRAY) && !(vtop->type.t & VT_VLA)
@@ -3445,7 +3912,7 @@ ST_FUNC void indir(void)
         vtop->r |= lvalue_type(vtop->type.t);
         /* if bound checking, the referenced pointer must be checked */
 #ifdef CONFIG_TCC_BCHECK
-        if (tcc_state->do_bounds_check)
+        if (tcc_state->do_bounds_check && !bound_elide)
             vtop->r |= VT_MUSTBOUND;
 #endif
     }
@@ -3641,7 +4108,13 @@ ST_FUNC void unary(void)
         break;
     case '&':
         next();
+#ifdef CONFIG_TCC_BCHECK
+        bound_addr_wanted = 1;
+#endif
         unary();
+#ifdef CONFIG_TCC_BCHECK
+        bound_addr_wanted = 0;
+#endif
         /* functions names must be treated as function pointers,
            except for unary '&' and sizeof. Since we consider that
            functions are not lvalues, we only have to handle it
@@ -3872,6 +4345,12 @@ ST_FUNC void unary(void)
             vtop->sym = s;
             vtop->c.ul = 0;
         }
+#ifdef CONFIG_TCC_BCHECK
+        if (tcc_state->do_bounds_check && !nocode_wanted
+            && (r & VT_VALMASK) == VT_LOCAL && (s->type.t & VT_ARRAY))
+            bound_local_ref(s);
+        bound_addr_wanted = 0;
+#endif
         break;
     }
     
@@ -3882,6 +4361,9 @@ ST_FUNC void unary(void)
             next();
         } else if (tok == '.' || tok == TOK_ARROW) {
             int qualifiers;
+#ifdef CONFIG_TCC_BCHECK
+            SValue base = *vtop;
+#endif
             /* field */ 
             if (tok == TOK_ARROW) 
                 indir();
@@ -3902,6 +4384,10 @@ ST_FUNC void unary(void)
             if (!s)
                 tcc_error("field not found: %s",  get_tok_str(tok & ~SYM_FIELD, NULL));
             /* add field offset to pointer */
+#ifdef CONFIG_TCC_BCHECK
+            if (tcc_state->do_bounds_check && !nocode_wanted)
+                bound_field(&base, s);
+#endif
             vtop->type = char_pointer_type; /* change type to 'char *' */
             vpushi(s->c);
             gen_op('+');
@@ -3913,16 +4399,32 @@ ST_FUNC void unary(void)
                 vtop->r |= lvalue_type(vtop->type.t);
 #ifdef CONFIG_TCC_BCHECK
                 /* if bound checking, the referenced pointer must be checked */
-                if (tcc_state->do_bounds_check)
+                if (tcc_state->do_bounds_check && !bound_elide)
                     vtop->r |= VT_MUSTBOUND;
 #endif
             }
+#ifdef CONFIG_TCC_BCHECK
+            bound_elide = bound_next.size = 0;
+#endif
             next();
         } else if (tok == '[') {
+#ifdef CONFIG_TCC_BCHECK
+            int local_index = bound_local_index;
+            bound_local_index = 0;
+#endif
             next();
             gexpr();
+#ifdef CONFIG_TCC_BCHECK
+            if (local_index)
+                bound_local_check();
+            else if (tcc_state->do_bounds_check && !nocode_wanted)
+                bound_index();
+#endif
             gen_op('+');
             indir();
+#ifdef CONFIG_TCC_BCHECK
+            bound_elide = bound_next.size = 0;
+#endif
             skip(']');
         } else if (tok == '(') {
             SValue ret;
@@ -4003,8 +4505,16 @@ ST_FUNC void unary(void)
             if (sa)
                 tcc_error("too few arguments to function");
             skip(')');
+#ifdef INLINE_MEMOPS
+            if (!nocode_wanted && gen_builtin_memop(nb_args))
+                continue;
+#endif
             if (!nocode_wanted) {
                 gfunc_call(nb_args);
+#ifdef CONFIG_TCC_BCHECK
+                /* the callee may free memory */
+                bound_cache_flush();
+#endif
             } else {
                 vtop -= (nb_args + 1);
             }
@@ -4171,6 +4681,9 @@ static void expr_land(void)
         for(;;) {
             t = gtst(1, t);
             if (tok != TOK_LAND) {
+#ifdef CONFIG_TCC_BCHECK
+                bound_cache_flush();
+#endif
                 vseti(VT_JMPI, t);
                 break;
             }
@@ -4191,6 +4704,9 @@ static void expr_lor(void)
         for(;;) {
             t = gtst(0, t);
             if (tok != TOK_LOR) {
+#ifdef CONFIG_TCC_BCHECK
+                bound_cache_flush();
+#endif
                 vseti(VT_JMP, t);
                 break;
             }
@@ -4262,6 +4778,9 @@ static void expr_cond(void)
             skip(':');
             u = gjmp(0);
             gsym(tt);
+#ifdef CONFIG_TCC_BCHECK
+            bound_cache_flush();
+#endif
             expr_cond();
             type2 = vtop->type;
 
@@ -4346,6 +4865,9 @@ static void expr_cond(void)
             move_reg(r2, r1, type.t);
             vtop->r = r2;
             gsym(tt);
+#ifdef CONFIG_TCC_BCHECK
+            bound_cache_flush();
+#endif
         }
     }
 }
@@ -4478,11 +5000,22 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
 {
     int a, b, c, d;
     Sym *s, *frame_bottom;
+#ifdef CONFIG_TCC_BCHECK
+    /* control statements start and end basic blocks */
+    int bflush = tok >= TOK_IDENT && tok < TOK_UIDENT;
+
+    if (bflush)
+        bound_cache_flush();
+#endif
 
     /* generate line number info */
     if (tcc_state->do_debug &&
         (last_line_num != file->line_num || last_ind != ind)) {
         put_stabn(N_SLINE, 0, file->line_num, ind - func_ind);
+#ifdef CONFIG_TCC_DWARF
+        if (tcc_state->do_dwarf)
+            dwarf_line(file->filename, file->line_num, ind - func_ind);
+#endif
         last_ind = ind;
         last_line_num = file->line_num;
     }
@@ -4506,6 +5039,9 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             next();
             d = gjmp(0);
             gsym(a);
+#ifdef CONFIG_TCC_BCHECK
+            bound_cache_flush();
+#endif
             block(bsym, csym, case_sym, def_sym, case_reg, 0);
             gsym(d); /* patch else jmp */
         } else
@@ -4692,6 +5228,9 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         c = ind;
         a = 0;
         b = 0;
+#ifdef CONFIG_TCC_BCHECK
+        bound_cache_flush();
+#endif
         if (tok != ';') {
             gexpr();
             a = gtst(1, 0);
@@ -4700,12 +5239,18 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         if (tok != ')') {
             e = gjmp(0);
             c = ind;
+#ifdef CONFIG_TCC_BCHECK
+            bound_cache_flush();
+#endif
             gexpr();
             vpop();
             gjmp_addr(d);
             gsym(e);
         }
         skip(')');
+#ifdef CONFIG_TCC_BCHECK
+        bound_cache_flush();
+#endif
         block(&a, &b, case_sym, def_sym, case_reg, 0);
         gjmp_addr(c);
         gsym(a);
@@ -4722,6 +5267,9 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         skip(TOK_WHILE);
         skip('(');
         gsym(b);
+#ifdef CONFIG_TCC_BCHECK
+        bound_cache_flush();
+#endif
         gexpr();
         c = gtst(0, 0);
         gsym_addr(c, d);
@@ -4851,6 +5399,9 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
                 s = label_push(&global_label_stack, b, LABEL_DEFINED);
             }
             s->jnext = ind;
+#ifdef CONFIG_TCC_BCHECK
+            bound_cache_flush();
+#endif
             if (vla_flags & VLA_IN_SCOPE) {
                 gen_vla_sp_restore(*vla_sp_loc);
                 vla_flags |= VLA_NEED_NEW_FRAME;
@@ -4878,6 +5429,10 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             skip(';');
         }
     }
+#ifdef CONFIG_TCC_BCHECK
+    if (bflush)
+        bound_cache_flush();
+#endif
 }
 
 /* t is the array or struct type. c is the array or struct
@@ -5102,6 +5657,11 @@ static void init_putz(CType *t, Section *sec, unsigned long c, int size)
 {
     if (sec) {
         /* nothing to do because globals are already set to zero */
+#ifdef INLINE_MEMOPS
+    } else if (inline_memops()) {
+        vseti(VT_LOCAL, c);
+        gen_memset(size, 0);
+#endif
     } else {
         vpush_global_sym(&func_old_type, TOK_memset);
         vseti(VT_LOCAL, c);
@@ -5467,13 +6027,11 @@ static void decl_initializer_alloc(CType *type, AttributeDef *ad, int r,
         /* XXX: currently, since we do only one pass, we cannot track
            '&' operators, so we add only arrays */
         if (tcc_state->do_bounds_check && (type->t & VT_ARRAY)) {
-            unsigned long *bounds_ptr;
             /* add padding between regions */
             loc--;
-            /* then add local bound info */
-            bounds_ptr = section_ptr_add(lbounds_section, 2 * sizeof(unsigned long));
-            bounds_ptr[0] = addr;
-            bounds_ptr[1] = size;
+            /* then add local bound info, registered at the end of
+               the function if its address escapes */
+            bound_local_add(addr, size);
         }
 #endif
         if (v) {
@@ -5581,11 +6139,11 @@ static void decl_initializer_alloc(CType *type, AttributeDef *ad, int r,
         /* handles bounds now because the symbol must be defined
            before for the relocation */
         if (tcc_state->do_bounds_check) {
-            unsigned long *bounds_ptr;
+            addr_t *bounds_ptr;
 
             greloc(bounds_section, sym, bounds_section->data_offset, R_DATA_PTR);
             /* then add global bound info */
-            bounds_ptr = section_ptr_add(bounds_section, 2 * sizeof(long));
+            bounds_ptr = section_ptr_add(bounds_section, 2 * sizeof(addr_t));
             bounds_ptr[0] = 0; /* relocated */
             bounds_ptr[1] = size;
         }
@@ -5618,6 +6176,11 @@ static void put_func_debug(Sym *sym)
                 cur_text_section, sym->c);
     /* //gr gdb wants a line at the function */
     put_stabn(N_SLINE, 0, file->line_num, 0); 
+#ifdef CONFIG_TCC_DWARF
+    if (tcc_state->do_dwarf)
+        dwarf_func_start(cur_text_section, func_ind,
+                         file->filename, file->line_num);
+#endif
     last_ind = 0;
     last_line_num = 0;
 }
@@ -5692,8 +6255,16 @@ static void gen_function(Sym *sym)
     sym_push2(&local_stack, SYM_FIELD, 0, 0);
     gfunc_prolog(&sym->type);
     rsym = 0;
+#ifdef CONFIG_TCC_BCHECK
+    bound_cache_flush();
+    nb_bound_locals = 0;
+#endif
     block(NULL, NULL, NULL, NULL, 0, 0);
     gsym(rsym);
+#ifdef CONFIG_TCC_BCHECK
+    if (tcc_state->do_bounds_check)
+        bound_local_end();
+#endif
     gfunc_epilog();
     cur_text_section->data_offset = ind;
     label_pop(&global_label_stack, NULL);
@@ -5709,6 +6280,10 @@ static void gen_function(Sym *sym)
         weaken_symbol(sym);
     if (tcc_state->do_debug) {
         put_stabn(N_FUN, 0, 0, ind - func_ind);
+#ifdef CONFIG_TCC_DWARF
+        if (tcc_state->do_dwarf)
+            dwarf_func_end(ind - func_ind, func_leave_ind - func_ind);
+#endif
     }
     /* It's better to crash than to generate wrong code */
     cur_text_section = NULL;
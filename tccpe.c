@@ -350,6 +350,12 @@ struct pe_info {
     int sec_count;
     struct pe_import_info **imp_info;
     int imp_count;
+    /* import lookup while checking symbols, by dynsym index and by
+       dll index (1 + position in imp_info) */
+    struct import_symbol **imp_syms;
+    int nb_imp_syms;
+    int *imp_dlls;
+    int nb_imp_dlls;
 };
 
 #define PE_NUL 0
@@ -403,15 +409,6 @@ static int pe_find_import(TCCState * s1, ElfW(Sym) *sym)
 
 /*----------------------------------------------------------------------------*/
 
-static int dynarray_assoc(void **pp, int n, int key)
-{
-    int i;
-    for (i = 0; i < n; ++i, ++pp)
-    if (key == **(int **) pp)
-        return i;
-    return -1;
-}
-
 #if 0
 ST_FN DWORD umin(DWORD a, DWORD b)
 {
@@ -738,7 +735,7 @@ static int pe_write(struct pe_info *pe)
 
 static struct import_symbol *pe_add_import(struct pe_info *pe, int sym_index)
 {
-    int i;
+    int i, n;
     int dll_index;
     struct pe_import_info *p;
     struct import_symbol *s;
@@ -747,23 +744,40 @@ static struct import_symbol *pe_add_import(struct pe_info *pe, int sym_index)
     isym = (ElfW(Sym) *)pe->s1->dynsymtab_section->data + sym_index;
     dll_index = isym->st_size;
 
-    i = dynarray_assoc ((void**)pe->imp_info, pe->imp_count, dll_index);
-    if (-1 != i) {
-        p = pe->imp_info[i];
-        goto found_dll;
+    /* grow the lookup tables to the current number of dynsyms/dlls */
+    if (sym_index >= pe->nb_imp_syms) {
+        n = pe->s1->dynsymtab_section->data_offset / sizeof(ElfW(Sym));
+        pe->imp_syms = tcc_realloc(pe->imp_syms, n * sizeof *pe->imp_syms);
+        memset(pe->imp_syms + pe->nb_imp_syms, 0,
+            (n - pe->nb_imp_syms) * sizeof *pe->imp_syms);
+        pe->nb_imp_syms = n;
+    }
+    if (dll_index >= pe->nb_imp_dlls) {
+        n = pe->s1->nb_loaded_dlls + 1;
+        pe->imp_dlls = tcc_realloc(pe->imp_dlls, n * sizeof *pe->imp_dlls);
+        memset(pe->imp_dlls + pe->nb_imp_dlls, 0,
+            (n - pe->nb_imp_dlls) * sizeof *pe->imp_dlls);
+        pe->nb_imp_dlls = n;
     }
-    p = tcc_mallocz(sizeof *p);
-    p->dll_index = dll_index;
-    dynarray_add((void***)&pe->imp_info, &pe->imp_count, p);
 
-found_dll:
-    i = dynarray_assoc ((void**)p->symbols, p->sym_count, sym_index);
-    if (-1 != i)
-        return p->symbols[i];
+    s = pe->imp_syms[sym_index];
+    if (s)
+        return s;
+
+    i = pe->imp_dlls[dll_index];
+    if (i) {
+        p = pe->imp_info[i - 1];
+    } else {
+        p = tcc_mallocz(sizeof *p);
+        p->dll_index = dll_index;
+        dynarray_add((void***)&pe->imp_info, &pe->imp_count, p);
+        pe->imp_dlls[dll_index] = pe->imp_count;
+    }
 
     s = tcc_mallocz(sizeof *s);
     dynarray_add((void***)&p->symbols, &p->sym_count, s);
     s->sym_index = sym_index;
+    pe->imp_syms[sym_index] = s;
     return s;
 }
 
@@ -1299,6 +1313,10 @@ static int pe_check_symbols(struct pe_info *pe)
             sym->st_other |= 1;
         }
     }
+    tcc_free(pe->imp_syms);
+    tcc_free(pe->imp_dlls);
+    pe->imp_syms = NULL, pe->nb_imp_syms = 0;
+    pe->imp_dlls = NULL, pe->nb_imp_dlls = 0;
     return ret;
 }
 
@@ -1578,12 +1596,14 @@ static char *trimback(char *a, char *e)
     return a;
 }
 
-static char *get_line(char *line, int size, int fd)
+static char *get_line(char *line, int size, const char **pp)
 {
+    const char *s = *pp;
     int n;
-    for (n = 0; n < size - 1; )
-        if (read(fd, line + n, 1) < 1 || line[n++] == '\n')
+    for (n = 0; n < size - 1 && *s; )
+        if ((line[n++] = *s++) == '\n')
             break;
+    *pp = s;
     if (0 == n)
         return NULL;
     trimback(line, line + n);
@@ -1594,12 +1614,24 @@ static char *get_line(char *line, int size, int fd)
 static int pe_load_def(TCCState *s1, int fd)
 {
     int state = 0, ret = -1, dllindex = 0;
-    char line[400], dllname[80], *p;
+    char line[400], dllname[80], *p, *buf;
+    const char *next;
+    long size;
+
+    /* read the whole file at once rather than a byte per read() */
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 0)
+        return -1;
+    buf = tcc_malloc(size + 1);
+    if (!read_mem(fd, 0, buf, size))
+        goto quit;
+    buf[size] = 0;
+    next = buf;
 
     for (;;) {
         int ord = 0;
-        char *x, *d, idxstr[8];
-        p = get_line(line, sizeof line, fd);
+        char *x, *d, idxstr[12];
+        p = get_line(line, sizeof line, &next);
         if (NULL == p)
             break;
         if (0 == *p || ';' == *p)
@@ -1633,7 +1665,7 @@ static int pe_load_def(TCCState *s1, int fd)
             }
             if (d) {
                 ord = atoi(d+1);
-                itoa(ord, idxstr, 10);
+                sprintf(idxstr, "%d", ord);
                 if (strcmp(idxstr, d+1) == 0) {
                     memset(d, 0, 1);
                     trimback(p, d);
@@ -1646,6 +1678,7 @@ static int pe_load_def(TCCState *s1, int fd)
     }
     ret = 0;
 quit:
+    tcc_free(buf);
     return ret;
 }
 
@@ -1800,9 +1833,11 @@ static void pe_add_runtime(TCCState *s1, struct pe_info *pe)
 
     if (TCC_OUTPUT_MEMORY == s1->output_type) {
         pe_type = PE_RUN;
+#ifdef TCC_IS_NATIVE
         s1->runtime_main = start_symbol;
+#endif
     } else {
-        pe->start_addr = (DWORD)tcc_get_symbol_err(s1, start_symbol);
+        pe->start_addr = (DWORD)get_elf_sym_addr(s1, start_symbol, 1);
     }
 
     pe->type = pe_type;
@@ -57,11 +57,27 @@ static int *macro_ptr_allocated;
 static const int *unget_saved_macro_ptr;
 static int unget_saved_buffer[TOK_MAX_SIZE + 1];
 static int unget_buffer_enabled;
-static TokenSym *hash_ident[TOK_HASH_SIZE];
+static TokenSym **hash_ident;
+static int hash_ident_size; /* a power of two */
 static char token_buf[STRING_MAX_SIZE + 1];
 /* true if isid(c) || isnum(c) */
 static unsigned char isidnum_table[256-CH_EOF];
 
+/* freed token strings kept for reuse */
+#define TOK_STR_POOL_SIZE 64
+#define TOK_STR_POOL_MAX 1024
+static int *tok_str_pool[TOK_STR_POOL_SIZE];
+static int nb_tok_str_pool;
+
+/* bumped on every change to the defines, invalidates the memos */
+static int define_gen;
+/* macros looked at by the current expansion (see macro_subst_tok) */
+static int *macro_uses;
+static int nb_macro_uses, macro_uses_size;
+/* set when an expansion depended on its context */
+static int macro_volatile;
+static int memo_mark;
+
 static const char tcc_keywords[] = 
 #define DEF(id, str) str "\0"
 #include "tcctok.h"
@@ -190,8 +206,27 @@ static void add_char(CString *cstr, int c)
 }
 
 /* ------------------------------------------------------------------------- */
+/* double the number of buckets, using the hash kept in each token */
+static void tok_hash_resize(void)
+{
+    TokenSym **table, *ts;
+    int i, n;
+
+    n = hash_ident_size * 2;
+    table = tcc_mallocz(n * sizeof(TokenSym *));
+    for(i = 0; i < tok_ident - TOK_IDENT; i++) {
+        ts = table_ident[i];
+        ts->hash_next = table[ts->hash & (n - 1)];
+        table[ts->hash & (n - 1)] = ts;
+    }
+    tcc_free(hash_ident);
+    hash_ident = table;
+    hash_ident_size = n;
+}
+
 /* allocate a new token */
-static TokenSym *tok_alloc_new(TokenSym **pts, const char *str, int len)
+static TokenSym *tok_alloc_new(TokenSym **pts, const char *str, int len,
+                               unsigned int h)
 {
     TokenSym *ts, **ptable;
     int i;
@@ -199,10 +234,12 @@ static TokenSym *tok_alloc_new(TokenSym **pts, const char *str, int len)
     if (tok_ident >= SYM_FIRST_ANOM) 
         tcc_error("memory full");
 
-    /* expand token table if needed */
+    /* expand token table if needed, doubling it once it is larger
+       than TOK_ALLOC_INCR */
     i = tok_ident - TOK_IDENT;
-    if ((i % TOK_ALLOC_INCR) == 0) {
-        ptable = tcc_realloc(table_ident, (i + TOK_ALLOC_INCR) * sizeof(TokenSym *));
+    if (i == 0 || (i >= TOK_ALLOC_INCR && (i & (i - 1)) == 0)) {
+        ptable = tcc_realloc(table_ident,
+            (i < TOK_ALLOC_INCR ? TOK_ALLOC_INCR : 2 * i) * sizeof(TokenSym *));
         table_ident = ptable;
     }
 
@@ -213,39 +250,73 @@ static TokenSym *tok_alloc_new(TokenSym **pts, const char *str, int len)
     ts->sym_label = NULL;
     ts->sym_struct = NULL;
     ts->sym_identifier = NULL;
+    ts->macro_memo = NULL;
+    ts->memo_gen = 0;
+    ts->memo_mark = 0;
+    ts->hidden = 0;
+    ts->hash = h;
     ts->len = len;
     ts->hash_next = NULL;
     memcpy(ts->str, str, len);
     ts->str[len] = '\0';
     *pts = ts;
+    /* keep the chains short: at most one identifier per bucket on
+       average */
+    if (tok_ident - TOK_IDENT > hash_ident_size)
+        tok_hash_resize();
     return ts;
 }
 
 #define TOK_HASH_INIT 1
 #define TOK_HASH_FUNC(h, c) ((h) * 263 + (c))
 
+/* find a token with hash 'h' and add it if not found */
+static TokenSym *tok_alloc_hash(const char *str, int len, unsigned int h)
+{
+    TokenSym *ts, **pts;
+
+    pts = &hash_ident[h & (hash_ident_size - 1)];
+    for(;;) {
+        ts = *pts;
+        if (!ts)
+            break;
+        if (ts->hash == h && ts->len == len && !memcmp(ts->str, str, len))
+            return ts;
+        pts = &(ts->hash_next);
+    }
+    return tok_alloc_new(pts, str, len, h);
+}
+
 /* find a token and add it if not found */
 ST_FUNC TokenSym *tok_alloc(const char *str, int len)
 {
-    TokenSym *ts, **pts;
     int i;
     unsigned int h;
     
     h = TOK_HASH_INIT;
     for(i=0;i<len;i++)
         h = TOK_HASH_FUNC(h, ((unsigned char *)str)[i]);
-    h &= (TOK_HASH_SIZE - 1);
+    return tok_alloc_hash(str, len, h);
+}
 
-    pts = &hash_ident[h];
-    for(;;) {
-        ts = *pts;
-        if (!ts)
-            break;
-        if (ts->len == len && !memcmp(ts->str, str, len))
-            return ts;
-        pts = &(ts->hash_next);
+/* chain statistics of the identifier table, for -bench */
+ST_FUNC void tok_hash_stats(TCCStats *st)
+{
+    TokenSym *ts;
+    unsigned long long n, probes, max;
+    int i;
+
+    probes = max = 0;
+    for(i = 0; i < hash_ident_size; i++) {
+        n = 0;
+        for(ts = hash_ident[i]; ts; ts = ts->hash_next)
+            probes += ++n;
+        if (n > max)
+            max = n;
     }
-    return tok_alloc_new(pts, str, len);
+    st->ident_buckets = hash_ident_size;
+    st->ident_max_chain = max;
+    st->ident_probes = probes;
 }
 
 /* XXX: buffer overflow */
@@ -830,9 +901,18 @@ ST_INLN void tok_str_new(TokenString *s)
     s->last_line_num = -1;
 }
 
+/* token strings are allocated with their capacity stored in the
+   word before the first token, so that small ones can be put back
+   in a pool when freed and reused by the next tok_str_realloc() */
 ST_FUNC void tok_str_free(int *str)
 {
-    tcc_free(str);
+    if (!str)
+        return;
+    str--;
+    if (str[0] <= TOK_STR_POOL_MAX && nb_tok_str_pool < TOK_STR_POOL_SIZE)
+        tok_str_pool[nb_tok_str_pool++] = str;
+    else
+        tcc_free(str);
 }
 
 static int *tok_str_realloc(TokenString *s)
@@ -840,13 +920,20 @@ static int *tok_str_realloc(TokenString *s)
     int *str, len;
 
     if (s->allocated_len == 0) {
-        len = 8;
+        if (nb_tok_str_pool) {
+            str = tok_str_pool[--nb_tok_str_pool];
+            len = str[0];
+        } else {
+            len = 8;
+            str = tcc_malloc((len + 1) * sizeof(int));
+        }
     } else {
         len = s->allocated_len * 2;
+        str = tcc_realloc(s->str - 1, (len + 1) * sizeof(int));
     }
-    str = tcc_realloc(s->str, len * sizeof(int));
+    str[0] = len;
     s->allocated_len = len;
-    s->str = str;
+    s->str = ++str;
     return str;
 }
 
@@ -932,6 +1019,18 @@ static void tok_str_add2(TokenString *s, int t, CValue *cv)
     s->len = len;
 }
 
+/* add 'n' words of tokens already encoded by tok_str_add2() */
+static inline void tok_str_add_words(TokenString *s, const int *p, int n)
+{
+    while (s->len + n > s->allocated_len)
+        tok_str_realloc(s);
+    if (n == 1)
+        s->str[s->len] = *p;
+    else
+        memcpy(s->str + s->len, p, n * sizeof(int));
+    s->len += n;
+}
+
 /* add the current parse token in token string 's' */
 ST_FUNC void tok_str_add_tok(TokenString *s)
 {
@@ -1020,6 +1119,7 @@ ST_INLN void define_push(int v, int macro_type, int *str, Sym *first_arg)
     if (s && !macro_is_equal(s->d, str))
         tcc_warning("%s redefined", get_tok_str(v, NULL));
 
+    define_gen++;
     s = sym_push2(&define_stack, v, macro_type, 0);
     s->d = str;
     s->next = first_arg;
@@ -1034,6 +1134,7 @@ ST_FUNC void define_undef(Sym *s)
     if (v >= TOK_IDENT && v < tok_ident)
         table_ident[v - TOK_IDENT]->sym_define = NULL;
     s->v = 0;
+    define_gen++;
 }
 
 ST_INLN Sym *define_find(int v)
@@ -1050,6 +1151,7 @@ ST_FUNC void free_defines(Sym *b)
     Sym *top, *top1;
     int v;
 
+    define_gen++;
     top = define_stack;
     while (top != b) {
         top1 = top->prev;
@@ -2212,17 +2314,17 @@ maybe_newline:
             /* fast case : no stray found, so we have the full token
                and we have already hashed it */
             len = p - p1;
-            h &= (TOK_HASH_SIZE - 1);
-            pts = &hash_ident[h];
+            pts = &hash_ident[h & (hash_ident_size - 1)];
             for(;;) {
                 ts = *pts;
                 if (!ts)
                     break;
-                if (ts->len == len && !memcmp(ts->str, p1, len))
+                if (ts->hash == h && ts->len == len &&
+                    !memcmp(ts->str, p1, len))
                     goto token_found;
                 pts = &(ts->hash_next);
             }
-            ts = tok_alloc_new(pts, p1, len);
+            ts = tok_alloc_new(pts, p1, len, h);
         token_found: ;
         } else {
             /* slower case */
@@ -2237,9 +2339,10 @@ maybe_newline:
         parse_ident_slow:
             while (isidnum_table[c-CH_EOF]) {
                 cstr_ccat(&tokcstr, c);
+                h = TOK_HASH_FUNC(h, c);
                 PEEKC(c, p);
             }
-            ts = tok_alloc(tokcstr.data, tokcstr.size);
+            ts = tok_alloc_hash(tokcstr.data, tokcstr.size, h);
         }
         tok = ts->tok;
         break;
@@ -2256,6 +2359,7 @@ maybe_newline:
             } else {
                 cstr_reset(&tokcstr);
                 cstr_ccat(&tokcstr, 'L');
+                h = TOK_HASH_FUNC(TOK_HASH_INIT, 'L');
                 goto parse_ident_slow;
             }
         }
@@ -2508,7 +2612,10 @@ static void next_nomacro_spc(void)
             }
         }
     } else {
+        bench_enter(tcc_state, TCC_PHASE_LEX);
         next_nomacro1();
+        bench_leave(tcc_state);
+        tcc_state->stats.tokens++;
     }
 }
 
@@ -2617,6 +2724,66 @@ static char const ab_month_name[12][4] =
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
 };
 
+/* remember that the current expansion depends on macro 'v' */
+static void macro_use(int v)
+{
+    if (nb_macro_uses >= macro_uses_size) {
+        macro_uses_size = macro_uses_size ? macro_uses_size * 2 : 64;
+        macro_uses = tcc_realloc(macro_uses, macro_uses_size * sizeof(int));
+    }
+    macro_uses[nb_macro_uses++] = v;
+}
+
+/* save the expansion (str,len) of the object-like macro 'ts'. The
+   memo is laid out as: parse flags, number of macros used, length,
+   the macros used (from 'macro_uses[uses]' on) and the tokens. */
+static void macro_memo_save(TokenSym *ts, const int *str, int len, int uses)
+{
+    int i, n, *memo;
+    TokenSym *u;
+
+    tcc_free(ts->macro_memo);
+    memo = tcc_malloc((3 + nb_macro_uses - uses + len) * sizeof(int));
+    memo_mark++;
+    for(i = uses, n = 0; i < nb_macro_uses; i++) {
+        u = table_ident[macro_uses[i] - TOK_IDENT];
+        if (u->memo_mark != memo_mark) {
+            u->memo_mark = memo_mark;
+            memo[3 + n++] = macro_uses[i];
+        }
+    }
+    memo[0] = parse_flags;
+    memo[1] = n;
+    memo[2] = len;
+    memcpy(memo + 3 + n, str, len * sizeof(int));
+    ts->macro_memo = memo;
+    ts->memo_gen = define_gen;
+}
+
+/* add the saved expansion of 'ts' to 'tok_str' if it is still valid:
+   no define changed since and none of the macros it used is being
+   expanded now. Return non zero if done. */
+static int macro_memo_use(TokenString *tok_str, TokenSym *ts)
+{
+    int i, n, len, *memo;
+
+    memo = ts->macro_memo;
+    if (!memo || ts->memo_gen != define_gen || memo[0] != parse_flags)
+        return 0;
+    n = memo[1];
+    len = memo[2];
+    for(i = 0; i < n; i++)
+        if (table_ident[memo[3 + i] - TOK_IDENT]->hidden)
+            return 0;
+    for(i = 0; i < n; i++)
+        macro_use(memo[3 + i]);
+    while (tok_str->len + len > tok_str->allocated_len)
+        tok_str_realloc(tok_str);
+    memcpy(tok_str->str + tok_str->len, memo + 3 + n, len * sizeof(int));
+    tok_str->len += len;
+    return 1;
+}
+
 /* do macro substitution of current token with macro 's' and add
    result to (tok_str,tok_len). 'nested_list' is the list of all
    macros we got inside to avoid recursing. Return non zero if no
@@ -2626,6 +2793,8 @@ static int macro_subst_tok(TokenString *tok_str,
 {
     Sym *args, *sa, *sa1;
     int mstr_allocated, parlevel, *mstr, t, t1, spc;
+    int len, uses, vol;
+    TokenSym *ts;
     const int *p;
     TokenString str;
     char *cstrval;
@@ -2635,6 +2804,9 @@ static int macro_subst_tok(TokenString *tok_str,
     
     /* if symbol is a macro, prepare substitution */
     /* special macros */
+    if (tok == TOK___LINE__ || tok == TOK___FILE__ ||
+        tok == TOK___DATE__ || tok == TOK___TIME__)
+        macro_volatile = 1;
     if (tok == TOK___LINE__) {
         snprintf(buf, sizeof(buf), "%d", file->line_num);
         cstrval = buf;
@@ -2669,7 +2841,13 @@ static int macro_subst_tok(TokenString *tok_str,
     } else {
         mstr = s->d;
         mstr_allocated = 0;
-        if (s->type.t == MACRO_FUNC) {
+        ts = table_ident[s->v - TOK_IDENT];
+        if (s->type.t == MACRO_OBJ) {
+            if (macro_memo_use(tok_str, ts)) {
+                tcc_state->stats.macro_expansions++;
+                return 0;
+            }
+        } else {
             /* NOTE: we do not use next_nomacro to avoid eating the
                next token. XXX: find better solution */
         redo:
@@ -2677,6 +2855,9 @@ static int macro_subst_tok(TokenString *tok_str,
                 p = macro_ptr;
                 while (is_space(t = *p) || TOK_LINEFEED == t) 
                     ++p;
+                /* the result depends on what follows the macro */
+                if (t == 0)
+                    macro_volatile = 1;
                 if (t == 0 && can_read_stream) {
                     /* end of macro stream: we must look at the token
                        after in the file */
@@ -2689,10 +2870,13 @@ static int macro_subst_tok(TokenString *tok_str,
                         *can_read_stream = ml -> prev;
                     }
                     /* also, end of scope for nested defined symbol */
+                    if ((*nested_list)->v != -1)
+                        table_ident[(*nested_list)->v - TOK_IDENT]->hidden--;
                     (*nested_list)->v = -1;
                     goto redo;
                 }
             } else {
+                macro_volatile = 1;
                 ch = file->buf_ptr[0];
                 while (is_space(ch) || ch == '\n' || ch == '/')
 		  {
@@ -2781,14 +2965,29 @@ static int macro_subst_tok(TokenString *tok_str,
             }
             mstr_allocated = 1;
         }
+        tcc_state->stats.macro_expansions++;
+        len = tok_str->len;
+        vol = macro_volatile;
+        macro_volatile = 0;
+        uses = nb_macro_uses;
+        macro_use(s->v);
+        /* mark the macro as hidden while it is expanded */
+        ts->hidden++;
         sym_push2(nested_list, s->v, 0, 0);
         macro_subst(tok_str, nested_list, mstr, can_read_stream);
         /* pop nested defined symbol */
         sa1 = *nested_list;
         *nested_list = sa1->prev;
+        if (sa1->v != -1)
+            table_ident[sa1->v - TOK_IDENT]->hidden--;
         sym_free(sa1);
         if (mstr_allocated)
             tok_str_free(mstr);
+        /* an object-like macro expands the same way until the defines
+           change, unless it looked outside of its own tokens */
+        if (s->type.t == MACRO_OBJ && !macro_volatile)
+            macro_memo_save(ts, tok_str->str + len, tok_str->len - len, uses);
+        macro_volatile |= vol;
     }
     return 0;
 }
@@ -2875,7 +3074,7 @@ static void macro_subst(TokenString *tok_str, Sym **nested_list,
 {
     Sym *s;
     int *macro_str1;
-    const int *ptr;
+    const int *ptr, *p0, *p1;
     int t, ret, spc;
     CValue cval;
     struct macro_level ml;
@@ -2895,21 +3094,26 @@ static void macro_subst(TokenString *tok_str, Sym **nested_list,
            file stream due to a macro function call */
         if (ptr == NULL)
             break;
+        p0 = ptr;
         TOK_GET(&t, &ptr, &cval);
         if (t == 0)
             break;
         if (t == TOK_NOSUBST) {
             /* following token has already been subst'd. just copy it on */
             tok_str_add2(tok_str, TOK_NOSUBST, NULL);
+            p0 = ptr;
             TOK_GET(&t, &ptr, &cval);
+            p1 = ptr;
             goto no_subst;
         }
+        p1 = ptr;
         s = define_find(t);
         if (s != NULL) {
             /* if nested substitution, do nothing */
-            if (sym_find2(*nested_list, t)) {
+            if (table_ident[t - TOK_IDENT]->hidden) {
                 /* and mark it as TOK_NOSUBST, so it doesn't get subst'd again */
                 tok_str_add2(tok_str, TOK_NOSUBST, NULL);
+                macro_volatile = 1;
                 goto no_subst;
             }
             ml.p = macro_ptr;
@@ -2922,8 +3126,10 @@ static void macro_subst(TokenString *tok_str, Sym **nested_list,
             macro_ptr = ml.p;
             if (can_read_stream && *can_read_stream == &ml)
                 *can_read_stream = ml.prev;
-            if (ret != 0)
+            if (ret != 0) {
+                macro_use(t);
                 goto no_subst;
+            }
             if (parse_flags & PARSE_FLAG_SPACES)
                 force_blank = 1;
         } else {
@@ -2933,8 +3139,9 @@ static void macro_subst(TokenString *tok_str, Sym **nested_list,
                 spc = 1;
                 force_blank = 0;
             }
-            if (!check_space(t, &spc)) 
-                tok_str_add2(tok_str, t, &cval);
+            /* copy the token as it is encoded */
+            if (!check_space(t, &spc))
+                tok_str_add_words(tok_str, p0, p1 - p0);
         }
     }
     if (macro_str1)
@@ -2947,6 +3154,7 @@ ST_FUNC void next(void)
     Sym *nested_list, *s;
     TokenString str;
     struct macro_level *ml;
+    int t;
 
  redo:
     if (parse_flags & PARSE_FLAG_SPACES)
@@ -2964,7 +3172,12 @@ ST_FUNC void next(void)
                 tok_str_new(&str);
                 nested_list = NULL;
                 ml = NULL;
-                if (macro_subst_tok(&str, &nested_list, s, &ml) == 0) {
+                nb_macro_uses = 0;
+                macro_volatile = 0;
+                bench_enter(tcc_state, TCC_PHASE_MACRO);
+                t = macro_subst_tok(&str, &nested_list, s, &ml);
+                bench_leave(tcc_state);
+                if (t == 0) {
                     /* substitution done, NOTE: maybe empty */
                     tok_str_add(&str, 0);
                     macro_ptr = str.str;
@@ -3030,6 +3243,12 @@ ST_INLN void unget_tok(int last_tok)
    correctly too */
 ST_FUNC void preprocess_init(TCCState *s1)
 {
+    int i;
+
+    /* expansions cut short by an error leave their macros hidden */
+    for(i = 0; i < tok_ident - TOK_IDENT; i++)
+        table_ident[i]->hidden = 0;
+
     s1->include_stack_ptr = s1->include_stack;
     /* XXX: move that before to avoid having to initialize
        file->ifdef_stack_ptr ? */
@@ -3041,6 +3260,29 @@ ST_FUNC void preprocess_init(TCCState *s1)
     s1->pack_stack_ptr = s1->pack_stack;
 }
 
+/* -include: read the files as if included by the first line of the
+   file opened in 'file' */
+ST_FUNC void preprocess_cmd_includes(TCCState *s1)
+{
+    CString cstr;
+    int i;
+
+    if (!s1->nb_cmd_include_files)
+        return;
+    cstr_new(&cstr);
+    for (i = 0; i < s1->nb_cmd_include_files; i++) {
+        cstr_cat(&cstr, "#consider \"");
+        cstr_cat(&cstr, s1->cmd_include_files[i]);
+        cstr_cat(&cstr, "\"\n");
+    }
+    *s1->include_stack_ptr++ = file;
+    tcc_open_bf(s1, "<command line>", cstr.size);
+    memcpy(file->buffer, cstr.data, cstr.size);
+    cstr_free(&cstr);
+    if (s1->do_debug)
+        put_stabs(file->filename, N_BINCL, 0, 0, 0);
+}
+
 ST_FUNC void preprocess_new(void)
 {
     int i, c;
@@ -3052,7 +3294,9 @@ ST_FUNC void preprocess_new(void)
 
     /* add all tokens */
     table_ident = NULL;
-    memset(hash_ident, 0, TOK_HASH_SIZE * sizeof(TokenSym *));
+    tcc_free(hash_ident);
+    hash_ident_size = TOK_HASH_SIZE;
+    hash_ident = tcc_mallocz(hash_ident_size * sizeof(TokenSym *));
     
     tok_ident = TOK_IDENT;
     p = tcc_keywords;
@@ -3068,6 +3312,110 @@ ST_FUNC void preprocess_new(void)
     }
 }
 
+/* free what the preprocessor keeps beyond a compilation */
+ST_FUNC void preprocess_delete(void)
+{
+    int i;
+
+    for(i = 0; i < tok_ident - TOK_IDENT; i++) {
+        tcc_free(table_ident[i]->macro_memo);
+        table_ident[i]->macro_memo = NULL;
+    }
+    while (nb_tok_str_pool)
+        tcc_free(tok_str_pool[--nb_tok_str_pool]);
+    tcc_free(macro_uses);
+    macro_uses = NULL;
+    tcc_free(hash_ident);
+    hash_ident = NULL;
+    hash_ident_size = 0;
+    nb_macro_uses = macro_uses_size = 0;
+}
+
+/* -E output: tokens are spelled into a buffer which is written in
+   large blocks */
+#define PP_OUT_SIZE 65536
+static unsigned char pp_out[PP_OUT_SIZE];
+static int pp_out_len;
+
+ST_FUNC void preprocess_flush(TCCState *s1)
+{
+    if (pp_out_len)
+        fwrite(pp_out, 1, pp_out_len, s1->ppfp);
+    pp_out_len = 0;
+}
+
+/* return where to write at least 'n' bytes (n <= PP_OUT_SIZE) */
+static inline unsigned char *pp_room(TCCState *s1, int n)
+{
+    if (pp_out_len + n > PP_OUT_SIZE)
+        preprocess_flush(s1);
+    return pp_out + pp_out_len;
+}
+
+static void pp_write(TCCState *s1, const void *p, int n)
+{
+    if (n > PP_OUT_SIZE / 2) {
+        preprocess_flush(s1);
+        fwrite(p, 1, n, s1->ppfp);
+        return;
+    }
+    memcpy(pp_room(s1, n), p, n);
+    pp_out_len += n;
+}
+
+/* same as add_char() */
+static inline void pp_write_char(TCCState *s1, int c)
+{
+    unsigned char *q;
+
+    q = pp_room(s1, 5);
+    if (c >= 32 && c <= 126) {
+        if (c == '\'' || c == '\"' || c == '\\')
+            *q++ = '\\';
+        *q++ = c;
+    } else {
+        *q++ = '\\';
+        if (c == '\n') {
+            *q++ = 'n';
+        } else {
+            *q++ = '0' + ((c >> 6) & 7);
+            *q++ = '0' + ((c >> 3) & 7);
+            *q++ = '0' + (c & 7);
+        }
+    }
+    pp_out_len = q - pp_out;
+}
+
+/* write the current token as get_tok_str() would spell it */
+static void pp_write_tok(TCCState *s1)
+{
+    TokenSym *ts;
+    CString *cstr;
+    const char *str;
+    int i, len;
+
+    if (tok >= TOK_IDENT && tok < tok_ident) {
+        ts = table_ident[tok - TOK_IDENT];
+        pp_write(s1, ts->str, ts->len);
+    } else if (tok > TOK_SAR && tok < 128) {
+        /* single character tokens, spaces and linefeeds */
+        *pp_room(s1, 1) = tok;
+        pp_out_len++;
+    } else if (tok == TOK_PPNUM || tok == TOK_STR) {
+        cstr = tokc.cstr;
+        len = cstr->size - 1;
+        if (tok == TOK_STR)
+            pp_write(s1, "\"", 1);
+        for(i = 0; i < len; i++)
+            pp_write_char(s1, ((unsigned char *)cstr->data)[i]);
+        if (tok == TOK_STR)
+            pp_write(s1, "\"", 1);
+    } else {
+        str = get_tok_str(tok, &tokc);
+        pp_write(s1, str, strlen(str));
+    }
+}
+
 /* Preprocess the current file */
 ST_FUNC int tcc_preprocess(TCCState *s1)
 {
@@ -3079,6 +3427,8 @@ ST_FUNC int tcc_preprocess(TCCState *s1)
 
     preprocess_init(s1);
     define_start = define_stack;
+    pp_out_len = 0; /* nothing left by a run that failed */
+    preprocess_cmd_includes(s1);
     ch = file->buf_ptr[0];
     tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
     parse_flags = PARSE_FLAG_ASM_COMMENTS | PARSE_FLAG_PREPROCESS |
@@ -3110,18 +3460,22 @@ print_line:
                   : ""
                   ;
                 iptr = iptr_new;
-                fprintf(s1->ppfp, "# %d \"%s\"%s\n", file->line_num, file->filename, s);
-            } else {
-                while (d)
-                    fputs("\n", s1->ppfp), --d;
+                d = sizeof(file->filename) + 32;
+                pp_out_len += snprintf((char *)pp_room(s1, d), d,
+                    "# %d \"%s\"%s\n", file->line_num, file->filename, s);
+            } else if (d) {
+                /* a run of empty lines */
+                memset(pp_room(s1, d), '\n', d);
+                pp_out_len += d;
             }
             line_ref = (file_ref = file)->line_num;
             token_seen = tok != TOK_LINEFEED;
             if (!token_seen)
                 continue;
         }
-        fputs(get_tok_str(tok, &tokc), s1->ppfp);
+        pp_write_tok(s1);
     }
+    preprocess_flush(s1);
     free_defines(define_start);
     return 0;
 }
@@ -26,6 +26,7 @@
 #ifdef CONFIG_TCC_BACKTRACE
 ST_DATA int rt_num_callers = 6;
 ST_DATA const char **rt_bound_error_msg;
+ST_DATA addr_t *rt_bound_error_pc, *rt_bound_error_fp;
 ST_DATA void *rt_prog_main;
 #endif
 
@@ -38,10 +39,15 @@ static void set_exception_handler(void);
 static int rt_get_caller_pc(addr_t *paddr, ucontext_t *uc, int level);
 static void rt_error(ucontext_t *uc, const char *fmt, ...);
 static int tcc_relocate_ex(TCCState *s1, void *ptr);
+static int tcc_relocate_jit(TCCState *s1);
 
 #ifdef _WIN64
 static void win64_add_function_table(TCCState *s1);
 #endif
+#ifdef CONFIG_TCC_JIT_DEBUG
+static void jit_debug_relocated(TCCState *s1);
+static void jit_debug_free(TCCState *s1);
+#endif
 
 /* ------------------------------------------------------------- */
 /* Do all relocations (needed before using tcc_get_symbol())
@@ -51,40 +57,12 @@ LIBTCCAPI int tcc_relocate(TCCState *s1, void *ptr)
 {
     int ret;
 
-    if (TCC_RELOCATE_AUTO != ptr)
-        return tcc_relocate_ex(s1, ptr);
-
-    ret = tcc_relocate_ex(s1, NULL);
-    if (ret < 0)
-        return ret;
-
-#ifdef HAVE_SELINUX
-    {   /* Use mmap instead of malloc for Selinux.  Ref:
-           http://www.gnu.org/s/libc/manual/html_node/File-Size.html */
-
-        char tmpfname[] = "/tmp/.tccrunXXXXXX";
-        int fd = mkstemp (tmpfname);
-
-        s1->mem_size = ret;
-        unlink (tmpfname);
-        ftruncate (fd, s1->mem_size);
-
-        s1->write_mem = mmap (NULL, ret, PROT_READ|PROT_WRITE,
-            MAP_SHARED, fd, 0);
-        if (s1->write_mem == MAP_FAILED)
-            tcc_error("/tmp not writeable");
-
-        s1->runtime_mem = mmap (NULL, ret, PROT_READ|PROT_EXEC,
-            MAP_SHARED, fd, 0);
-        if (s1->runtime_mem == MAP_FAILED)
-            tcc_error("/tmp not executable");
-
-        ret = tcc_relocate_ex(s1, s1->write_mem);
-    }
-#else
-    s1->runtime_mem = tcc_malloc(ret);
-    ret = tcc_relocate_ex(s1, s1->runtime_mem);
-#endif
+    bench_enter(s1, TCC_PHASE_OUTPUT);
+    if (TCC_RELOCATE_AUTO == ptr)
+        ret = tcc_relocate_jit(s1);
+    else
+        ret = tcc_relocate_ex(s1, ptr);
+    bench_leave(s1);
     return ret;
 }
 
@@ -94,7 +72,9 @@ LIBTCCAPI int tcc_run(TCCState *s1, int argc, char **argv)
     int (*prog_main)(int, char **);
     int ret;
 
-    if (tcc_relocate(s1, TCC_RELOCATE_AUTO) < 0)
+    /* may already have been relocated by the caller (tcc -bench -run) */
+    if (s1->nb_sections > 1 + s1->nb_relocated_sections
+        && tcc_relocate(s1, TCC_RELOCATE_AUTO) < 0)
         return -1;
 
     prog_main = tcc_get_symbol_err(s1, s1->runtime_main);
@@ -112,6 +92,8 @@ LIBTCCAPI int tcc_run(TCCState *s1, int argc, char **argv)
         void (*bound_exit)(void);
         /* set error function */
         rt_bound_error_msg = tcc_get_symbol_err(s1, "__bound_error_msg");
+        rt_bound_error_pc = tcc_get_symbol_err(s1, "__bound_error_pc");
+        rt_bound_error_fp = tcc_get_symbol_err(s1, "__bound_error_fp");
         /* XXX: use .init section so that it also work in binary ? */
         bound_init = tcc_get_symbol_err(s1, "__bound_init");
         bound_exit = tcc_get_symbol_err(s1, "__bound_exit");
@@ -124,90 +106,539 @@ LIBTCCAPI int tcc_run(TCCState *s1, int argc, char **argv)
     return ret;
 }
 
-/* relocate code. Return -1 on error, required size if ptr is NULL,
-   otherwise copy code into buffer passed by the caller */
-static int tcc_relocate_ex(TCCState *s1, void *ptr)
+/* link the runtime in and build the GOT, before layout_sections() */
+static int prepare_relocate(TCCState *s1)
 {
-    Section *s;
-    unsigned long offset, length;
-    addr_t mem;
-    int i;
-
-    if (NULL == ptr) {
-        s1->nb_errors = 0;
+    s1->nb_errors = 0;
+    if (s1->nb_relocated_sections) {
+#ifdef TCC_TARGET_PE
+        tcc_error_noabort("cannot relocate the state twice");
+        return -1;
+#elif defined CONFIG_TCC_BCHECK
+        if (s1->do_bounds_check) {
+            tcc_error_noabort("-b: cannot add code to a relocated state");
+            return -1;
+        }
+#endif
+    }
 #ifdef TCC_TARGET_PE
-        pe_output_file(s1, NULL);
+    pe_output_file(s1, NULL);
 #else
-        tcc_add_runtime(s1);
-        relocate_common_syms();
+    tcc_add_runtime(s1);
+    relocate_common_syms();
+    if (0 == s1->nb_relocated_sections)
         tcc_add_linker_symbols(s1);
-        build_got_entries(s1);
+    build_got_entries(s1);
 #endif
-        if (s1->nb_errors)
-            return -1;
+    return s1->nb_errors ? -1 : 0;
+}
+
+/* all sections are in memory: the symbols get their final addresses
+   and the sections are left alone by the next tcc_relocate(), if
+   more code is added.  Their copies and relocations are freed. */
+static void freeze_sections(TCCState *s1)
+{
+    ElfW(Sym) *sym, *sym_end;
+    Section *s;
+    int i;
+
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for (sym = (ElfW(Sym) *)symtab_section->data + 1; sym < sym_end; sym++) {
+        if (sym->st_shndx == SHN_UNDEF ? sym->st_value != 0
+                                       : sym->st_shndx < SHN_LORESERVE)
+            sym->st_shndx = SHN_ABS;
     }
+    for (i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if ((s->sh_flags & SHF_ALLOC) || s->sh_type == SHT_RELX)
+            free_section(s);
+    }
+    s1->nb_relocated_sections = s1->nb_sections - 1;
+}
 
-    offset = 0, mem = (addr_t)ptr;
-    for(i = 1; i < s1->nb_sections; i++) {
+/* assign addresses to the sections: the executable ones and the
+   runtime PLT/GOT from 'code', the others from 'data'. Set the sizes
+   needed for both in size[0] and size[1]. */
+static void layout_sections(TCCState *s1, addr_t code, addr_t data,
+                            unsigned long *size)
+{
+    Section *s;
+    unsigned long offset[2];
+    addr_t base;
+    int i, k;
+
+    offset[0] = offset[1] = 0;
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
         s = s1->sections[i];
         if (0 == (s->sh_flags & SHF_ALLOC))
             continue;
-        length = s->data_offset;
-        s->sh_addr = mem ? (mem + offset + 15) & ~15 : 0;
-        offset = (offset + length + 15) & ~15;
+        k = !(s->sh_flags & SHF_EXECINSTR);
+        base = k ? data : code;
+        offset[k] = (offset[k] + 15) & ~15;
+        s->sh_addr = base ? base + offset[k] : 0;
+        offset[k] += s->data_offset;
     }
-    offset += 16;
-
-    /* relocate symbols */
-    relocate_syms(s1, 1);
-    if (s1->nb_errors)
-        return -1;
+    offset[0] = (offset[0] + 15) & ~15;
 
 #ifdef TCC_HAS_RUNTIME_PLTGOT
+    /* runtime_plt_and_got_size() was computed */
     s1->runtime_plt_and_got_offset = 0;
-    s1->runtime_plt_and_got = (char *)(mem + offset);
-    /* double the size of the buffer for got and plt entries
-       XXX: calculate exact size for them? */
-    offset *= 2;
+    s1->runtime_plt_and_got = (char *)(code + offset[0]);
+    offset[0] += s1->runtime_plt_and_got_size;
 #endif
+    size[0] = offset[0];
+    size[1] = offset[1];
+}
 
-    if (0 == mem)
-        return offset;
+/* relocate the sections and copy them to their address. Code is
+   written 'wdelta' bytes from there (a writable view of it). */
+static void copy_sections(TCCState *s1, addr_t wdelta)
+{
+    Section *s;
+    unsigned long length;
+    void *ptr;
+    int i;
 
-    /* relocate each section */
-    for(i = 1; i < s1->nb_sections; i++) {
-        s = s1->sections[i];
-        if (s->reloc)
-            relocate_section(s1, s);
-    }
+    s1->runtime_wdelta = wdelta;
+#ifdef TCC_HAS_RUNTIME_PLTGOT
+    s1->runtime_pltgot_slots = tcc_mallocz(2 * sizeof(unsigned)
+        * (symtab_section->data_offset / sizeof(ElfW(Sym))));
+#endif
+    relocate_sections(s1, 1 + s1->nb_relocated_sections, NULL);
+#ifdef TCC_HAS_RUNTIME_PLTGOT
+    tcc_free(s1->runtime_pltgot_slots);
+    s1->runtime_pltgot_slots = NULL;
+#endif
 
-    for(i = 1; i < s1->nb_sections; i++) {
+    for(i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
         s = s1->sections[i];
         if (0 == (s->sh_flags & SHF_ALLOC))
             continue;
         length = s->data_offset;
         // printf("%-12s %08x %04x\n", s->name, s->sh_addr, length);
         ptr = (void*)s->sh_addr;
+        if (s->sh_flags & SHF_EXECINSTR)
+            ptr = (char *)ptr + wdelta;
         if (NULL == s->data || s->sh_type == SHT_NOBITS)
             memset(ptr, 0, length);
         else
             memcpy(ptr, s->data, length);
-        /* mark executable sections as executable in memory */
-        if (s->sh_flags & SHF_EXECINSTR)
-            set_pages_executable(ptr, length);
     }
+}
 
+/* relocate code. Return -1 on error, required size if ptr is NULL,
+   otherwise copy code into buffer passed by the caller */
+static int tcc_relocate_ex(TCCState *s1, void *ptr)
+{
+    unsigned long size[2];
+    addr_t mem;
+
+    if (NULL == ptr && prepare_relocate(s1) < 0)
+        return -1;
 #ifdef TCC_HAS_RUNTIME_PLTGOT
-    set_pages_executable(s1->runtime_plt_and_got,
-                         s1->runtime_plt_and_got_offset);
+    s1->runtime_plt_and_got_size = runtime_plt_and_got_size(s1, NULL);
 #endif
 
+    /* code, then data */
+    mem = ptr ? ((addr_t)ptr + 15) & ~15 : 0;
+    layout_sections(s1, mem, 0, size);
+    layout_sections(s1, mem, mem ? mem + size[0] : 0, size);
+
+    /* relocate symbols */
+    relocate_syms(s1, 1);
+    if (s1->nb_errors)
+        return -1;
+
+    if (0 == mem)
+        return size[0] + size[1] + 16;
+
+    copy_sections(s1, 0);
+    /* mark executable sections as executable in memory */
+    set_pages_executable((void *)mem, size[0]);
+
 #ifdef _WIN64
     win64_add_function_table(s1);
 #endif
+#ifdef CONFIG_TCC_JIT_DEBUG
+    jit_debug_relocated(s1);
+#endif
+    freeze_sections(s1);
     return 0;
 }
 
+/* ------------------------------------------------------------- */
+/* memory for tcc_relocate(TCC_RELOCATE_AUTO)
+
+   The code and data of all states are packed into large mappings,
+   one page aligned block per state: code pages first, then data
+   pages.  Code is never writable and executable at the same time:
+   with CONFIG_TCC_JIT_DUALMAP each mapping is a shared file mapped
+   twice, writable and executable, next to each other, and the code is
+   written through the writable view.  Otherwise the code pages are
+   made read-only once relocated.
+
+   On x86-64, mappings are placed near the shared libraries when
+   possible so that calls to them need no jump table entry. */
+
+#ifndef PAGESIZE
+# define PAGESIZE 4096
+#endif
+#define JIT_CHUNK_SIZE (4UL << 20)
+#define JIT_REACH (1UL << 30) /* well within 32-bit displacements */
+
+#ifndef _WIN32
+#ifdef HAVE_SELINUX
+# define CONFIG_TCC_JIT_DUALMAP
+# include <sys/syscall.h>
+#endif
+
+typedef struct JitChunk {
+    struct JitChunk *next;
+    addr_t mem; /* executable view */
+    addr_t wdelta; /* writable view - executable view */
+    unsigned long size, used;
+} JitChunk;
+
+/* a free range of a chunk */
+typedef struct JitFree {
+    struct JitFree *next;
+    JitChunk *chunk;
+    addr_t mem;
+    unsigned long size;
+} JitFree;
+
+static JitChunk *jit_chunks;
+static JitFree *jit_free_list; /* sorted by address */
+static int jit_far; /* mmap() did not take the hint, do not insist */
+
+/* the arena is shared by the states of all threads.  Nothing which
+   can call tcc_error() is done with the lock held. */
+#ifdef CONFIG_TCCBOOT
+#define jit_lock()
+#define jit_unlock()
+#else
+#include <pthread.h>
+static pthread_mutex_t jit_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define jit_lock() pthread_mutex_lock(&jit_mutex)
+#define jit_unlock() pthread_mutex_unlock(&jit_mutex)
+#endif
+
+#ifdef CONFIG_TCC_JIT_DUALMAP
+static int jit_open_file(unsigned long size)
+{
+    char tmpfname[] = "/tmp/.tccrunXXXXXX";
+    int fd;
+
+#if defined __linux__ && defined SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "tccrun", 0);
+    if (fd < 0)
+#endif
+    {
+        /* Use mmap instead of malloc for Selinux.  Ref:
+           http://www.gnu.org/s/libc/manual/html_node/File-Size.html */
+        fd = mkstemp(tmpfname);
+        if (fd < 0)
+            return -1;
+        unlink(tmpfname);
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+/* is chunk 'c' within reach of the calls to 'near' */
+static int jit_reach(JitChunk *c, addr_t near)
+{
+#ifdef TCC_TARGET_X86_64
+    if (near && !jit_far)
+        return c->mem < near ? near - c->mem < JIT_REACH
+                             : c->mem + c->size - near < JIT_REACH;
+#endif
+    return 1;
+}
+
+/* map a new chunk, described by 'c' */
+static JitChunk *jit_new_chunk(JitChunk *c, unsigned long size, addr_t near,
+                               int hugepages)
+{
+    void *p, *hint;
+#ifdef CONFIG_TCC_JIT_DUALMAP
+    void *w;
+    int fd;
+#endif
+
+    /* below the libraries, taken by mmap() if free */
+    hint = NULL;
+#ifdef TCC_TARGET_X86_64
+    if (near > JIT_REACH)
+        hint = (void *)((near - JIT_REACH / 2) & ~(JIT_CHUNK_SIZE - 1));
+#endif
+#ifdef CONFIG_TCC_JIT_DUALMAP
+    /* reserve room for both views so that 32-bit pc-relative references
+       from the code to the data are always in range */
+    fd = jit_open_file(size);
+    if (fd < 0)
+        return NULL;
+    w = mmap(hint, 2 * size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (w == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    p = (char *)w + size;
+    if (mmap(w, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0)
+            == MAP_FAILED
+        || mmap(p, size, PROT_READ|PROT_EXEC, MAP_SHARED|MAP_FIXED, fd, 0)
+            == MAP_FAILED) {
+        munmap(w, 2 * size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+#else
+    p = mmap(hint, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+#endif
+#ifdef MADV_HUGEPAGE
+    /* less iTLB misses. Without CONFIG_TCC_JIT_DUALMAP, mprotect()
+       splits the huge pages again. */
+    if (hugepages)
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    c->mem = (addr_t)p;
+    c->size = size;
+#ifdef CONFIG_TCC_JIT_DUALMAP
+    c->wdelta = (addr_t)w - (addr_t)p;
+#endif
+    c->next = jit_chunks;
+    jit_chunks = c;
+    return c;
+}
+
+/* '*spare' is used if a new range is needed */
+static void jit_free_range(JitChunk *c, addr_t mem, unsigned long size,
+                           JitFree **spare)
+{
+    JitFree **pf, *f, *n;
+
+    for (pf = &jit_free_list; (f = *pf) != NULL; pf = &f->next)
+        if (f->mem > mem)
+            break;
+    /* merge with the following and the preceding range */
+    if (f && f->chunk == c && mem + size == f->mem) {
+        f->mem = mem;
+        f->size += size;
+    } else {
+        f = *spare;
+        *spare = NULL;
+        f->chunk = c;
+        f->mem = mem;
+        f->size = size;
+        f->next = *pf;
+        *pf = f;
+    }
+    for (pf = &jit_free_list; (n = *pf) != f; pf = &n->next)
+        if (n->next == f && n->chunk == c && n->mem + n->size == f->mem) {
+            n->size += f->size;
+            n->next = f->next;
+            tcc_free(f);
+            break;
+        }
+}
+
+/* allocate 'size' bytes, page aligned, preferably within reach of
+   'near'. Return the executable view, the writable one is at
+   '*wdelta' from it. */
+static addr_t jit_alloc(unsigned long size, addr_t near, int hugepages,
+                        addr_t *wdelta)
+{
+    JitFree **pf, *f, *spare;
+    JitChunk *c, *nc;
+    addr_t mem;
+
+    size = (size + PAGESIZE - 1) & ~(PAGESIZE - 1);
+    /* in case a chunk is added, freed below when not used */
+    nc = tcc_mallocz(sizeof *nc);
+    spare = tcc_malloc(sizeof *spare);
+    jit_lock();
+    for (pf = &jit_free_list; (f = *pf) != NULL; pf = &f->next)
+        if (f->size >= size && jit_reach(f->chunk, near))
+            break;
+    if (!f) {
+        c = jit_new_chunk(nc, size > JIT_CHUNK_SIZE ? size : JIT_CHUNK_SIZE,
+                          near, hugepages);
+        if (!c) {
+            mem = 0;
+            goto done;
+        }
+        nc = NULL;
+        jit_far = !jit_reach(c, near);
+        jit_free_range(c, c->mem, c->size, &spare);
+        for (pf = &jit_free_list; (f = *pf)->chunk != c; pf = &f->next)
+            ;
+    }
+    c = f->chunk;
+    mem = f->mem;
+    f->mem += size;
+    f->size -= size;
+    if (0 == f->size) {
+        *pf = f->next;
+        tcc_free(f);
+    }
+    c->used += size;
+    *wdelta = c->wdelta;
+#ifndef CONFIG_TCC_JIT_DUALMAP
+    /* might have been code before */
+    mprotect((void *)mem, size, PROT_READ | PROT_WRITE);
+#endif
+done:
+    jit_unlock();
+    tcc_free(nc);
+    tcc_free(spare);
+    return mem;
+}
+
+static void jit_free(addr_t mem, unsigned long size)
+{
+    JitChunk **pc, *c;
+    JitFree **pf, *f, *spare;
+
+    size = (size + PAGESIZE - 1) & ~(PAGESIZE - 1);
+    spare = tcc_malloc(sizeof *spare);
+    jit_lock();
+    for (pc = &jit_chunks; (c = *pc) != NULL; pc = &c->next)
+        if (mem >= c->mem && mem < c->mem + c->size)
+            break;
+    if (!c)
+        goto done;
+    c->used -= size;
+    if (c->used) {
+        jit_free_range(c, mem, size, &spare);
+        goto done;
+    }
+    /* last block of the chunk: give it back to the system */
+    for (pf = &jit_free_list; (f = *pf) != NULL; )
+        if (f->chunk == c)
+            *pf = f->next, tcc_free(f);
+        else
+            pf = &f->next;
+#ifdef CONFIG_TCC_JIT_DUALMAP
+    munmap((void *)(c->mem + c->wdelta), 2 * c->size);
+#else
+    munmap((void *)c->mem, c->size);
+#endif
+    *pc = c->next;
+    tcc_free(c);
+done:
+    jit_unlock();
+    tcc_free(spare);
+}
+
+/* code is complete: make it executable */
+static void jit_protect(addr_t mem, unsigned long size)
+{
+#ifndef CONFIG_TCC_JIT_DUALMAP
+    mprotect((void *)mem, (size + PAGESIZE - 1) & ~(PAGESIZE - 1),
+             PROT_READ | PROT_EXEC);
+#endif
+    __clear_cache((void *)mem, (void *)(mem + size));
+}
+
+#else /* _WIN32 */
+
+static addr_t jit_alloc(unsigned long size, addr_t near, int hugepages,
+                        addr_t *wdelta)
+{
+    *wdelta = 0;
+    return (addr_t)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
+                                PAGE_READWRITE);
+}
+
+static void jit_free(addr_t mem, unsigned long size)
+{
+    VirtualFree((void *)mem, 0, MEM_RELEASE);
+}
+
+static void jit_protect(addr_t mem, unsigned long size)
+{
+    unsigned long old_protect;
+    VirtualProtect((void *)mem, size, PAGE_EXECUTE_READ, &old_protect);
+    FlushInstructionCache(GetCurrentProcess(), (void *)mem, size);
+}
+#endif /* _WIN32 */
+
+/* relocate into a block of the JIT memory */
+static int tcc_relocate_jit(TCCState *s1)
+{
+    unsigned long size[2], code_size;
+    addr_t mem, wdelta, near;
+
+    if (prepare_relocate(s1) < 0)
+        return -1;
+    near = 0;
+#ifdef TCC_HAS_RUNTIME_PLTGOT
+    s1->runtime_plt_and_got_size = 0;
+#endif
+    layout_sections(s1, 0, 0, size);
+    relocate_syms(s1, 1);
+    if (s1->nb_errors)
+        return -1;
+#ifdef TCC_HAS_RUNTIME_PLTGOT
+    /* now that the shared library symbols are resolved */
+    s1->runtime_plt_and_got_size = runtime_plt_and_got_size(s1, &near);
+    layout_sections(s1, 0, 0, size);
+#endif
+
+    code_size = (size[0] + PAGESIZE - 1) & ~(PAGESIZE - 1);
+    if (0 == code_size + size[1]) {
+        /* nothing new to place (only declarations were added) */
+        freeze_sections(s1);
+        return 0;
+    }
+    if (0 == near && s1->nb_runtime_mem)
+        near = s1->runtime_mem[0]; /* close to the code of before */
+    mem = jit_alloc(code_size + size[1], near, s1->jit_hugepages, &wdelta);
+    if (!mem) {
+        tcc_error_noabort("cannot allocate memory for the code");
+        return -1;
+    }
+    s1->runtime_mem = tcc_realloc(s1->runtime_mem,
+                                  (s1->nb_runtime_mem + 2) * sizeof(addr_t));
+    s1->runtime_mem[s1->nb_runtime_mem++] = mem;
+    s1->runtime_mem[s1->nb_runtime_mem++] = code_size + size[1];
+
+    /* the data is accessed through the writable view */
+    layout_sections(s1, mem, mem + code_size + wdelta, size);
+    relocate_syms(s1, 1);
+    copy_sections(s1, wdelta);
+    jit_protect(mem, size[0]);
+
+#ifdef _WIN64
+    win64_add_function_table(s1);
+#endif
+#ifdef CONFIG_TCC_JIT_DEBUG
+    jit_debug_relocated(s1);
+#endif
+    freeze_sections(s1);
+    return 0;
+}
+
+/* release the memory of tcc_relocate(TCC_RELOCATE_AUTO) */
+ST_FUNC void tcc_run_free(TCCState *s1)
+{
+    int i;
+#ifdef CONFIG_TCC_JIT_DEBUG
+    jit_debug_free(s1);
+#endif
+    for (i = 0; i < s1->nb_runtime_mem; i += 2)
+        jit_free(s1->runtime_mem[i], s1->runtime_mem[i + 1]);
+    tcc_free(s1->runtime_mem);
+}
+
 /* ------------------------------------------------------------- */
 /* allow to run code in memory */
 
@@ -217,9 +648,6 @@ static void set_pages_executable(void *ptr, unsigned long length)
     unsigned long old_protect;
     VirtualProtect(ptr, length, PAGE_EXECUTE_READWRITE, &old_protect);
 #else
-#ifndef PAGESIZE
-# define PAGESIZE 4096
-#endif
     addr_t start, end;
     start = (addr_t)ptr & ~(PAGESIZE - 1);
     end = (addr_t)ptr + length;
@@ -229,6 +657,529 @@ static void set_pages_executable(void *ptr, unsigned long length)
 #endif
 }
 
+/* ------------------------------------------------------------- */
+#ifdef CONFIG_TCC_JIT_DEBUG
+/* make the relocated code known to debuggers and profilers
+
+   After each relocation a small ELF image is built that describes the
+   new sections (as SHT_NOBITS at their run time address) with their
+   symbols and line numbers, and is registered through the gdb JIT
+   interface, so that a debugger attached later finds it.  The line
+   numbers are the DWARF sections with -gdwarf, else the new .stab
+   entries if the code is below 4GB.  With -fjit-dump, the functions
+   and their line numbers are also appended to a perf jitdump file
+   (jit-<pid>.dump in $JITDUMPDIR or the current directory, see "perf
+   inject --jit"). */
+
+/* the gdb JIT interface: gdb sets a breakpoint in
+   __jit_debug_register_code() and reads the descriptor.  Both are
+   weak so that only one is used when the host defines them too (other
+   JIT compilers, or several copies of libtcc). The entry list is
+   protected by the lock of the arena. */
+typedef enum {
+    JIT_NOACTION = 0,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN
+} jit_actions_t;
+
+struct jit_code_entry {
+    struct jit_code_entry *next_entry;
+    struct jit_code_entry *prev_entry;
+    const char *symfile_addr;
+    unsigned long long symfile_size;
+};
+
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry *relevant_entry;
+    struct jit_code_entry *first_entry;
+};
+
+void __attribute__((weak, noinline)) __jit_debug_register_code(void)
+{
+    __asm__ __volatile__("");
+}
+
+struct jit_descriptor __attribute__((weak))
+    __jit_debug_descriptor = { 1, JIT_NOACTION, 0, 0 };
+
+static void jit_debug_notify(struct jit_code_entry *e, int action)
+{
+    __jit_debug_descriptor.relevant_entry = e;
+    __jit_debug_descriptor.action_flag = action;
+    __jit_debug_register_code();
+}
+
+/* stab values are 32 bits: the full address of a function of the new
+   code from the value of its N_FUN */
+static addr_t jit_debug_stab_addr(addr_t v)
+{
+#if PTR_SIZE == 8
+    addr_t base = text_section->sh_addr;
+    v |= base & ~(addr_t)0xffffffff;
+    if (v < base)
+        v += (addr_t)1 << 32;
+#endif
+    return v;
+}
+
+/* index of the section of the image for symbol 'sym', 0 if the
+   symbol is not described */
+static int jit_debug_shndx(TCCState *s1, ElfW(Sym) *sym, int *shmap)
+{
+    int type = ELFW(ST_TYPE)(sym->st_info);
+
+    if (sym->st_shndx <= s1->nb_relocated_sections
+        || sym->st_shndx >= s1->nb_sections
+        || sym->st_name == 0
+        || (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE))
+        return 0;
+    return shmap[sym->st_shndx];
+}
+
+/* -gdwarf: the .debug_* sections go in the image with their data, the
+   addresses in them were relocated to 64 bits */
+static int jit_debug_dwarf(Section *s)
+{
+    return !(s->sh_flags & SHF_ALLOC) && s->sh_type == SHT_PROGBITS
+        && s->data_offset && !strncmp(s->name, ".debug_", 7);
+}
+
+/* build the image for the sections placed by this relocation */
+static void jit_debug_add(TCCState *s1)
+{
+    static const char names[] =
+        "\0.symtab\0.strtab\0.stab\0.stabstr\0.shstrtab";
+    ElfW(Ehdr) *ehdr;
+    ElfW(Shdr) *shdr;
+    ElfW(Sym) *sym, *sym_end, *isym;
+    Stab_Sym *stab;
+    struct jit_code_entry *e;
+    Section *s;
+    int *shmap, shnum, ncode, nsyms, nlocals, i, k, bind, with_stab;
+    unsigned long size, symoff, stroff, stabsize, staboff, stabstroff;
+    unsigned long dwarfoff, dwarfsize, shstroff, shstrsize, shoff, o;
+    char *image, *str;
+
+    shmap = tcc_mallocz(s1->nb_sections * sizeof *shmap);
+    shnum = 1, ncode = 0;
+    shstrsize = sizeof names;
+    dwarfsize = 0;
+    for (i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (s->sh_flags & SHF_ALLOC)
+            ncode++;
+        else if (jit_debug_dwarf(s))
+            dwarfsize += (s->data_offset + 15) & ~15;
+        else
+            continue;
+        shmap[i] = shnum++;
+        shstrsize += strlen(s->name) + 1;
+    }
+    if (ncode == 0) {
+        tcc_free(shmap);
+        return;
+    }
+
+    /* what goes in: symbols, then the new stabs (header included) */
+    nsyms = 1, size = 1;
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for (sym = (ElfW(Sym) *)symtab_section->data + 1; sym < sym_end; sym++) {
+        if (jit_debug_shndx(s1, sym, shmap)) {
+            nsyms++;
+            size += strlen(strtab_section->data + sym->st_name) + 1;
+        }
+    }
+    /* the stabs are useful to the debugger only if they can hold the
+       addresses, and not needed with the DWARF line table */
+    stabsize = 0;
+    with_stab = stab_section && dwarfsize == 0
+        && stab_section->data_offset > s1->jit_debug_stab + sizeof(Stab_Sym)
+        && jit_debug_stab_addr(0) == 0;
+    if (with_stab) {
+        if (0 == s1->jit_debug_stab)
+            s1->jit_debug_stab = sizeof(Stab_Sym);
+        stabsize = sizeof(Stab_Sym)
+            + stab_section->data_offset - s1->jit_debug_stab;
+    }
+
+    symoff = (sizeof(ElfW(Ehdr)) + 15) & ~15;
+    stroff = symoff + nsyms * sizeof(ElfW(Sym));
+    staboff = (stroff + size + 15) & ~15;
+    stabstroff = staboff + stabsize;
+    dwarfoff = (stabstroff + (with_stab ? stabstr_section->data_offset : 0)
+                + 15) & ~15;
+    shstroff = dwarfoff + dwarfsize;
+    shoff = (shstroff + shstrsize + 15) & ~15;
+    shnum += 3 + 2 * with_stab;
+
+    image = tcc_mallocz(shoff + shnum * sizeof(ElfW(Shdr)));
+    ehdr = (ElfW(Ehdr) *)image;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASSW;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_type = ET_EXEC;
+    ehdr->e_machine = EM_TCC_TARGET;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_shoff = shoff;
+    ehdr->e_ehsize = sizeof(ElfW(Ehdr));
+    ehdr->e_shentsize = sizeof(ElfW(Shdr));
+    ehdr->e_shnum = shnum;
+    ehdr->e_shstrndx = shnum - 1;
+
+    /* section names: the fixed ones, then those of the code and data
+       and of the DWARF sections, whose data is copied */
+    str = image + shstroff;
+    memcpy(str, names, sizeof names);
+    o = sizeof names;
+    shdr = (ElfW(Shdr) *)(image + shoff);
+    for (i = 1 + s1->nb_relocated_sections; i < s1->nb_sections; i++) {
+        if (shmap[i]) {
+            s = s1->sections[i];
+            k = shmap[i];
+            shdr[k].sh_name = o;
+            o += strlen(strcpy(str + o, s->name)) + 1;
+            shdr[k].sh_flags = s->sh_flags;
+            shdr[k].sh_size = s->data_offset;
+            if (s->sh_flags & SHF_ALLOC) {
+                shdr[k].sh_type = SHT_NOBITS;
+                shdr[k].sh_addr = s->sh_addr;
+                shdr[k].sh_addralign = s->sh_addralign;
+            } else {
+                shdr[k].sh_type = SHT_PROGBITS;
+                shdr[k].sh_offset = dwarfoff;
+                shdr[k].sh_addralign = 1;
+                memcpy(image + dwarfoff, s->data, s->data_offset);
+                dwarfoff += (s->data_offset + 15) & ~15;
+            }
+        }
+    }
+
+    /* symbols, locals first */
+    isym = (ElfW(Sym) *)(image + symoff) + 1;
+    str = image + stroff + 1;
+    nlocals = 1;
+    for (bind = 0; bind < 2; bind++) {
+        sym = (ElfW(Sym) *)symtab_section->data + 1;
+        for (; sym < sym_end; sym++) {
+            k = jit_debug_shndx(s1, sym, shmap);
+            if (!k || (ELFW(ST_BIND)(sym->st_info) != STB_LOCAL) != bind)
+                continue;
+            *isym = *sym;
+            isym->st_shndx = k;
+            isym->st_name = str - (image + stroff);
+            str += strlen(strcpy(str, strtab_section->data + sym->st_name)) + 1;
+            isym++;
+            nlocals += !bind;
+        }
+    }
+
+    k = shnum - 3 - 2 * with_stab;
+    shdr[k].sh_name = 1; /* .symtab */
+    shdr[k].sh_type = SHT_SYMTAB;
+    shdr[k].sh_offset = symoff;
+    shdr[k].sh_size = nsyms * sizeof(ElfW(Sym));
+    shdr[k].sh_link = k + 1;
+    shdr[k].sh_info = nlocals;
+    shdr[k].sh_addralign = PTR_SIZE;
+    shdr[k].sh_entsize = sizeof(ElfW(Sym));
+    k++;
+    shdr[k].sh_name = 9; /* .strtab */
+    shdr[k].sh_type = SHT_STRTAB;
+    shdr[k].sh_offset = stroff;
+    shdr[k].sh_size = size;
+    shdr[k].sh_addralign = 1;
+    k++;
+    if (with_stab) {
+        /* an empty header entry, then the entries of the new code */
+        stab = (Stab_Sym *)(image + staboff);
+        memcpy(stab + 1, stab_section->data + s1->jit_debug_stab,
+               stabsize - sizeof(Stab_Sym));
+        memcpy(image + stabstroff, stabstr_section->data,
+               stabstr_section->data_offset);
+        shdr[k].sh_name = 17; /* .stab */
+        shdr[k].sh_type = SHT_PROGBITS;
+        shdr[k].sh_offset = staboff;
+        shdr[k].sh_size = stabsize;
+        shdr[k].sh_link = k + 1;
+        shdr[k].sh_addralign = 4;
+        shdr[k].sh_entsize = sizeof(Stab_Sym);
+        k++;
+        shdr[k].sh_name = 23; /* .stabstr */
+        shdr[k].sh_type = SHT_STRTAB;
+        shdr[k].sh_offset = stabstroff;
+        shdr[k].sh_size = stabstr_section->data_offset;
+        shdr[k].sh_addralign = 1;
+        k++;
+    }
+    shdr[k].sh_name = 32; /* .shstrtab */
+    shdr[k].sh_type = SHT_STRTAB;
+    shdr[k].sh_offset = shstroff;
+    shdr[k].sh_size = o;
+    shdr[k].sh_addralign = 1;
+    tcc_free(shmap);
+    if (stab_section)
+        s1->jit_debug_stab = stab_section->data_offset;
+
+    /* link it in front of the list and tell the debugger */
+    e = tcc_mallocz(sizeof *e);
+    e->symfile_addr = image;
+    e->symfile_size = shoff + shnum * sizeof(ElfW(Shdr));
+    jit_lock();
+    e->next_entry = __jit_debug_descriptor.first_entry;
+    if (e->next_entry)
+        e->next_entry->prev_entry = e;
+    __jit_debug_descriptor.first_entry = e;
+    jit_debug_notify(e, JIT_REGISTER_FN);
+    jit_unlock();
+    dynarray_add(&s1->jit_debug_entries, &s1->nb_jit_debug_entries, e);
+}
+
+/* unregister the images of the state */
+static void jit_debug_free(TCCState *s1)
+{
+    struct jit_code_entry *e;
+    int i;
+
+    jit_lock();
+    for (i = 0; i < s1->nb_jit_debug_entries; i++) {
+        e = s1->jit_debug_entries[i];
+        if (e->prev_entry)
+            e->prev_entry->next_entry = e->next_entry;
+        else
+            __jit_debug_descriptor.first_entry = e->next_entry;
+        if (e->next_entry)
+            e->next_entry->prev_entry = e->prev_entry;
+        jit_debug_notify(e, JIT_UNREGISTER_FN);
+    }
+    jit_unlock();
+    for (i = 0; i < s1->nb_jit_debug_entries; i++) {
+        e = s1->jit_debug_entries[i];
+        tcc_free((void *)e->symfile_addr);
+    }
+    dynarray_reset(&s1->jit_debug_entries, &s1->nb_jit_debug_entries);
+}
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+/* perf jitdump format, see tools/perf/Documentation/jitdump-specification.txt
+   in the linux sources */
+#define JITDUMP_MAGIC 0x4A695444
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_DEBUG_INFO 2
+
+struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    unsigned long long timestamp;
+    unsigned long long flags;
+};
+
+struct jitdump_record {
+    uint32_t id;
+    uint32_t total_size;
+    unsigned long long timestamp;
+};
+
+struct jitdump_load {
+    struct jitdump_record rec;
+    uint32_t pid;
+    uint32_t tid;
+    unsigned long long vma;
+    unsigned long long code_addr;
+    unsigned long long code_size;
+    unsigned long long code_index;
+};
+
+struct jitdump_debug {
+    struct jitdump_record rec;
+    unsigned long long code_addr;
+    unsigned long long nr_entry;
+};
+
+struct jitdump_line {
+    unsigned long long addr;
+    uint32_t line;
+    uint32_t discrim;
+};
+
+static FILE *jit_dump_file;
+static unsigned long long jit_dump_index;
+
+static unsigned long long jit_dump_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* open jit-<pid>.dump and map it executable: perf record notes the
+   mapping, perf inject --jit finds the file through it */
+static FILE *jit_dump_open(void)
+{
+    struct jitdump_header hdr;
+    char buf[1024];
+    const char *dir;
+    int fd;
+
+    if (jit_dump_file)
+        return jit_dump_file;
+    dir = getenv("JITDUMPDIR");
+    snprintf(buf, sizeof buf, "%s/jit-%d.dump", dir ? dir : ".", (int)getpid());
+    fd = open(buf, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        return NULL;
+    if (mmap(NULL, PAGESIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0)
+        == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    jit_dump_file = fdopen(fd, "w");
+    memset(&hdr, 0, sizeof hdr);
+    hdr.magic = JITDUMP_MAGIC;
+    hdr.version = 1;
+    hdr.total_size = sizeof hdr;
+    hdr.elf_mach = EM_TCC_TARGET;
+    hdr.pid = getpid();
+    hdr.timestamp = jit_dump_time();
+    fwrite(&hdr, sizeof hdr, 1, jit_dump_file);
+    return jit_dump_file;
+}
+
+/* the line numbers of one function from the stabs */
+static void jit_dump_lines(FILE *f, Stab_Sym *sym, Stab_Sym *end,
+                           addr_t func_addr, const char *file)
+{
+    struct jitdump_debug d;
+    struct jitdump_line l;
+    Stab_Sym *p;
+    int n, len;
+
+    len = strlen(file) + 1;
+    n = 0;
+    for (p = sym; p < end && p->n_type != N_FUN; p++)
+        n += p->n_type == N_SLINE;
+    if (0 == n)
+        return;
+    d.rec.id = JIT_CODE_DEBUG_INFO;
+    d.rec.total_size = sizeof d + n * (sizeof l + len);
+    d.rec.timestamp = jit_dump_time();
+    d.code_addr = func_addr;
+    d.nr_entry = n;
+    fwrite(&d, sizeof d, 1, f);
+    for (p = sym; p < end && p->n_type != N_FUN; p++) {
+        if (p->n_type != N_SLINE)
+            continue;
+        l.addr = func_addr + p->n_value;
+        l.line = p->n_desc;
+        l.discrim = 0;
+        fwrite(&l, sizeof l, 1, f);
+        fwrite(file, len, 1, f);
+    }
+}
+
+/* append the functions placed by this relocation: their line numbers
+   (which perf wants first), then their code */
+static void jit_dump_add(TCCState *s1, unsigned long stab_start)
+{
+    struct jitdump_load r;
+    ElfW(Sym) *sym, *sym_end;
+    Stab_Sym *stab, *stab_end;
+    const char *incl_files[INCLUDE_STACK_SIZE], *name, *str;
+    int incl_index, len;
+    FILE *f;
+
+    f = jit_dump_open();
+    if (!f)
+        return;
+
+    if (stab_section && stab_section->data_offset > stab_start) {
+        if (0 == stab_start)
+            stab_start = sizeof(Stab_Sym);
+        stab = (Stab_Sym *)(stab_section->data + stab_start);
+        stab_end = (Stab_Sym *)(stab_section->data + stab_section->data_offset);
+        incl_index = 0;
+        for (; stab < stab_end; stab++) {
+            str = stabstr_section->data + stab->n_strx;
+            switch (stab->n_type) {
+            case N_FUN:
+                if (stab->n_strx && incl_index)
+                    jit_dump_lines(f, stab + 1, stab_end,
+                                   jit_debug_stab_addr(stab->n_value),
+                                   incl_files[incl_index - 1]);
+                break;
+            case N_BINCL:
+            add_incl:
+                if (incl_index < INCLUDE_STACK_SIZE)
+                    incl_files[incl_index++] = str;
+                break;
+            case N_EINCL:
+                if (incl_index > 1)
+                    incl_index--;
+                break;
+            case N_SO:
+                if (stab->n_strx == 0) {
+                    incl_index = 0;
+                } else {
+                    len = strlen(str);
+                    if (len > 0 && str[len - 1] != '/')
+                        goto add_incl;
+                }
+                break;
+            }
+        }
+    }
+
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for (sym = (ElfW(Sym) *)symtab_section->data + 1; sym < sym_end; sym++) {
+        if (ELFW(ST_TYPE)(sym->st_info) != STT_FUNC
+            || sym->st_shndx <= s1->nb_relocated_sections
+            || sym->st_shndx >= s1->nb_sections
+            || 0 == sym->st_size)
+            continue;
+        name = strtab_section->data + sym->st_name;
+        len = strlen(name) + 1;
+        r.rec.id = JIT_CODE_LOAD;
+        r.rec.total_size = sizeof r + len + sym->st_size;
+        r.rec.timestamp = jit_dump_time();
+        r.pid = getpid();
+        r.tid = syscall(SYS_gettid);
+        r.vma = r.code_addr = sym->st_value;
+        r.code_size = sym->st_size;
+        r.code_index = jit_dump_index++;
+        fwrite(&r, sizeof r, 1, f);
+        fwrite(name, len, 1, f);
+        fwrite((void *)(addr_t)sym->st_value, sym->st_size, 1, f);
+    }
+    fflush(f);
+}
+#endif /* __linux__ */
+
+/* after a relocation, before freeze_sections() */
+static void jit_debug_relocated(TCCState *s1)
+{
+    unsigned long stab_start;
+
+    /* code added after a relocation has new .stab sections */
+    if (stab_section && stab_section->sh_num > s1->nb_relocated_sections
+        && s1->nb_relocated_sections)
+        s1->jit_debug_stab = 0;
+    stab_start = s1->jit_debug_stab;
+    jit_debug_add(s1);
+#ifdef __linux__
+    if (s1->jit_dump)
+        jit_dump_add(s1, stab_start);
+#endif
+}
+#endif /* CONFIG_TCC_JIT_DEBUG */
+
 /* ------------------------------------------------------------- */
 #ifdef CONFIG_TCC_BACKTRACE
 
@@ -393,6 +1344,22 @@ static void rt_error(ucontext_t *uc, const char *fmt, ...)
     va_end(ap);
     fprintf(stderr, "\n");
 
+#ifdef CONFIG_TCC_BCHECK
+    if (rt_bound_error_fp && *rt_bound_error_fp) {
+        /* found by the check code of a function: start from its pc
+           and frame pointer, passed to __bound_index_error() */
+        addr_t fp = *rt_bound_error_fp;
+        pc = *rt_bound_error_pc;
+        for(i=0;i<rt_num_callers;i++) {
+            pc = rt_printline(pc, i ? "by" : "at");
+            if ((pc == (addr_t)rt_prog_main && pc) || fp <= 0x1000)
+                break;
+            pc = ((addr_t *)fp)[1];
+            fp = ((addr_t *)fp)[0];
+        }
+        return;
+    }
+#endif
     for(i=0;i<rt_num_callers;i++) {
         if (rt_get_caller_pc(&pc, uc, i) < 0)
             break;
@@ -709,25 +1676,281 @@ static TCCSyms tcc_syms[] = {
     { NULL, NULL },
 };
 
-ST_FUNC void *resolve_sym(TCCState *s1, const char *symbol)
+#endif /* CONFIG_TCC_STATIC */
+
+#ifndef _WIN32
+/* ------------------------------------------------------------- */
+/* Process-wide cache of the host symbols resolved for -run code,
+   shared by all states.  Filled lazily from dlsym() (or from
+   tcc_syms[] in a static build) and in bulk by tcc_add_symbols()
+   with a NULL state.  Misses are not cached, so that libraries
+   opened later are still seen.  The dlsym() results are dropped when
+   a library was closed since, and are not kept at all where this
+   cannot be known.  Nothing which can call tcc_error() is done with
+   the lock held. */
+
+typedef struct RtSym {
+    struct RtSym *next;
+    void *ptr;
+    int dl; /* from dlsym() */
+    char name[1];
+} RtSym;
+
+static RtSym **rt_sym_hash;
+static unsigned rt_sym_hash_size, rt_nb_syms;
+#ifdef CONFIG_TCC_STATIC
+static int rt_sym_static_done;
+#endif
+
+#ifdef CONFIG_TCCBOOT
+#define rt_sym_lock()
+#define rt_sym_unlock()
+#else
+#include <pthread.h>
+static pthread_mutex_t rt_sym_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define rt_sym_lock() pthread_mutex_lock(&rt_sym_mutex)
+#define rt_sym_unlock() pthread_mutex_unlock(&rt_sym_mutex)
+#endif
+
+#if !defined CONFIG_TCC_STATIC && (defined __GLIBC__ || defined __FreeBSD__)
+#include <link.h>
+#define RT_SYM_DL_CACHE
+static unsigned long long rt_sym_dl_subs;
+
+static int rt_dl_subs_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    *(unsigned long long *)data = info->dlpi_subs;
+    return 1;
+}
+
+/* number of libraries unloaded by the process so far */
+static unsigned long long rt_dl_subs(void)
+{
+    unsigned long long subs = 0;
+    dl_iterate_phdr(rt_dl_subs_cb, &subs);
+    return subs;
+}
+#endif
+
+static unsigned rt_sym_hash_name(const char *name)
+{
+    unsigned h = 1;
+    while (*name)
+        h = h * 263 + *(unsigned char *)name++;
+    return h;
+}
+
+static RtSym *rt_sym_new(const char *name, void *ptr, int dl)
+{
+    RtSym *p;
+    int len = strlen(name);
+    p = tcc_malloc(sizeof *p + len);
+    memcpy(p->name, name, len + 1);
+    p->ptr = ptr;
+    p->dl = dl;
+    return p;
+}
+
+/* take the lock, with room in the table for 'n' more symbols */
+static void rt_sym_lock_for(unsigned n)
 {
-    TCCSyms *p;
-    p = tcc_syms;
-    while (p->str != NULL) {
-        if (!strcmp(p->str, symbol))
-            return p->ptr;
-        p++;
+    RtSym **tab = NULL, *p, *next, **pp;
+    unsigned i, size, tab_size = 0;
+
+    for (;;) {
+        rt_sym_lock();
+        /* keep the load factor below one */
+        size = rt_sym_hash_size ? rt_sym_hash_size : 256;
+        while (rt_nb_syms + n > size)
+            size *= 2;
+        if (size == rt_sym_hash_size)
+            break;
+        if (size == tab_size) {
+            for (i = 0; i < rt_sym_hash_size; i++) {
+                for (p = rt_sym_hash[i]; p; p = next) {
+                    next = p->next;
+                    pp = &tab[rt_sym_hash_name(p->name) & (size - 1)];
+                    p->next = *pp;
+                    *pp = p;
+                }
+            }
+            tcc_free(rt_sym_hash);
+            rt_sym_hash = tab;
+            rt_sym_hash_size = size;
+            return;
+        }
+        rt_sym_unlock();
+        tcc_free(tab);
+        tab = tcc_mallocz(size * sizeof *tab);
+        tab_size = size;
     }
-    return NULL;
+    tcc_free(tab);
 }
 
-#elif !defined(_WIN32)
+/* must be called with the lock held.  Return 'p' if it was linked in,
+   NULL if the symbol was there (and was set if 'p' is not from
+   dlsym()) */
+static RtSym *rt_sym_put(RtSym *p)
+{
+    RtSym *q, **pp;
+
+    pp = &rt_sym_hash[rt_sym_hash_name(p->name) & (rt_sym_hash_size - 1)];
+    for (q = *pp; q; q = q->next) {
+        if (!strcmp(q->name, p->name)) {
+            if (!p->dl) {
+                q->ptr = p->ptr;
+                q->dl = 0;
+            }
+            return NULL;
+        }
+    }
+    p->next = *pp;
+    *pp = p;
+    rt_nb_syms++;
+    return p;
+}
 
-ST_FUNC void *resolve_sym(TCCState *s1, const char *sym)
+/* must be called with the lock held */
+static RtSym *rt_sym_find(const char *name)
 {
-    return dlsym(RTLD_DEFAULT, sym);
+    RtSym *p;
+    if (!rt_sym_hash)
+        return NULL;
+    p = rt_sym_hash[rt_sym_hash_name(name) & (rt_sym_hash_size - 1)];
+    while (p && strcmp(p->name, name))
+        p = p->next;
+    return p;
 }
 
-#endif /* CONFIG_TCC_STATIC */
+#ifdef RT_SYM_DL_CACHE
+/* must be called with the lock held: drop the dlsym() results if a
+   library was unloaded since they were found. Return them in a list
+   to be freed without the lock. */
+static RtSym *rt_sym_check_dl(unsigned long long subs)
+{
+    RtSym *p, **pp, *list = NULL;
+    unsigned i;
+
+    if (subs == rt_sym_dl_subs)
+        return NULL;
+    rt_sym_dl_subs = subs;
+    for (i = 0; i < rt_sym_hash_size; i++) {
+        for (pp = &rt_sym_hash[i]; (p = *pp) != NULL; ) {
+            if (p->dl) {
+                *pp = p->next;
+                p->next = list;
+                list = p;
+                rt_nb_syms--;
+            } else {
+                pp = &p->next;
+            }
+        }
+    }
+    return list;
+}
+#endif
+
+static void rt_sym_free_list(RtSym *p)
+{
+    RtSym *next;
+    for (; p; p = next) {
+        next = p->next;
+        tcc_free(p);
+    }
+}
+
+/* add the symbols of 'tab', and free it. '*done' (if not NULL) is
+   set with the lock held */
+static void rt_sym_add(RtSym **tab, int nb_syms, int *done)
+{
+    RtSym *unused = NULL;
+    int i;
+
+    rt_sym_lock_for(nb_syms);
+    for (i = 0; i < nb_syms; i++) {
+        if (!rt_sym_put(tab[i])) {
+            tab[i]->next = unused;
+            unused = tab[i];
+        }
+    }
+    if (done)
+        *done = 1;
+    rt_sym_unlock();
+    rt_sym_free_list(unused);
+    tcc_free(tab);
+}
+
+#ifdef CONFIG_TCC_STATIC
+static void rt_sym_add_static(void)
+{
+    RtSym **tab;
+    int i, n;
+
+    for (n = 0; tcc_syms[n].str; n++)
+        ;
+    tab = tcc_malloc(n * sizeof *tab);
+    for (i = 0; i < n; i++)
+        tab[i] = rt_sym_new(tcc_syms[i].str, tcc_syms[i].ptr, 0);
+    rt_sym_add(tab, n, &rt_sym_static_done);
+}
+#endif
+
+ST_FUNC void *resolve_sym(TCCState *s1, const char *symbol)
+{
+    RtSym *p, *unused = NULL;
+    void *ptr = NULL;
+#ifdef RT_SYM_DL_CACHE
+    unsigned long long subs = rt_dl_subs();
+#endif
+
+    rt_sym_lock();
+#ifdef RT_SYM_DL_CACHE
+    unused = rt_sym_check_dl(subs);
+#endif
+#ifdef CONFIG_TCC_STATIC
+    if (!rt_sym_static_done) {
+        rt_sym_unlock();
+        rt_sym_add_static();
+        rt_sym_lock();
+    }
+#endif
+    p = rt_sym_find(symbol);
+    if (p)
+        ptr = p->ptr;
+    rt_sym_unlock();
+    rt_sym_free_list(unused);
+#ifndef CONFIG_TCC_STATIC
+    if (!p) {
+        /* dlsym() outside the lock: it may be slow and takes its own */
+        ptr = dlsym(RTLD_DEFAULT, symbol);
+#ifdef RT_SYM_DL_CACHE
+        if (ptr) {
+            p = rt_sym_new(symbol, ptr, 1);
+            rt_sym_lock_for(1);
+            /* not if a library was unloaded meanwhile */
+            if (subs == rt_sym_dl_subs && rt_sym_put(p))
+                p = NULL;
+            rt_sym_unlock();
+            tcc_free(p);
+        }
+#endif
+    }
+#endif
+    return ptr;
+}
+
+ST_FUNC void rt_add_symbols(const TCCSymbol *syms, int nb_syms)
+{
+    RtSym **tab;
+    int i;
+
+    /* allocated without the lock */
+    tab = tcc_malloc(nb_syms * sizeof *tab);
+    for (i = 0; i < nb_syms; i++)
+        tab[i] = rt_sym_new(syms[i].name, (void *)syms[i].val, 0);
+    rt_sym_add(tab, nb_syms, NULL);
+}
+
+#endif /* !_WIN32 */
 #endif /* TCC_IS_NATIVE */
 /* ------------------------------------------------------------- */
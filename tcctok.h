@@ -233,7 +233,12 @@
      DEF(TOK___bound_ptr_indir16, "__bound_ptr_indir16")
      DEF(TOK___bound_local_new, "__bound_local_new")
      DEF(TOK___bound_local_delete, "__bound_local_delete")
-#ifdef TCC_TARGET_PE
+     DEF(TOK___bound_index_error, "__bound_index_error")
+#ifdef TCC_TARGET_X86_64
+     DEF(TOK___bound_t1, "__bound_t1")
+     DEF(TOK___bound_locks, "__bound_locks")
+#endif
+#if defined TCC_TARGET_PE || defined TCC_TARGET_X86_64
      DEF(TOK_malloc, "malloc")
      DEF(TOK_free, "free")
      DEF(TOK_realloc, "realloc")
@@ -243,6 +248,11 @@
      DEF(TOK_memmove, "memmove")
      DEF(TOK_strlen, "strlen")
      DEF(TOK_strcpy, "strcpy")
+     DEF(TOK_strncpy, "strncpy")
+     DEF(TOK_strcat, "strcat")
+     DEF(TOK_strchr, "strchr")
+     DEF(TOK_strcmp, "strcmp")
+     DEF(TOK_memcmp, "memcmp")
 #endif
 #if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
      DEF(TOK_alloca, "alloca")
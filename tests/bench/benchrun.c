@@ -0,0 +1,456 @@
+/*
+ * benchrun - measure tcc against the host compiler
+ *
+ * For each kernel <name>.xe (see bench.h) and each compiler (tcc,
+ * cc -O0, cc -O2) record the compile time, the size of the binary and
+ * the run time of the kernel, then compile the generated inputs
+ * (compile speed only), preprocess one of them with tcc -E and cpp and
+ * assemble a generated .s file with tcc and cc (time and output size).
+ * Results are written one line per measurement:
+ *
+ *   name compiler compile_ms size_bytes run_ms checksum
+ *
+ * '-' stands for a value which was not measured.  Times are the best of
+ * several runs.  'benchrun -compare old.txt new.txt' prints the ratios
+ * between two result files.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_FORMAT 1
+#define MAX_RESULTS 256
+
+typedef struct Result {
+    char name[32], compiler[16];
+    double compile_ms, run_ms;
+    long size;
+    char checksum[32];
+} Result;
+
+static const char *srcdir = ".";
+static const char *tcc_cmd, *cc_cmd, *cpp_cmd;
+static int nb_runs = 3;
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* run 'cmd' nb_runs times, return best wall time or -1 on failure */
+static double time_cmd(const char *cmd)
+{
+    double t, best = -1;
+    int i;
+
+    for (i = 0; i < nb_runs; i++) {
+        t = now_ms();
+        if (system(cmd) != 0)
+            return -1;
+        t = now_ms() - t;
+        if (best < 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* run a kernel nb_runs times, return best time reported by the kernel */
+static double run_kernel(const char *cmd, char *checksum)
+{
+    char buf[256];
+    double best = -1;
+    unsigned sum;
+    long us;
+    FILE *f;
+    int i;
+
+    for (i = 0; i < nb_runs; i++) {
+        f = popen(cmd, "r");
+        if (!f)
+            return -1;
+        if (!fgets(buf, sizeof buf, f)
+            || sscanf(buf, "%u %ld", &sum, &us) != 2)
+            us = -1;
+        if (pclose(f) != 0 || us < 0)
+            return -1;
+        sprintf(checksum, "%u", sum);
+        if (best < 0 || us / 1000.0 < best)
+            best = us / 1000.0;
+    }
+    return best;
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return -1;
+    return st.st_size;
+}
+
+/* the host compiler does not know the tcc keywords: translate with
+   xe2c.h and turn '#consider' into '#include' */
+static int make_c_source(const char *xe, const char *c)
+{
+    char buf[1024];
+    FILE *in, *out;
+
+    in = fopen(xe, "r");
+    if (!in)
+        return -1;
+    out = fopen(c, "w");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    fprintf(out, "#include \"xe2c.h\"\n#line 1 \"%s\"\n", xe);
+    while (fgets(buf, sizeof buf, in)) {
+        if (!strncmp(buf, "#consider", 9))
+            fprintf(out, "#include%s", buf + 9);
+        else
+            fputs(buf, out);
+    }
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+static void print_result(FILE *f, Result *r)
+{
+    fprintf(f, "%-12s %-8s ", r->name, r->compiler);
+    if (r->compile_ms < 0)
+        fprintf(f, "%10s ", "-");
+    else
+        fprintf(f, "%10.2f ", r->compile_ms);
+    if (r->size < 0)
+        fprintf(f, "%10s ", "-");
+    else
+        fprintf(f, "%10ld ", r->size);
+    if (r->run_ms < 0)
+        fprintf(f, "%10s ", "-");
+    else
+        fprintf(f, "%10.2f ", r->run_ms);
+    fprintf(f, "%s\n", r->checksum[0] ? r->checksum : "-");
+}
+
+static void print_header(FILE *f)
+{
+    fprintf(f, "# tcc benchmark results, format %d\n", BENCH_FORMAT);
+    fprintf(f, "# %-10s %-8s %10s %10s %10s %s\n", "name", "compiler",
+            "compile_ms", "size_bytes", "run_ms", "checksum");
+}
+
+/* compile and run one kernel ('run' set) or compile one generated input */
+static void bench_one(Result *r, const char *name, const char *compiler,
+                      const char *cmd, int is_tcc, int run)
+{
+    char src[256], out[256], buf[1024];
+
+    memset(r, 0, sizeof *r);
+    r->compile_ms = r->run_ms = r->size = -1;
+    snprintf(r->name, sizeof r->name, "%s", name);
+    snprintf(r->compiler, sizeof r->compiler, "%s", compiler);
+
+    if (run)
+        snprintf(src, sizeof src, "%s/%s.xe", srcdir, name);
+    else
+        snprintf(src, sizeof src, "%s.xe", name);
+    if (!is_tcc) {
+        snprintf(buf, sizeof buf, "%s-%s.c", name, compiler);
+        if (make_c_source(src, buf) < 0)
+            return;
+        strcpy(src, buf);
+    }
+    snprintf(out, sizeof out, "%s-%s%s", name, compiler, run ? "" : ".o");
+    snprintf(buf, sizeof buf, "%s %s -I%s -w -o %s %s", cmd,
+             run ? "" : "-c", srcdir, out, src);
+    r->compile_ms = time_cmd(buf);
+    if (r->compile_ms < 0) {
+        fprintf(stderr, "benchrun: failed: %s\n", buf);
+        return;
+    }
+    r->size = file_size(out);
+    if (!run)
+        return;
+
+    snprintf(buf, sizeof buf, "exec ./%s", out);
+    r->run_ms = run_kernel(buf, r->checksum);
+    if (r->run_ms < 0 && is_tcc) {
+        /* executables may not work with all libc versions, the
+           kernel measures its own time so -run is equivalent */
+        snprintf(buf, sizeof buf, "%s -I%s -run %s", cmd, srcdir, src);
+        r->run_ms = run_kernel(buf, r->checksum);
+    }
+    if (r->run_ms < 0)
+        fprintf(stderr, "benchrun: %s: run failed\n", out);
+}
+
+/* generated inputs for compile speed: many small functions and one
+   large table with a long switch */
+static void gen_inputs(void)
+{
+    FILE *f;
+    int i, j;
+
+    f = fopen("gen_funcs.xe", "w");
+    if (f) {
+        fprintf(f, "struct node { xe key, val; struct node *next; };\n"
+                "xe ext(xe x);\n");
+        for (i = 0; i < 2000; i++) {
+            fprintf(f, "xe f%d(struct node *n, xe x)\n{\n"
+                    "    xe s = %d;\n"
+                    "    freeflowing (n) {\n"
+                    "        maybe (n->key == x + %d)\n"
+                    "            s += n->val * %d;\n"
+                    "        perhaps_and_equally_valid\n"
+                    "            s ^= n->key << %d;\n"
+                    "        n = n->next;\n"
+                    "    }\n"
+                    "    return s + ext(x);\n}\n",
+                    i, i, i & 63, i % 7 + 1, i & 15);
+        }
+        fclose(f);
+    }
+    f = fopen("gen_table.xe", "w");
+    if (f) {
+        fprintf(f, "static const xe table[] = {\n");
+        for (i = 0; i < 2000; i++) {
+            for (j = 0; j < 16; j++)
+                fprintf(f, "%d, ", (i * 16 + j) * 2654435761u % 100000);
+            fprintf(f, "\n");
+        }
+        fprintf(f, "};\nxe lookup(xe x)\n{\n    give_consent_to (x) {\n");
+        for (i = 0; i < 4000; i++)
+            fprintf(f, "    currently_identifying_as %d:"
+                    " return table[%d] + x * %d;\n", i * 3, i, i & 31);
+        fprintf(f, "    }\n    return -1;\n}\n");
+        fclose(f);
+    }
+    /* plain C for the preprocessors: macros, strings, numbers and
+       runs of empty lines */
+    f = fopen("gen_pp.c", "w");
+    if (f) {
+        fprintf(f, "#define STR(x) #x\n#define CAT(a, b) a##b\n"
+                "#define ADD(a, b) ((a) + (b))\n"
+                "#define ENTRY(n) { CAT(id_, n), STR(n), ADD(n, 0x10) },\n");
+        for (i = 0; i < 20000; i++) {
+            fprintf(f, "#define K%d ADD(%d, K%d)\n", i, i, i / 2);
+            fprintf(f, "static const struct entry e%d[] = { ENTRY(%d) "
+                    "{ %d, \"text %d\\n\", K%d } };\n", i, i, i, i, i);
+            if (i % 16 == 0)
+                fprintf(f, "\n\n\n\n");
+        }
+        fclose(f);
+    }
+    /* x86 instructions which both the i386 and the x86-64 assemblers
+       accept */
+    f = fopen("gen_asm.s", "w");
+    if (f) {
+        fprintf(f, "    .text\n");
+        for (i = 0; i < 20000; i++) {
+            fprintf(f, "f%d:\n"
+                    "    movl $%d, %%eax\n    addl %%ebx, %%eax\n"
+                    "    subl $%d, %%ecx\n    xorl %%edx, %%edx\n"
+                    "    imull %%esi, %%edi\n    shll $%d, %%eax\n"
+                    "    sarl %%cl, %%edx\n    andl $0x%x, %%ebx\n"
+                    "    orl %%eax, %%ecx\n    testl %%eax, %%eax\n"
+                    "    incl %%eax\n    negl %%ecx\n    notl %%edx\n"
+                    "    movb $%d, %%al\n    movw $%d, %%bx\n"
+                    "    sete %%al\n    cmpl $%d, %%eax\n"
+                    "    jne f%d\n    jmp 1f\n1:\n    nop\n    ret\n",
+                    i, i * 7, i & 127, i & 31, i & 0xfff, i & 127, i,
+                    i * 3, i / 2);
+        }
+        fclose(f);
+    }
+}
+
+/* time 'cmd opt -o out src' and report the size of the output */
+static void bench_tool(Result *r, const char *name, const char *compiler,
+                       const char *cmd, const char *opt, const char *src)
+{
+    char out[256], buf[1024];
+
+    memset(r, 0, sizeof *r);
+    r->compile_ms = r->run_ms = r->size = -1;
+    snprintf(r->name, sizeof r->name, "%s", name);
+    snprintf(r->compiler, sizeof r->compiler, "%s", compiler);
+    snprintf(out, sizeof out, "%s-%s.out", name, compiler);
+    snprintf(buf, sizeof buf, "%s %s -o %s %s", cmd, opt, out, src);
+    r->compile_ms = time_cmd(buf);
+    if (r->compile_ms < 0) {
+        fprintf(stderr, "benchrun: failed: %s\n", buf);
+        return;
+    }
+    r->size = file_size(out);
+    if (r->compile_ms > 0)
+        printf("# %s %s: %.1f MB/s\n", name, compiler,
+               file_size(src) / r->compile_ms / 1000.0);
+}
+
+static int load_results(const char *file, Result *res)
+{
+    char buf[512], c[32], s[32], r[32];
+    FILE *f;
+    int n;
+
+    f = fopen(file, "r");
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    n = 0;
+    while (n < MAX_RESULTS && fgets(buf, sizeof buf, f)) {
+        if (buf[0] == '#')
+            continue;
+        if (sscanf(buf, "%31s %15s %31s %31s %31s %31s", res[n].name,
+                   res[n].compiler, c, s, r, res[n].checksum) != 6)
+            continue;
+        res[n].compile_ms = c[0] == '-' ? -1 : atof(c);
+        res[n].size = s[0] == '-' ? -1 : atol(s);
+        res[n].run_ms = r[0] == '-' ? -1 : atof(r);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static void print_ratio(double o, double n)
+{
+    if (o > 0 && n >= 0)
+        printf(" %9.3f", n / o);
+    else
+        printf(" %9s", "-");
+}
+
+/* print new/old ratios for compile time, size and run time */
+static int compare(const char *old_file, const char *new_file)
+{
+    static Result o[MAX_RESULTS], n[MAX_RESULTS];
+    int no, nn, i, j;
+
+    no = load_results(old_file, o);
+    nn = load_results(new_file, n);
+    printf("# %-10s %-8s %9s %9s %9s (new/old)\n", "name", "compiler",
+           "compile", "size", "run");
+    for (i = 0; i < nn; i++) {
+        for (j = 0; j < no; j++)
+            if (!strcmp(o[j].name, n[i].name)
+                && !strcmp(o[j].compiler, n[i].compiler))
+                break;
+        if (j == no)
+            continue;
+        printf("%-12s %-8s", n[i].name, n[i].compiler);
+        print_ratio(o[j].compile_ms, n[i].compile_ms);
+        print_ratio(o[j].size, n[i].size);
+        print_ratio(o[j].run_ms, n[i].run_ms);
+        if (strcmp(o[j].checksum, n[i].checksum))
+            printf(" checksum changed");
+        printf("\n");
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    printf("usage: benchrun -tcc cmd [-cc cmd] [-cpp cmd] [-n runs]"
+           " [-srcdir dir] [-o file] kernels...\n"
+           "       benchrun -compare old.txt new.txt\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *cc_opts[] = { "-O0", "-O2" };
+    static const char *gen_names[] = { "gen_funcs", "gen_table" };
+    static Result res[MAX_RESULTS];
+    const char *outfile = NULL;
+    char cmd[512], compiler[16];
+    int i, j, nb_res, first_kernel;
+    FILE *f;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-compare") && i + 2 < argc)
+            return compare(argv[i + 1], argv[i + 2]);
+        if (i + 1 == argc)
+            usage();
+        if (!strcmp(argv[i], "-tcc"))
+            tcc_cmd = argv[++i];
+        else if (!strcmp(argv[i], "-cc"))
+            cc_cmd = argv[++i][0] ? argv[i] : NULL;
+        else if (!strcmp(argv[i], "-cpp"))
+            cpp_cmd = argv[++i][0] ? argv[i] : NULL;
+        else if (!strcmp(argv[i], "-n"))
+            nb_runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-srcdir"))
+            srcdir = argv[++i];
+        else if (!strcmp(argv[i], "-o"))
+            outfile = argv[++i];
+        else
+            usage();
+    }
+    if (!tcc_cmd || nb_runs < 1)
+        usage();
+    first_kernel = i;
+    gen_inputs();
+
+    print_header(stdout);
+    nb_res = 0;
+    for (i = first_kernel; i < argc + 2; i++) {
+        const char *name = i < argc ? argv[i] : gen_names[i - argc];
+        int run = i < argc;
+        for (j = -1; j < 2; j++) {
+            if (j >= 0 && !cc_cmd)
+                break;
+            if (nb_res == MAX_RESULTS)
+                break;
+            if (j < 0) {
+                strcpy(compiler, "tcc");
+                snprintf(cmd, sizeof cmd, "%s", tcc_cmd);
+            } else {
+                snprintf(compiler, sizeof compiler, "cc%s", cc_opts[j]);
+                snprintf(cmd, sizeof cmd, "%s %s", cc_cmd, cc_opts[j]);
+            }
+            bench_one(&res[nb_res], name, compiler, cmd, j < 0, run);
+            print_result(stdout, &res[nb_res]);
+            fflush(stdout);
+            if (j >= 0 && res[nb_res].checksum[0]
+                && strcmp(res[nb_res].checksum, res[nb_res - 1 - j].checksum))
+                fprintf(stderr, "benchrun: %s: checksum differs from tcc\n",
+                        name);
+            nb_res++;
+        }
+    }
+
+    /* preprocessor and assembler throughput */
+    for (j = 0; j < 4 && nb_res < MAX_RESULTS; j++) {
+        if ((j == 1 && !cpp_cmd) || (j == 3 && !cc_cmd))
+            continue;
+        if (j < 2)
+            bench_tool(&res[nb_res], "gen_pp", j ? "cpp" : "tcc",
+                       j ? cpp_cmd : tcc_cmd, "-E", "gen_pp.c");
+        else
+            bench_tool(&res[nb_res], "gen_asm", j == 3 ? "cc" : "tcc",
+                       j == 3 ? cc_cmd : tcc_cmd, "-c", "gen_asm.s");
+        print_result(stdout, &res[nb_res]);
+        nb_res++;
+    }
+
+    if (outfile) {
+        f = fopen(outfile, "w");
+        if (!f) {
+            perror(outfile);
+            return 1;
+        }
+        print_header(f);
+        for (i = 0; i < nb_res; i++)
+            print_result(f, &res[i]);
+        fclose(f);
+        printf("results written to %s\n", outfile);
+    }
+    return 0;
+}
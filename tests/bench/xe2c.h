@@ -0,0 +1,16 @@
+/* map the tcc keywords to C so that the benchmark kernels can also be
+   built with the host compiler (see benchrun.c) */
+#define xe int
+#define trans void
+#define strong char
+#define maybe if
+#define perhaps_and_equally_valid else
+#define freeflowing while
+#define leave break
+#define consider_jump goto
+#define perform do
+#define give_consent_to switch
+#define currently_identifying_as case
+#define studFling long
+#define fatpride double
+#define mealTicket short
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "libtcc.h"
 
@@ -15,16 +16,27 @@ int add(int a, int b)
     return a + b;
 }
 
+/* and these through tcc_add_symbols() */
+int mul(int a, int b)
+{
+    return a * b;
+}
+
+int sub(int a, int b)
+{
+    return a - b;
+}
+
 char my_program[] =
-"int fib(int n)\n"
+"xe fib(xe n)\n"
 "{\n"
-"    if (n <= 2)\n"
+"    maybe (n <= 2)\n"
 "        return 1;\n"
-"    else\n"
+"    perhaps_and_equally_valid\n"
 "        return fib(n-1) + fib(n-2);\n"
 "}\n"
 "\n"
-"int foo(int n)\n"
+"xe foo(xe n)\n"
 "{\n"
 "    printf(\"Hello World!\\n\");\n"
 "    printf(\"fib(%d) = %d\\n\", n, fib(n));\n"
@@ -32,23 +44,101 @@ char my_program[] =
 "    return 0;\n"
 "}\n";
 
-int main(int argc, char **argv)
+static const char *lib_path;
+
+static TCCState *new_state(int output_type)
 {
     TCCState *s;
-    int (*func)(int);
 
     s = tcc_new();
     if (!s) {
         fprintf(stderr, "Could not create tcc state\n");
         exit(1);
     }
+    if (lib_path)
+        tcc_set_lib_path(s, lib_path);
+    /* MUST BE CALLED before any compilation */
+    tcc_set_output_type(s, output_type);
+    return s;
+}
+
+/* compile and relocate more code into a state which is relocated
+   already: the functions of both generations can be called */
+static int test_incremental(void)
+{
+    TCCState *s;
+    int (*one)(int), (*two)(int);
+
+    s = new_state(TCC_OUTPUT_MEMORY);
+    if (tcc_compile_string(s, "xe one(xe n) { return n + 1; }") == -1
+        || tcc_relocate(s, TCC_RELOCATE_AUTO) < 0)
+        return 1;
+    one = tcc_get_symbol(s, "one");
+    if (tcc_compile_string(s, "xe two(xe n) { return one(n) * 2; }") == -1
+        || tcc_relocate(s, TCC_RELOCATE_AUTO) < 0)
+        return 1;
+    two = tcc_get_symbol(s, "two");
+    if (!one || !two || one(20) != 21 || two(20) != 42)
+        return 1;
+    printf("incremental: one(20) = %d, two(20) = %d\n", one(20), two(20));
+    tcc_delete(s);
+    return 0;
+}
+
+static int test_add_symbols(void)
+{
+    static const TCCSymbol syms[] = {
+        { "mul", mul },
+        { "sub", sub },
+    };
+    TCCState *s;
+    int (*func)(int);
+
+    s = new_state(TCC_OUTPUT_MEMORY);
+    if (tcc_compile_string(s, "xe calc(xe n) { return sub(mul(n, n), n); }") == -1)
+        return 1;
+    tcc_add_symbols(s, syms, 2);
+    if (tcc_relocate(s, TCC_RELOCATE_AUTO) < 0)
+        return 1;
+    func = tcc_get_symbol(s, "calc");
+    if (!func || func(7) != 42)
+        return 1;
+    printf("tcc_add_symbols: calc(7) = %d\n", func(7));
+    tcc_delete(s);
+    return 0;
+}
+
+/* an object file written to a temporary file, which stays open */
+static int test_output_fd(void)
+{
+    TCCState *s;
+    FILE *f;
+    char buf[4];
+
+    s = new_state(TCC_OUTPUT_OBJ);
+    f = tmpfile();
+    if (!f || tcc_compile_string(s, "xe three(trans) { return 3; }") == -1
+        || tcc_output_fd(s, fileno(f)) < 0)
+        return 1;
+    tcc_delete(s);
+    if (lseek(fileno(f), 0, SEEK_SET) != 0
+        || read(fileno(f), buf, 4) != 4 || memcmp(buf, "\177ELF", 4))
+        return 1;
+    printf("tcc_output_fd: ELF object written\n");
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    TCCState *s;
+    int (*func)(int);
 
     /* if tcclib.h and libtcc1.a are not installed, where can we find them */
     if (argc == 2 && !memcmp(argv[1], "lib_path=",9))
-        tcc_set_lib_path(s, argv[1]+9);
+        lib_path = argv[1]+9;
 
-    /* MUST BE CALLED before any compilation */
-    tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
+    s = new_state(TCC_OUTPUT_MEMORY);
 
     if (tcc_compile_string(s, my_program) == -1)
         return 1;
@@ -72,5 +162,7 @@ int main(int argc, char **argv)
     /* delete the state */
     tcc_delete(s);
 
+    if (test_incremental() || test_add_symbols() || test_output_fd())
+        return 1;
     return 0;
 }
@@ -92,6 +92,13 @@ enum {
 /* defined if function parameters must be evaluated in reverse order */
 #define INVERT_FUNC_PARAMS
 
+/* defined if memcpy()/memset() of constant size can be generated
+   inline (see gen_memcpy() and gen_memset()). Up to INLINE_MEMOPS_MAX
+   bytes are moved with unrolled loads and stores, above that with
+   'rep movs/stos'. */
+#define INLINE_MEMOPS
+#define INLINE_MEMOPS_MAX 128
+
 /* pointer size, in bytes */
 #define PTR_SIZE 8
 
@@ -112,6 +119,17 @@ enum {
 #define R_JMP_SLOT  R_X86_64_JUMP_SLOT
 #define R_COPY      R_X86_64_COPY
 
+#ifndef TCC_TARGET_PE
+/* DWARF register numbers and prolog layout for -gdwarf call frame info:
+   'push %rbp' ends at +1, 'mov %rsp,%rbp' at +4 */
+#define DWARF_REG_SP    7
+#define DWARF_REG_FP    6
+#define DWARF_REG_RA    16
+#define DWARF_CFA_PUSH  1
+#define DWARF_CFA_FRAME 4
+#define DWARF_R_PC32    R_X86_64_PC32
+#endif
+
 #define ELF_START_ADDR 0x08048000
 #define ELF_PAGE_SIZE  0x1000
 
@@ -154,6 +172,10 @@ ST_DATA const int reg_classes[NB_REGS] = {
 
 static unsigned long func_sub_sp_offset;
 static int func_ret_sub;
+#ifdef CONFIG_TCC_BCHECK
+static unsigned long func_bound_offset;
+static int func_bound_ind;
+#endif
 
 /* XXX: make it faster ? */
 void g(int c)
@@ -595,6 +617,18 @@ void store(int r, SValue *v)
     }
 }
 
+#ifdef CONFIG_TCC_BCHECK
+/* generate a call to a runtime function of tcc */
+static void gen_static_call(int v)
+{
+    Sym *sym;
+
+    sym = external_global_sym(v, &func_old_type, 0);
+    oad(0xe8, -4);
+    greloc(cur_text_section, sym, ind-4, R_X86_64_PC32);
+}
+#endif
+
 /* 'is_jmp' is '1' if it is a jump */
 static void gcall_or_jmp(int is_jmp)
 {
@@ -881,6 +915,9 @@ void gfunc_epilog(void)
 {
     int v, saved_ind;
 
+#ifdef CONFIG_TCC_DWARF
+    func_leave_ind = ind;
+#endif
     o(0xc9); /* leave */
     if (func_ret_sub == 0) {
         o(0xc3); /* ret */
@@ -1090,6 +1127,11 @@ void gfunc_call(int nb_args)
     int nb_sse_args = 0;
     int sse_reg, gen_reg;
 
+#ifdef CONFIG_TCC_BCHECK
+    if (tcc_state->do_bounds_check)
+        gbound_args(nb_args);
+#endif
+
     /* calculate the number of integer/float register arguments */
     for(i = 0; i < nb_args; i++) {
         mode = classify_x86_64_arg(&vtop[-i].type, NULL, &size, &align, &reg_count);
@@ -1507,6 +1549,22 @@ void gfunc_prolog(CType *func_type)
         sym_push(sym->v & ~SYM_FIELD, type,
                  VT_LOCAL | VT_LVAL, param_addr);
     }
+
+#ifdef CONFIG_TCC_BCHECK
+    /* leave some room for bound checking code, after the register
+       parameters are saved */
+    if (tcc_state->do_bounds_check) {
+        func_bound_offset = lbounds_section->data_offset;
+        func_bound_ind = ind;
+        o(0x441f0f); /* nopl 0(%rax,%rax,1) (lbound section pointer) */
+        g(0x00);
+        g(0x00);
+        o(0x1f0f); /* nopl (%rax) (frame pointer) */
+        g(0x00);
+        o(0x801f0f); /* nopl 0(%rax) (call to function) */
+        gen_le32(0);
+    }
+#endif
 }
 
 /* generate function epilog */
@@ -1514,6 +1572,51 @@ void gfunc_epilog(void)
 {
     int v, saved_ind;
 
+#ifdef CONFIG_TCC_BCHECK
+    if (tcc_state->do_bounds_check
+     && func_bound_offset != lbounds_section->data_offset) {
+        addr_t *bounds_ptr;
+        Sym *sym_data;
+        /* add end of table info */
+        bounds_ptr = section_ptr_add(lbounds_section, sizeof(addr_t));
+        *bounds_ptr = 0;
+        /* generate bound local allocation */
+        saved_ind = ind;
+        ind = func_bound_ind;
+        sym_data = get_sym_ref(&char_pointer_type, lbounds_section,
+                               func_bound_offset, lbounds_section->data_offset);
+        o(0x3d8d48); /* lea xxx(%rip), %rdi */
+        gen_addrpc32(VT_SYM, sym_data, 0);
+        o(0xee8948); /* mov %rbp, %rsi */
+        gen_static_call(TOK___bound_local_new);
+
+        ind = saved_ind;
+        /* generate bound check local freeing, keep the returned
+           value, if any */
+        o(0x20ec8348); /* sub $32, %rsp */
+        o(0x24048948); /* mov %rax, (%rsp) */
+        o(0x24548948); /* mov %rdx, 8(%rsp) */
+        g(0x08);
+        o(0x44d60f66); /* movq %xmm0, 16(%rsp) */
+        o(0x1024);
+        o(0x4cd60f66); /* movq %xmm1, 24(%rsp) */
+        o(0x1824);
+        o(0x3d8d48); /* lea xxx(%rip), %rdi */
+        gen_addrpc32(VT_SYM, sym_data, 0);
+        o(0xee8948); /* mov %rbp, %rsi */
+        gen_static_call(TOK___bound_local_delete);
+        o(0x24048b48); /* mov (%rsp), %rax */
+        o(0x24548b48); /* mov 8(%rsp), %rdx */
+        g(0x08);
+        o(0x447e0ff3); /* movq 16(%rsp), %xmm0 */
+        o(0x1024);
+        o(0x4c7e0ff3); /* movq 24(%rsp), %xmm1 */
+        o(0x1824);
+    }
+#endif
+#ifdef CONFIG_TCC_DWARF
+    func_leave_ind = ind;
+#endif
     o(0xc9); /* leave */
     if (func_ret_sub == 0) {
         o(0xc3); /* ret */
@@ -1843,19 +1946,6 @@ void gen_opf(int op)
         }
     } else {
         if (op >= TOK_ULT && op <= TOK_GT) {
-            /* if saved lvalue, then we must reload it */
-            r = vtop->r;
-            fc = vtop->c.ul;
-            if ((r & VT_VALMASK) == VT_LLOCAL) {
-                SValue v1;
-                r = get_reg(RC_INT);
-                v1.type.t = VT_PTR;
-                v1.r = VT_LOCAL | VT_LVAL;
-                v1.c.ul = fc;
-                load(r, &v1);
-                fc = 0;
-            }
-
             if (op == TOK_EQ || op == TOK_NE) {
                 swapped = 0;
             } else {
@@ -1873,6 +1963,20 @@ void gen_opf(int op)
                 vswap();
             }
             assert(!(vtop[-1].r & VT_LVAL));
+
+            /* if saved lvalue, then we must reload it (gv() above may
+               also have saved the register operand) */
+            r = vtop->r;
+            fc = vtop->c.ul;
+            if ((r & VT_VALMASK) == VT_LLOCAL) {
+                SValue v1;
+                r = get_reg(RC_INT);
+                v1.type.t = VT_PTR;
+                v1.r = VT_LOCAL | VT_LVAL;
+                v1.c.ul = fc;
+                load(r, &v1);
+                fc = 0;
+            }
             
             if ((vtop->type.t & VT_BTYPE) == VT_DOUBLE)
                 o(0x66);
@@ -1904,12 +2008,20 @@ void gen_opf(int op)
                 a = 6;
                 break;
             }
+            if (swapped) {
+                assert(vtop->r & VT_LVAL);
+                gv(RC_FLOAT);
+                vswap();
+            }
+            assert(!(vtop[-1].r & VT_LVAL));
+
             ft = vtop->type.t;
             fc = vtop->c.ul;
             assert((ft & VT_BTYPE) != VT_LDOUBLE);
             
             r = vtop->r;
-            /* if saved lvalue, then we must reload it */
+            /* if saved lvalue, then we must reload it (gv() above may
+               also have saved the register operand) */
             if ((vtop->r & VT_VALMASK) == VT_LLOCAL) {
                 SValue v1;
                 r = get_reg(RC_INT);
@@ -1920,13 +2032,6 @@ void gen_opf(int op)
                 fc = 0;
             }
             
-            assert(!(vtop[-1].r & VT_LVAL));
-            if (swapped) {
-                assert(vtop->r & VT_LVAL);
-                gv(RC_FLOAT);
-                vswap();
-            }
-            
             if ((ft & VT_BTYPE) == VT_DOUBLE) {
                 o(0xf2);
             } else {
@@ -2089,6 +2194,155 @@ void ggoto(void)
     vtop--;
 }
 
+/* bound check support functions */
+#ifdef CONFIG_TCC_BCHECK
+
+/* page table of lib/bcheck.c */
+#define BOUND_T1_BITS 25
+#define BOUND_T2_BITS 14
+#define BOUND_T3_BITS 8
+#define BOUND_E_BITS  5
+/* __bound_locks[]: 2^BOUND_LOCK_BITS locks of 64 bytes */
+#define BOUND_LOCK_BITS 6
+#define BOUND_LOCK_SHIFT 6
+
+/* distance from the size checked inline to the call of the check
+   function, in gen_bounded_ptr_add() */
+#define BOUND_SIZE_OFFSET 22
+
+/* call __bound_index_error() with the address of the check and the
+   frame pointer, it does not return */
+ST_FUNC void gen_bounded_index_error(void)
+{
+    o(0x3d8d48); /* lea -7(%rip), %rdi */
+    gen_le32(-7);
+    o(0xee8948); /* mov %rbp, %rsi */
+    gen_static_call(TOK___bound_index_error);
+}
+
+/* generate a bounded pointer addition */
+ST_FUNC void gen_bounded_ptr_add(void)
+{
+    int jmp_slow[6], i;
+    Sym *sym;
+
+    gv2(RC_RAX, RC_RDX);
+    /* save all temporary registers */
+    vtop -= 2;
+    save_regs(0);
+    /* arguments of __bound_ptr_add() */
+    o(0xc78948); /* mov %rax, %rdi */
+    o(0xd68948); /* mov %rdx, %rsi */
+    /* inline check against the first region of the page table entry,
+       call the check function when the pointer is elsewhere or when
+       the entry is being changed: like bound_find() in lib/bcheck.c,
+       read the sequence count of its lock before and after it */
+    o(0xe8c148); /* shr $x, %rax */
+    g(BOUND_T2_BITS + BOUND_T3_BITS - BOUND_LOCK_SHIFT);
+    o(0x25); /* and $x, %eax */
+    gen_le32(((1 << BOUND_LOCK_BITS) - 1) << BOUND_LOCK_SHIFT);
+    sym = external_global_sym(TOK___bound_locks, &char_pointer_type, 0);
+    o(0x158d48); /* lea __bound_locks(%rip), %rdx */
+    gen_addrpc32(VT_SYM, sym, 0);
+    o(0xc20148); /* add %rax, %rdx */
+    o(0x028b4c); /* mov (%rdx), %r8 */
+    o(0xc0f641); /* test $1, %r8b */
+    g(1);
+    o(0x75); /* jne slow */
+    g(0);
+    jmp_slow[0] = ind;
+    o(0xf88948); /* mov %rdi, %rax */
+    o(0xe8c148); /* shr $x, %rax */
+    g(BOUND_T2_BITS + BOUND_T3_BITS);
+    o(0x3d48); /* cmp $x, %rax */
+    gen_le32(1 << BOUND_T1_BITS);
+    o(0x73); /* jae slow */
+    g(0);
+    jmp_slow[1] = ind;
+    sym = external_global_sym(TOK___bound_t1, &char_pointer_type, 0);
+    o(0x0d8b48); /* mov __bound_t1(%rip), %rcx */
+    gen_addrpc32(VT_SYM, sym, 0);
+    o(0xc10c8b48); /* mov (%rcx,%rax,8), %rcx */
+    o(0xc98548); /* test %rcx, %rcx */
+    o(0x74); /* je slow */
+    g(0);
+    jmp_slow[2] = ind;
+    o(0xf88948); /* mov %rdi, %rax */
+    o(0xe8c148); /* shr $x, %rax */
+    g(BOUND_T3_BITS - BOUND_E_BITS);
+    o(0x25); /* and $x, %eax */
+    gen_le32(((1 << BOUND_T2_BITS) - 1) << BOUND_E_BITS);
+    o(0xc10148); /* add %rax, %rcx */
+    o(0xf88948); /* mov %rdi, %rax */
+    o(0x012b48); /* sub (%rcx), %rax */
+    o(0x08413b48); /* cmp 8(%rcx), %rax */
+    o(0x77); /* ja slow */
+    g(0);
+    jmp_slow[3] = ind;
+    o(0x30848d48); /* lea x(%rax,%rsi,1), %rax */
+    gen_le32(0); /* size of the access, see gen_bounded_ptr_deref() */
+    o(0x08413b48); /* cmp 8(%rcx), %rax */
+    o(0x77); /* ja slow */
+    g(0);
+    jmp_slow[4] = ind;
+    o(0x023b4c); /* cmp (%rdx), %r8 */
+    o(0x75); /* jne slow */
+    g(0);
+    jmp_slow[5] = ind;
+    o(0x37048d48); /* lea (%rdi,%rsi,1), %rax */
+    o(0x05eb); /* jmp after the call */
+    for (i = 0; i < 6; i++)
+        cur_text_section->data[jmp_slow[i] - 1] = ind - jmp_slow[i];
+    gen_static_call(TOK___bound_ptr_add);
+    /* returned pointer is in rax */
+    vtop++;
+    vtop->r = TREG_RAX | VT_BOUNDED;
+    /* address of bounding function call point */
+    vtop->c.ul = (cur_text_section->reloc->data_offset - sizeof(ElfW(Rela)));
+}
+
+/* patch pointer addition in vtop so that pointer dereferencing is
+   also tested */
+ST_FUNC void gen_bounded_ptr_deref(void)
+{
+    int func;
+    int size, align;
+    ElfW(Rela) *rel;
+    Sym *sym;
+
+    size = 0;
+    /* XXX: put that code in generic part of tcc */
+    if (!is_float(vtop->type.t)) {
+        if (vtop->r & VT_LVAL_BYTE)
+            size = 1;
+        else if (vtop->r & VT_LVAL_SHORT)
+            size = 2;
+    }
+    if (!size)
+        size = type_size(&vtop->type, &align);
+    switch(size) {
+    case  1: func = TOK___bound_ptr_indir1; break;
+    case  2: func = TOK___bound_ptr_indir2; break;
+    case  4: func = TOK___bound_ptr_indir4; break;
+    case  8: func = TOK___bound_ptr_indir8; break;
+    case 12: func = TOK___bound_ptr_indir12; break;
+    case 16: func = TOK___bound_ptr_indir16; break;
+    default:
+        tcc_error("unhandled size when dereferencing bounded pointer");
+        func = 0;
+        break;
+    }
+
+    /* patch relocation and the inline check */
+    rel = (ElfW(Rela) *)(cur_text_section->reloc->data + vtop->c.ul);
+    sym = external_global_sym(func, &func_old_type, 0);
+    if (!sym->c)
+        put_extern_sym(sym, NULL, 0, 0);
+    rel->r_info = ELF64_R_INFO(sym->c, ELF64_R_TYPE(rel->r_info));
+    *(int *)(cur_text_section->data + rel->r_offset - BOUND_SIZE_OFFSET) = size;
+}
+#endif
+
 /* Save the stack pointer onto the stack and return the location of its address */
 ST_FUNC void gen_vla_sp_save(int addr) {
     /* mov %rsp,addr(%rbp)*/
@@ -2125,6 +2379,143 @@ ST_FUNC void gen_vla_alloc(CType *type, int align) {
 #endif
 }
 
+/* move 'size' bytes from 'off'(%rsi) to 'off'(%rdi), or store the
+   pattern in %r11/%xmm7 if 'fill' is true. All offsets must fit in
+   a signed byte. */
+static void gen_mem_chunks(int size, int fill)
+{
+    int n, off;
+
+    for (off = 0; size > 0; off += n, size -= n) {
+#ifndef TCC_TARGET_PE
+        if (size >= 16) {
+            n = 16;
+            if (!fill)
+                o(0x7e6f0ff3), g(off); /* movdqu off(%rsi),%xmm7 */
+            o(0x7f7f0ff3); /* movdqu %xmm7,off(%rdi) */
+        } else
+#endif
+        if (size >= 8) {
+            n = 8;
+            if (!fill)
+                o(0x5e8b4c), g(off); /* mov off(%rsi),%r11 */
+            o(0x5f894c); /* mov %r11,off(%rdi) */
+        } else if (size >= 4) {
+            n = 4;
+            if (!fill)
+                o(0x5e8b44), g(off); /* mov off(%rsi),%r11d */
+            o(0x5f8944); /* mov %r11d,off(%rdi) */
+        } else if (size >= 2) {
+            n = 2;
+            if (!fill)
+                o(0x5e8b4466), g(off); /* mov off(%rsi),%r11w */
+            o(0x5f894466); /* mov %r11w,off(%rdi) */
+        } else {
+            n = 1;
+            if (!fill)
+                o(0x5e8a44), g(off); /* mov off(%rsi),%r11b */
+            o(0x5f8844); /* mov %r11b,off(%rdi) */
+        }
+        g(off);
+    }
+}
+
+/* move the address on top of the value stack to 'r' (%rsi or %rdi)
+   and pop it */
+static void gen_mem_addr(int r)
+{
+    int s;
+
+    s = gv(RC_INT);
+    orex(1, r, s, 0x89); /* mov s,r */
+    o(0xc0 + REG_VALUE(r) + REG_VALUE(s) * 8);
+    vpop();
+}
+
+/* copy 'size' bytes from the address in vtop to the address in
+   vtop[-1] without calling memcpy(). Both values are popped. Small
+   copies are unrolled, larger ones use 'rep movsq'. */
+ST_FUNC void gen_memcpy(int size)
+{
+    if (size > INLINE_MEMOPS_MAX)
+        save_reg(TREG_RCX);
+#ifdef TCC_TARGET_PE
+    /* %rsi and %rdi are callee saved on win64 */
+    o(0x5756); /* push %rsi; push %rdi */
+#else
+    if (size >= 16)
+        save_reg(TREG_XMM7);
+#endif
+    gen_mem_addr(TREG_RSI);
+    gen_mem_addr(TREG_RDI);
+    if (size > INLINE_MEMOPS_MAX) {
+        oad(0xb9, size >> 3); /* mov $size/8,%ecx */
+        o(0xa548f3); /* rep movsq */
+        if (size & 4)
+            o(0xa5); /* movsl */
+        if (size & 2)
+            o(0xa566); /* movsw */
+        if (size & 1)
+            o(0xa4); /* movsb */
+    } else {
+        gen_mem_chunks(size, 0);
+    }
+#ifdef TCC_TARGET_PE
+    o(0x5e5f); /* pop %rdi; pop %rsi */
+#endif
+}
+
+/* fill 'size' bytes at the address in vtop with the byte 'c' without
+   calling memset(). The address is popped. */
+ST_FUNC void gen_memset(int size, int c)
+{
+    uint64_t pattern;
+
+    pattern = (uint8_t)c * 0x0101010101010101ULL;
+    if (size > INLINE_MEMOPS_MAX) {
+        save_reg(TREG_RAX);
+        save_reg(TREG_RCX);
+    }
+#ifdef TCC_TARGET_PE
+    o(0x57); /* push %rdi */
+#else
+    if (size >= 16)
+        save_reg(TREG_XMM7);
+#endif
+    gen_mem_addr(TREG_RDI);
+    if (pattern == 0) {
+        o(0xdb314d); /* xor %r11,%r11 */
+    } else {
+        o(0xbb49); /* mov $pattern,%r11 */
+        gen_le64(pattern);
+    }
+    if (size > INLINE_MEMOPS_MAX) {
+        o(0xd8894c); /* mov %r11,%rax */
+        oad(0xb9, size >> 3); /* mov $size/8,%ecx */
+        o(0xab48f3); /* rep stosq */
+        if (size & 4)
+            o(0xab); /* stosl */
+        if (size & 2)
+            o(0xab66); /* stosw */
+        if (size & 1)
+            o(0xaa); /* stosb */
+    } else {
+#ifndef TCC_TARGET_PE
+        if (size >= 16) {
+            if (pattern == 0)
+                o(0xffef0f66); /* pxor %xmm7,%xmm7 */
+            else
+                o(0x66), o(0xfb6e0f49), /* movq %r11,%xmm7 */
+                o(0xff6c0f66); /* punpcklqdq %xmm7,%xmm7 */
+        }
+#endif
+        gen_mem_chunks(size, 1);
+    }
+#ifdef TCC_TARGET_PE
+    o(0x5f); /* pop %rdi */
+#endif
+}
+
 
 /* end of x86-64 code generator */
 /*************************************************************/